@@ -24,6 +24,13 @@
 #include "utils.h"
 #include "dbutils.h"
 
+// khash allocations are tracked by the same allocator used by the rest of the extension
+#define kcalloc(N,Z)                            cloudsync_memory_zeroalloc((uint64_t)(N) * (uint64_t)(Z))
+#define kmalloc(Z)                              cloudsync_memory_alloc((sqlite3_uint64)(Z))
+#define krealloc(P,Z)                           cloudsync_memory_realloc((P), (sqlite3_uint64)(Z))
+#define kfree(P)                                cloudsync_memory_free(P)
+#include "khash.h"
+
 #ifndef CLOUDSYNC_OMIT_NETWORK
 #include "network.h"
 #endif
@@ -68,10 +75,22 @@ SQLITE_EXTENSION_INIT1
 #define CLOUDSYNC_DEFAULT_ALGO                  "cls"
 #define CLOUDSYNC_INIT_NTABLES                  128
 #define CLOUDSYNC_VALUE_NOTSET                  -1
+#define CLOUDSYNC_MERGE_CL_CACHE_SIZE           65536
+#define CLOUDSYNC_MERGE_STMT_CACHE_SIZE         8
+#define CLOUDSYNC_MERGE_MAX_COLUMNS             64
 #define CLOUDSYNC_MIN_DB_VERSION                0
 
 #define CLOUDSYNC_PAYLOAD_MINBUF_SIZE           512*1024
-#define CLOUDSYNC_PAYLOAD_VERSION               1
+#define CLOUDSYNC_PAYLOAD_VERSION               3       // 3: names dictionary and rows are split into independently compressed blocks
+#define CLOUDSYNC_PAYLOAD_VERSION_DICT          2       // 2: tbl and col_name are ids into the payload names dictionary
+#define CLOUDSYNC_PAYLOAD_VERSION_1             1       // 1: rows contain tbl and col_name (the only version decoded by older releases)
+#define CLOUDSYNC_PAYLOAD_VERSION_DEFAULT       CLOUDSYNC_PAYLOAD_VERSION_1
+#define CLOUDSYNC_PAYLOAD_BLOCK_SIZE            (256*1024)
+#define CLOUDSYNC_PAYLOAD_BLOCK_HEADER          8       // compressed size (0 if stored) + expanded size
+#define CLOUDSYNC_APPLY_ERRORS_MAX_GROUPS       64
+#define CLOUDSYNC_ESTIMATED_ROWS_DEFAULT        1000000 // meta rows assumed by the cost estimates when nothing is known about a table
+#define CLOUDSYNC_DEFER_META_BATCH              64      // deferred entries written by each multi-row INSERT
+#define CLOUDSYNC_DEFER_META_MAX_ENTRIES        262144  // deferred entries that force a flush before the commit
 #define CLOUDSYNC_PAYLOAD_SIGNATURE             'CLSY'
 #define CLOUDSYNC_PAYLOAD_APPLY_CALLBACK_KEY    "cloudsync_payload_apply_callback"
 
@@ -104,12 +123,39 @@ typedef struct {
     int             index;
 } cloudsync_pk_decode_context;
 
+typedef struct {
+    uint8_t         bytes[UUID_LEN];
+} cloudsync_siteid_key;
+
+#define siteid_hash_func(_key)              ((khint32_t)cloudsync_hash_bytes((const char *)(_key).bytes, UUID_LEN))
+#define siteid_hash_equal(_a, _b)           (memcmp((_a).bytes, (_b).bytes, UUID_LEN) == 0)
+
+// bidirectional site_id <-> cloudsync_site_id rowid dictionary
+KHASH_INIT(SITEID_TO_ORD, cloudsync_siteid_key, sqlite3_int64, 1, siteid_hash_func, siteid_hash_equal)
+KHASH_MAP_INIT_INT64(ORD_TO_SITEID, cloudsync_siteid_key)
+
 #define SYNCBIT_SET(_data)                  _data->insync = 1
 #define SYNCBIT_RESET(_data)                _data->insync = 0
 #define BUMP_SEQ(_data)                     ((_data)->seq += 1, (_data)->seq - 1)
 
+// case-insensitive name -> column index (same comparison used by SQLite for identifiers)
+#define name_hash_func(_key)                ((khint32_t)cloudsync_hash_nocase(_key))
+#define name_hash_equal(_a, _b)             (strcasecmp((_a), (_b)) == 0)
+KHASH_INIT(NAME_TO_INDEX, const char *, int, 1, name_hash_func, name_hash_equal)
+
+// exact name -> payload dictionary id (names are sent as they are, so the comparison is case-sensitive)
+#define dict_hash_func(_key)                ((khint32_t)cloudsync_hash_bytes((_key), strlen(_key)))
+#define dict_hash_equal(_a, _b)             (strcmp((_a), (_b)) == 0)
+KHASH_INIT(PAYLOAD_DICT, const char *, int, 1, dict_hash_func, dict_hash_equal)
+
 // MARK: -
 
+typedef struct {
+    uint64_t        mask;                           // bitmask of the merged columns (0 if the entry is unused)
+    uint64_t        tick;                           // last use, to evict the least recently used entry
+    sqlite3_stmt    *vm;
+} cloudsync_merge_stmt;
+
 typedef struct {
     table_algo      algo;                           // CRDT algoritm associated to the table
     char            *name;                          // table name
@@ -117,6 +163,7 @@ typedef struct {
     sqlite3_stmt    **col_merge_stmt;               // array of merge insert stmt (indexed by col_name)
     sqlite3_stmt    **col_value_stmt;               // array of column value stmt (indexed by col_name)
     int             *col_id;                        // array of column id
+    khash_t(NAME_TO_INDEX) *col_index;              // column name -> index in the arrays above
     int             ncols;                          // number of non primary key cols
     int             npks;                           // number of primary key cols
     bool            enabled;                        // flag to check if a table is enabled or disabled
@@ -126,6 +173,18 @@ typedef struct {
     
     char            **pk_name;                      // array of primary key names
     
+    // the meta table stores the fingerprint of the local column values (meta tables created by previous
+    // versions do not have the col_fingerprint column until cloudsync_init is called again)
+    bool            has_fingerprint;
+    
+    // in-memory high-water mark of the db_version values stored in the meta table
+    // (CLOUDSYNC_VALUE_NOTSET if unknown, it is lazily loaded from the meta table db_version index)
+    sqlite3_int64   max_db_version;
+    
+    // estimated number of rows in the meta table, used by the cloudsync_changes cost model
+    // (CLOUDSYNC_VALUE_NOTSET if unknown, it is lazily loaded from sqlite_stat1 or counted)
+    sqlite3_int64   estimated_rows;
+    
     // precompiled statements
     sqlite3_stmt    *meta_pkexists_stmt;            // check if a primary key already exist in the augmented table
     sqlite3_stmt    *meta_sentinel_update_stmt;     // update a local sentinel row
@@ -133,21 +192,127 @@ typedef struct {
     sqlite3_stmt    *meta_row_insert_update_stmt;   // insert/update a local row
     sqlite3_stmt    *meta_row_drop_stmt;            // delete rows from meta
     sqlite3_stmt    *meta_update_move_stmt;         // update rows in meta when pk changes
-    sqlite3_stmt    *meta_local_cl_stmt;            // compute local cl value
+    sqlite3_stmt    *meta_row_clocks_stmt;          // retrieve all the column clocks of a pk (local cl and col versions)
     sqlite3_stmt    *meta_winner_clock_stmt;        // get the rowid of the last inserted/updated row in the meta table
     sqlite3_stmt    *meta_merge_delete_drop;
     sqlite3_stmt    *meta_zero_clock_stmt;
     sqlite3_stmt    *meta_col_version_stmt;
     sqlite3_stmt    *meta_site_id_stmt;
+    sqlite3_stmt    *meta_max_db_version_stmt;      // retrieve the max db_version from the meta table
+    sqlite3_stmt    *meta_fingerprint_stmt;         // retrieve the value fingerprint of a column (if has_fingerprint)
+    sqlite3_stmt    *meta_deferred_stmt;            // write one deferred entry (lazily prepared)
+    sqlite3_stmt    *meta_deferred_batch_stmt;      // write CLOUDSYNC_DEFER_META_BATCH deferred entries (lazily prepared)
+    sqlite3_stmt    *meta_tombstone_clock_stmt;     // retrieve the clock of the sentinel row, used by the deferred flush (lazily prepared)
     
     sqlite3_stmt    *real_col_values_stmt;          // retrieve all column values based on pk
+    sqlite3_stmt    *real_row_exists_stmt;          // same query of real_col_values_stmt (or an existence check), used by the deferred flush (lazily prepared)
     sqlite3_stmt    *real_merge_delete_stmt;
     sqlite3_stmt    *real_merge_sentinel_stmt;
     
+    // multi-column merge statements, lazily prepared for the sets of columns that win together (LRU)
+    cloudsync_merge_stmt merge_multi_stmt[CLOUDSYNC_MERGE_STMT_CACHE_SIZE];
+    uint64_t        merge_multi_tick;
+    
 } cloudsync_table_context;
 
+// case-insensitive table name -> table context
+KHASH_INIT(NAME_TO_TABLE, const char *, cloudsync_table_context *, 1, name_hash_func, name_hash_equal)
+
+typedef struct {
+    char            *tbl;
+    int             code;
+    int             count;
+    sqlite3_int64   db_version;                     // first rejected change
+    sqlite3_int64   seq;
+    char            *message;                       // error message of the first rejected change
+} cloudsync_apply_error;
+
+typedef struct {
+    int             index;                          // column index in the table
+    sqlite3_value   *value;                         // winning value (owned)
+    sqlite3_int64   col_version;
+    sqlite3_int64   db_version;
+    sqlite3_int64   seq;
+    uint8_t         site_id[UUID_LEN];
+    int             site_len;
+} cloudsync_merge_pending;
+
+typedef struct {
+    cloudsync_table_context *table;
+    char            *pk;
+    int             pk_len;
+} cloudsync_row_key;
+
+#define rowkey_hash_func(_key)              ((khint32_t)cloudsync_hash_bytes((_key).pk, (size_t)(_key).pk_len) ^ (khint32_t)(uintptr_t)(_key).table)
+#define rowkey_hash_equal(_a, _b)           (((_a).table == (_b).table) && ((_a).pk_len == (_b).pk_len) && (memcmp((_a).pk, (_b).pk, (_a).pk_len) == 0))
+
+// (table, pk) -> local causal length of the rows merged by a payload
+KHASH_INIT(ROW_TO_CL, cloudsync_row_key, sqlite3_int64, 1, rowkey_hash_func, rowkey_hash_equal)
+
+// local column write not yet stored in the meta table (defer_meta setting): the writes of the same
+// (table, pk, column) in a transaction are collapsed and col_version is incremented by count at flush time
+typedef struct {
+    cloudsync_table_context *table;                 // NULL if the entry has been dropped
+    char            *pk;                            // allocated in the deferred arena
+    int             pk_len;
+    int             col_index;
+    int             count;                          // number of collapsed writes
+    sqlite3_int64   db_version;                     // last write
+    int             seq;
+    int             delete_count;                   // writes that precede the last local delete of the row (0 if none)
+    sqlite3_int64   delete_db_version;              // clock of the tombstone written by that delete
+    int             delete_seq;
+    sqlite3_value   *before;                        // column value before the first write (NULL for an insert)
+    sqlite3_int64   fingerprint;                    // computed by the flush from the current column value
+    bool            has_fingerprint;                // the last write is an update (an insert has no fingerprint)
+} cloudsync_deferred_meta;
+
+typedef struct {
+    cloudsync_table_context *table;
+    const char      *pk;
+    int             pk_len;
+    int             col_index;
+} cloudsync_meta_key;
+
+#define metakey_hash_func(_key)             ((khint32_t)cloudsync_hash_bytes((_key).pk, (size_t)(_key).pk_len) ^ (khint32_t)(uintptr_t)(_key).table ^ ((khint32_t)(_key).col_index * 0x9E3779B1u))
+#define metakey_hash_equal(_a, _b)          (((_a).table == (_b).table) && ((_a).col_index == (_b).col_index) && ((_a).pk_len == (_b).pk_len) && (memcmp((_a).pk, (_b).pk, (size_t)(_a).pk_len) == 0))
+
+// (table, pk, column) -> index of the deferred entry
+KHASH_INIT(META_DEFERRED, cloudsync_meta_key, int, 1, metakey_hash_func, metakey_hash_equal)
+
+// clocks of the (table, pk) row being merged: consecutive changes of the same row (a payload is sorted by db_version, seq
+// so all the columns changed in a transaction are adjacent) are resolved with a single meta table lookup
+typedef struct {
+    cloudsync_table_context *table;                 // table of the cached row (NULL if no row is cached)
+    char            *pk;                            // primary key of the cached row
+    int             pk_len;
+    int             pk_alloc;
+    sqlite3_int64   *col_version;                   // ncols+1 clocks (the tombstone is the last one), CLOUDSYNC_VALUE_NOTSET if missing
+    int             col_alloc;
+    bool            has_rows;                       // at least one clock exists (even for a column not in the current schema)
+    bool            batch;                          // keep the cached row between merges (set by cloudsync_payload_apply)
+    
+    // causal length of every row merged by the current payload, so a row that shows up again later in the
+    // payload can skip the clocks lookup when its causal length alone is enough to discard the change
+    khash_t(ROW_TO_CL) *local_cl;
+    
+    // winning columns of the cached row not yet written, flushed with a single multi-column UPSERT
+    bool            coalesce;                       // defer the column writes (set by cloudsync_payload_apply)
+    cloudsync_merge_pending *pending;
+    int             npending;
+    int             pending_alloc;
+} cloudsync_merge_group;
+
+// table and column names of a version 2 payload (names point inside the decoded buffer and are not NULL terminated)
+typedef struct {
+    char            **names;
+    int64_t         *lens;
+    int64_t         count;
+} cloudsync_payload_dict;
+
 struct cloudsync_pk_decode_bind_context {
     sqlite3_stmt    *vm;
+    cloudsync_payload_dict *dict;
     char            *tbl;
     int64_t         tbl_len;
     const void      *pk;
@@ -170,16 +335,44 @@ struct cloudsync_context {
     int             insync;
     int             debug;
     bool            merge_equal_values;
+    bool            apply_sorted;               // apply payload rows grouped by (tbl, pk) (apply_sorted setting)
+    int             apply_errors_max;           // max rows kept in the cloudsync_apply_errors table, 0 if disabled (apply_errors setting)
+    int             payload_version;            // version of the encoded payloads (payload_version setting)
+    
+    // changes rejected by the current payload apply, grouped by (table, error code)
+    cloudsync_apply_error *apply_errors;
+    int             apply_errors_count;
+    int             apply_errors_alloc;
+    
+    // end of the last page returned by cloudsync_payload_next, waiting for cloudsync_payload_ack
+    sqlite3_int64   page_db_version;
+    sqlite3_int64   page_seq;
+    
+    // local column writes buffered until the next flush (defer_meta setting)
+    bool            defer_meta;
+    khash_t(META_DEFERRED) *deferred_index;
+    cloudsync_deferred_meta *deferred;
+    int             deferred_count;             // used entries (including the dropped ones)
+    int             deferred_alloc;
+    int             deferred_live;              // entries still to be written
+    cloudsync_arena deferred_arena;             // primary keys of the entries, reset when the entries are cleared
+    
+    // buffers of a single function call (primary key encoding), released back to a mark when the call returns
+    cloudsync_arena arena;
     bool            temp_bool;                  // temporary value used in callback
     void            *aux_data;
     
     // stmts and context values
     bool            pragma_checked;             // we need to check PRAGMAs only once per transaction
-    sqlite3_stmt    *schema_version_stmt;
     sqlite3_stmt    *data_version_stmt;
     sqlite3_stmt    *db_version_stmt;
+    sqlite3_stmt    *db_version_store_stmt;
     sqlite3_stmt    *getset_siteid_stmt;
+    sqlite3_stmt    *siteid_lookup_stmt;
+    sqlite3_stmt    *siteid_max_ord_stmt;
+    sqlite3_vtab    *changes_vtab;              // connected cloudsync_changes vtab (owns the prepared statements cache)
     int             data_version;
+    int             cache_data_version;         // data_version used to validate the in-memory caches (high-water marks and site_id dictionary)
     int             schema_version;
     uint64_t        schema_hash;
     
@@ -189,15 +382,40 @@ struct cloudsync_context {
     // the version that the db will be set to at the end of the transaction
     // if that transaction were to commit at the time this value is checked
     sqlite3_int64   pending_db_version;
+    // db_version has been checked by the first call of the current write transaction
+    // (re-set on transaction commit or rollback)
+    bool            db_version_checked;
+    // the version stored in the cloudsync_db_version counter by the current write transaction
+    // (re-set on transaction commit or rollback)
+    sqlite3_int64   stored_db_version;
     // used to set an order inside each transaction
     int             seq;
+    // the caches have been validated (PRAGMA data_version) by the first merge of the current write transaction
+    // (re-set on transaction commit or rollback)
+    bool            caches_checked;
     
     // augmented tables are stored in-memory so we do not need to retrieve information about col names and cid
     // from the disk each time a write statement is performed
-    // we do also not need to use an hash map here because for few tables the direct in-memory comparison with table name is faster
+    // tables_index maps each (case-insensitive) table name to its context, so the lookup from triggers and merges
+    // does not depend on the number of augmented tables
     cloudsync_table_context **tables;
     int tables_count;
     int tables_alloc;
+    khash_t(NAME_TO_TABLE) *tables_index;
+    
+    // site_id dictionary, lazily filled so merges and cloudsync_changes do not need to access cloudsync_site_id
+    // for each change (the local site_id is always rowid 0 and it is never stored here)
+    khash_t(SITEID_TO_ORD) *siteid_to_ord;
+    khash_t(ORD_TO_SITEID) *ord_to_siteid;
+    uint8_t siteid_lookup_buffer[UUID_LEN];
+    // number of rows in cloudsync_site_id used by the cost estimates (CLOUDSYNC_VALUE_NOTSET if unknown)
+    sqlite3_int64 siteid_count;
+    // max cloudsync_site_id rowid before the first site_id inserted by the current transaction: the entries above it
+    // can be undone by a ROLLBACK TO, so they are verified before use (re-set on transaction commit or rollback)
+    sqlite3_int64 siteid_base_ord;
+    
+    // row clocks cache used by the merge functions
+    cloudsync_merge_group merge_group;
 };
 
 typedef struct {
@@ -206,6 +424,15 @@ typedef struct {
     size_t      bused;
     uint64_t    nrows;
     uint16_t    ncols;
+    uint8_t     version;            // encoded payload version, set before the first row is added
+    
+    // table and column names dictionary: rows reference each name by its index (in first-use order)
+    // and the dictionary is sent once, before the rows
+    khash_t(PAYLOAD_DICT) *dict;
+    char        **dict_names;
+    int         dict_count;
+    int         dict_alloc;
+    size_t      dict_size;          // encoded size of the names
 } cloudsync_network_payload;
 
 #ifdef _MSC_VER
@@ -237,9 +464,17 @@ bool force_uncompressed_blob = false;
 #define CHECK_FORCE_UNCOMPRESSED_BUFFER()
 #endif
 
-int db_version_rebuild_stmt (sqlite3 *db, cloudsync_context *data);
 int cloudsync_load_siteid (sqlite3 *db, cloudsync_context *data);
-int local_mark_insert_or_update_meta (sqlite3 *db, cloudsync_table_context *table, const char *pk, size_t pklen, const char *col_name, sqlite3_int64 db_version, int seq);
+int local_mark_insert_or_update_meta (sqlite3 *db, cloudsync_table_context *table, const char *pk, size_t pklen, const char *col_name, sqlite3_value *col_value, sqlite3_int64 db_version, int seq);
+void table_set_max_db_version (cloudsync_table_context *table, sqlite3_int64 db_version);
+void deferred_meta_clear (cloudsync_context *data);
+void deferred_meta_free (cloudsync_context *data);
+cloudsync_table_context *table_lookup (cloudsync_context *data, const char *table_name);
+int table_column_index (cloudsync_table_context *table, const char *col_name);
+void siteid_cache_clear (cloudsync_context *data);
+int merge_group_reset (cloudsync_context *data);
+void db_version_store_reset (cloudsync_context *data);
+bool db_version_stored_check (sqlite3 *db, cloudsync_context *data, sqlite3_int64 version);
 
 // MARK: - STMT Utils -
 
@@ -259,14 +494,6 @@ CLOUDSYNC_STMT_VALUE stmt_execute (sqlite3_stmt *stmt, cloudsync_context *data)
         } else {
             result = CLOUDSYNC_STMT_VALUE_UNCHANGED;
         }
-    } else if (stmt == data->schema_version_stmt) {
-        int version = sqlite3_column_int(stmt, 0);
-        if (version > data->schema_version) {
-            data->schema_version = version;
-        } else {
-            result = CLOUDSYNC_STMT_VALUE_UNCHANGED;
-        }
-        
     } else if (stmt == data->db_version_stmt) {
         data->db_version = (rc == SQLITE_DONE) ? CLOUDSYNC_MIN_DB_VERSION : sqlite3_column_int64(stmt, 0);
     }
@@ -316,12 +543,21 @@ int stmts_add_tocontext (sqlite3 *db, cloudsync_context *data) {
         DEBUG_SQL("data_version_stmt: %s", sql);
     }
     
-    if (data->schema_version_stmt == NULL) {
-        const char *sql = "PRAGMA schema_version;";
-        int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &data->schema_version_stmt, NULL);
-        DEBUG_STMT("schema_version_stmt %p", data->schema_version_stmt);
+    if (data->db_version_stmt == NULL) {
+        const char *sql = "SELECT version FROM cloudsync_db_version WHERE id=1;";
+        int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &data->db_version_stmt, NULL);
+        DEBUG_STMT("db_version_stmt %p", data->db_version_stmt);
+        if (rc != SQLITE_OK) return rc;
+        DEBUG_SQL("db_version_stmt: %s", sql);
+    }
+    
+    if (data->db_version_store_stmt == NULL) {
+        // the counter never goes back (and the row is re-created if missing)
+        const char *sql = "INSERT INTO cloudsync_db_version (id, version) VALUES (1, ?1) ON CONFLICT(id) DO UPDATE SET version=excluded.version WHERE version<excluded.version;";
+        int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &data->db_version_store_stmt, NULL);
+        DEBUG_STMT("db_version_store_stmt %p", data->db_version_store_stmt);
         if (rc != SQLITE_OK) return rc;
-        DEBUG_SQL("schema_version_stmt: %s", sql);
+        DEBUG_SQL("db_version_store_stmt: %s", sql);
     }
     
     if (data->getset_siteid_stmt == NULL) {
@@ -335,83 +571,27 @@ int stmts_add_tocontext (sqlite3 *db, cloudsync_context *data) {
         DEBUG_SQL("getset_siteid_stmt: %s", sql);
     }
     
-    return db_version_rebuild_stmt(db, data);
-}
-
-// MARK: - Database Version -
-
-char *db_version_build_query (sqlite3 *db) {
-    // this function must be manually called each time tables changes
-    // because the query plan changes too and it must be re-prepared
-    // unfortunately there is no other way
-    
-    // we need to execute a query like:
-    /*
-     SELECT max(version) as version FROM (
-         SELECT max(db_version) as version FROM "table1_cloudsync"
-         UNION ALL
-         SELECT max(db_version) as version FROM "table2_cloudsync"
-         UNION ALL
-         SELECT max(db_version) as version FROM "table3_cloudsync"
-         UNION
-         SELECT value as version FROM cloudsync_settings WHERE key = 'pre_alter_dbversion'
-     )
-     */
-    
-    // the good news is that the query can be computed in SQLite without the need to do any extra computation from the host language
-    const char *sql = "WITH table_names AS ("
-                      "SELECT format('%w', name) as tbl_name "
-                      "FROM sqlite_master "
-                      "WHERE type='table' "
-                      "AND name LIKE '%_cloudsync'"
-                      "), "
-                      "query_parts AS ("
-                      "SELECT 'SELECT max(db_version) as version FROM \"' || tbl_name || '\"' as part FROM table_names"
-                      "), "
-                      "combined_query AS ("
-                      "SELECT GROUP_CONCAT(part, ' UNION ALL ') || ' UNION SELECT value as version FROM cloudsync_settings WHERE key = ''pre_alter_dbversion''' as full_query FROM query_parts"
-                      ") "
-                      "SELECT CONCAT('SELECT max(version) as version FROM (', full_query, ');') FROM combined_query;";
-    return dbutils_text_select(db, sql);
-}
-
-int db_version_rebuild_stmt (sqlite3 *db, cloudsync_context *data) {
-    if (data->db_version_stmt) {
-        sqlite3_finalize(data->db_version_stmt);
-        data->db_version_stmt = NULL;
-    }
-    
-    sqlite3_int64 count = dbutils_table_settings_count_tables(db);
-    if (count == 0) return SQLITE_OK;
-    else if (count == -1) {
-        dbutils_context_result_error(data->sqlite_ctx, "%s", sqlite3_errmsg(db));
-        return SQLITE_ERROR;
+    if (data->siteid_lookup_stmt == NULL) {
+        const char *sql = "SELECT site_id FROM cloudsync_site_id WHERE rowid=?;";
+        int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &data->siteid_lookup_stmt, NULL);
+        DEBUG_STMT("siteid_lookup_stmt %p", data->siteid_lookup_stmt);
+        if (rc != SQLITE_OK) return rc;
+        DEBUG_SQL("siteid_lookup_stmt: %s", sql);
     }
     
-    char *sql = db_version_build_query(db);
-    if (!sql) return SQLITE_NOMEM;
-    DEBUG_SQL("db_version_stmt: %s", sql);
-    
-    int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &data->db_version_stmt, NULL);
-    DEBUG_STMT("db_version_stmt %p", data->db_version_stmt);
-    cloudsync_memory_free(sql);
-    return rc;
-}
-
-int db_version_rerun (sqlite3 *db, cloudsync_context *data) {
-    CLOUDSYNC_STMT_VALUE schema_changed = stmt_execute(data->schema_version_stmt, data);
-    if (schema_changed == CLOUDSYNC_STMT_VALUE_ERROR) return -1;
-    
-    if (schema_changed == CLOUDSYNC_STMT_VALUE_CHANGED) {
-        int rc = db_version_rebuild_stmt(db, data);
-        if (rc != SQLITE_OK) return -1;
+    if (data->siteid_max_ord_stmt == NULL) {
+        const char *sql = "SELECT max(rowid) FROM cloudsync_site_id;";
+        int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &data->siteid_max_ord_stmt, NULL);
+        DEBUG_STMT("siteid_max_ord_stmt %p", data->siteid_max_ord_stmt);
+        if (rc != SQLITE_OK) return rc;
+        DEBUG_SQL("siteid_max_ord_stmt: %s", sql);
     }
     
-    CLOUDSYNC_STMT_VALUE rc = stmt_execute(data->db_version_stmt, data);
-    if (rc == CLOUDSYNC_STMT_VALUE_ERROR) return -1;
-    return 0;
+    return SQLITE_OK;
 }
 
+// MARK: - Database Version -
+
 int db_version_check_uptodate (sqlite3 *db, cloudsync_context *data) {
     // perform a PRAGMA data_version to check if some other process write any data
     CLOUDSYNC_STMT_VALUE rc = stmt_execute(data->data_version_stmt, data);
@@ -420,23 +600,344 @@ int db_version_check_uptodate (sqlite3 *db, cloudsync_context *data) {
     // db_version is already set and there is no need to update it
     if (data->db_version != CLOUDSYNC_VALUE_NOTSET && rc == CLOUDSYNC_STMT_VALUE_UNCHANGED) return 0;
     
-    return db_version_rerun(db, data);
+    // read the cloudsync_db_version counter (a single primary key lookup),
+    // db_version_next keeps it in sync with the db_version used by each committed transaction
+    rc = stmt_execute(data->db_version_stmt, data);
+    if (rc == CLOUDSYNC_STMT_VALUE_ERROR) return -1;
+    return 0;
+}
+
+bool db_version_stored_check (sqlite3 *db, cloudsync_context *data, sqlite3_int64 version) {
+    // a ROLLBACK TO can undo the write of the counter while the transaction goes on using the same db_version,
+    // a savepoint can only be rolled back within an explicit transaction (BEGIN) and never in the middle of a statement
+    if (sqlite3_get_autocommit(db)) return true;
+    
+    sqlite3_stmt *vm = data->db_version_stmt;
+    int rc = sqlite3_step(vm);
+    sqlite3_int64 stored = (rc == SQLITE_ROW) ? sqlite3_column_int64(vm, 0) : CLOUDSYNC_VALUE_NOTSET;
+    sqlite3_reset(vm);
+    return (stored >= version);
+}
+
+int db_version_store (sqlite3 *db, cloudsync_context *data, sqlite3_int64 version) {
+    sqlite3_stmt *vm = data->db_version_store_stmt;
+    int rc = sqlite3_bind_int64(vm, 1, version);
+    if (rc == SQLITE_OK) rc = sqlite3_step(vm);
+    if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    
+    DEBUG_SQLITE_ERROR(rc, "db_version_store", db);
+    sqlite3_reset(vm);
+    if (rc == SQLITE_OK) data->stored_db_version = version;
+    return rc;
+}
+
+void db_version_store_reset (cloudsync_context *data) {
+    // a failed statement undoes its write of the counter, so the next call of the transaction must write it again
+    data->stored_db_version = CLOUDSYNC_VALUE_NOTSET;
 }
 
 sqlite3_int64 db_version_next (sqlite3 *db, cloudsync_context *data, sqlite3_int64 merging_version) {
-    int rc = db_version_check_uptodate(db, data);
-    if (rc != SQLITE_OK) return -1;
+    // once a write transaction is open no other connection can commit until it ends,
+    // so db_version is checked (PRAGMA data_version) only by the first call of each write transaction
+    if (!data->db_version_checked) {
+        int rc = db_version_check_uptodate(db, data);
+        if (rc != SQLITE_OK) return -1;
+        data->db_version_checked = (sqlite3_txn_state(db, "main") == SQLITE_TXN_WRITE);
+    }
     
     sqlite3_int64 result = data->db_version + 1;
     if (result < data->pending_db_version) result = data->pending_db_version;
     if (merging_version != CLOUDSYNC_VALUE_NOTSET && result < merging_version) result = merging_version;
     data->pending_db_version = result;
     
+    // the counter is written within the transaction that uses the version, just once per new version
+    // unless a failed statement (db_version_store_reset) or a ROLLBACK TO has undone that write
+    if (data->db_version_checked && (result > data->stored_db_version || !db_version_stored_check(db, data, result))) {
+        if (db_version_store(db, data, result) != SQLITE_OK) return -1;
+    }
+    
+    return result;
+}
+
+void table_set_max_db_version (cloudsync_table_context *table, sqlite3_int64 db_version) {
+    // an unknown high-water mark will be lazily loaded (and it will include this db_version)
+    if (table->max_db_version != CLOUDSYNC_VALUE_NOTSET && db_version > table->max_db_version) table->max_db_version = db_version;
+}
+
+bool cloudsync_context_validate_caches (cloudsync_context *data) {
+    // high-water marks and site_id dictionary are updated in-memory by this connection,
+    // so they must be discarded each time another connection writes to the database
+    sqlite3_stmt *vm = data->data_version_stmt;
+    if (!vm) return false;
+    
+    int rc = sqlite3_step(vm);
+    int version = (rc == SQLITE_ROW) ? sqlite3_column_int(vm, 0) : CLOUDSYNC_VALUE_NOTSET;
+    sqlite3_reset(vm);
+    if (version == CLOUDSYNC_VALUE_NOTSET) return false;
+    
+    if (version != data->cache_data_version) {
+        for (int i=0; i<data->tables_count; ++i) {
+            if (!data->tables[i]) continue;
+            data->tables[i]->max_db_version = CLOUDSYNC_VALUE_NOTSET;
+            data->tables[i]->estimated_rows = CLOUDSYNC_VALUE_NOTSET;
+        }
+        siteid_cache_clear(data);
+        data->siteid_count = CLOUDSYNC_VALUE_NOTSET;
+        data->cache_data_version = version;
+    }
+    
+    return true;
+}
+
+// MARK: - Site ID Dictionary -
+
+void siteid_cache_clear (cloudsync_context *data) {
+    if (data->siteid_to_ord) kh_clear(SITEID_TO_ORD, data->siteid_to_ord);
+    if (data->ord_to_siteid) kh_clear(ORD_TO_SITEID, data->ord_to_siteid);
+}
+
+void siteid_cache_free (cloudsync_context *data) {
+    if (data->siteid_to_ord) kh_destroy(SITEID_TO_ORD, data->siteid_to_ord);
+    if (data->ord_to_siteid) kh_destroy(ORD_TO_SITEID, data->ord_to_siteid);
+    data->siteid_to_ord = NULL;
+    data->ord_to_siteid = NULL;
+}
+
+void siteid_cache_remove (cloudsync_context *data, const void *site_id, sqlite3_int64 ord) {
+    if (!data->siteid_to_ord || !data->ord_to_siteid) return;
+    
+    cloudsync_siteid_key key;
+    memcpy(key.bytes, site_id, UUID_LEN);
+    khiter_t k = kh_get(SITEID_TO_ORD, data->siteid_to_ord, key);
+    if (k != kh_end(data->siteid_to_ord) && kh_value(data->siteid_to_ord, k) == ord) kh_del(SITEID_TO_ORD, data->siteid_to_ord, k);
+    
+    k = kh_get(ORD_TO_SITEID, data->ord_to_siteid, (khint64_t)ord);
+    if (k != kh_end(data->ord_to_siteid) && memcmp(kh_value(data->ord_to_siteid, k).bytes, site_id, UUID_LEN) == 0) kh_del(ORD_TO_SITEID, data->ord_to_siteid, k);
+}
+
+void siteid_cache_add (sqlite3 *db, cloudsync_context *data, const void *site_id, sqlite3_int64 ord) {
+    // a rowid assigned inside an explicit transaction is cached too: a ROLLBACK clears the dictionary and
+    // the entries that a ROLLBACK TO can undo are verified before use (siteid_cache_is_tentative)
+    if (!data->siteid_to_ord) data->siteid_to_ord = kh_init(SITEID_TO_ORD);
+    if (!data->ord_to_siteid) data->ord_to_siteid = kh_init(ORD_TO_SITEID);
+    if (!data->siteid_to_ord || !data->ord_to_siteid) return;
+    
+    cloudsync_siteid_key key;
+    memcpy(key.bytes, site_id, UUID_LEN);
+    
+    // a rowid re-assigned after a ROLLBACK TO replaces the site_id it was cached for
+    khiter_t k = kh_get(ORD_TO_SITEID, data->ord_to_siteid, (khint64_t)ord);
+    if (k != kh_end(data->ord_to_siteid) && memcmp(kh_value(data->ord_to_siteid, k).bytes, site_id, UUID_LEN) != 0) {
+        siteid_cache_remove(data, kh_value(data->ord_to_siteid, k).bytes, ord);
+    }
+    k = kh_get(SITEID_TO_ORD, data->siteid_to_ord, key);
+    if (k != kh_end(data->siteid_to_ord) && kh_value(data->siteid_to_ord, k) != ord) {
+        siteid_cache_remove(data, site_id, kh_value(data->siteid_to_ord, k));
+    }
+    
+    int ret;
+    k = kh_put(SITEID_TO_ORD, data->siteid_to_ord, key, &ret);
+    if (ret == -1) return;
+    kh_value(data->siteid_to_ord, k) = ord;
+    
+    k = kh_put(ORD_TO_SITEID, data->ord_to_siteid, (khint64_t)ord, &ret);
+    if (ret == -1) {
+        siteid_cache_clear(data);
+        return;
+    }
+    kh_value(data->ord_to_siteid, k) = key;
+}
+
+bool siteid_cache_is_tentative (sqlite3 *db, cloudsync_context *data, sqlite3_int64 ord) {
+    // only the rows inserted by the current transaction can be undone without a ROLLBACK (and they are above the base)
+    return (data->siteid_base_ord != CLOUDSYNC_VALUE_NOTSET) && (ord > data->siteid_base_ord) && (sqlite3_get_autocommit(db) == 0);
+}
+
+bool siteid_cache_verify (cloudsync_context *data, const void *site_id, sqlite3_int64 ord) {
+    // check that a tentative entry is still in cloudsync_site_id (a rowid lookup is cheaper than the get/set UPSERT)
+    sqlite3_stmt *vm = data->siteid_lookup_stmt;
+    bool verified = false;
+    int rc = sqlite3_bind_int64(vm, 1, ord);
+    if (rc == SQLITE_OK && sqlite3_step(vm) == SQLITE_ROW) {
+        verified = ((sqlite3_column_bytes(vm, 0) == UUID_LEN) && (memcmp(sqlite3_column_blob(vm, 0), site_id, UUID_LEN) == 0));
+    }
+    stmt_reset(vm);
+    
+    if (!verified) siteid_cache_remove(data, site_id, ord);
+    return verified;
+}
+
+int siteid_cache_getset_ord (sqlite3 *db, cloudsync_context *data, const char *site_id, int site_len, sqlite3_int64 *ord) {
+    // local site_id is always stored at rowid 0
+    if (site_len == UUID_LEN && memcmp(site_id, data->site_id, UUID_LEN) == 0) {
+        *ord = 0;
+        return SQLITE_OK;
+    }
+    
+    if (site_len == UUID_LEN && data->siteid_to_ord) {
+        cloudsync_siteid_key key;
+        memcpy(key.bytes, site_id, UUID_LEN);
+        khiter_t k = kh_get(SITEID_TO_ORD, data->siteid_to_ord, key);
+        if (k != kh_end(data->siteid_to_ord)) {
+            sqlite3_int64 value = kh_value(data->siteid_to_ord, k);
+            if (!siteid_cache_is_tentative(db, data, value) || siteid_cache_verify(data, site_id, value)) {
+                *ord = value;
+                return SQLITE_OK;
+            }
+        }
+    }
+    
+    // the rowids inserted from now on by this transaction are above the base
+    if (data->siteid_base_ord == CLOUDSYNC_VALUE_NOTSET && sqlite3_get_autocommit(db) == 0) {
+        sqlite3_stmt *vm = data->siteid_max_ord_stmt;
+        if (sqlite3_step(vm) == SQLITE_ROW) data->siteid_base_ord = sqlite3_column_int64(vm, 0);
+        stmt_reset(vm);
+    }
+    
+    // get/set site_id (a new site_id changes the number of rows)
+    sqlite3_stmt *vm = data->getset_siteid_stmt;
+    data->siteid_count = CLOUDSYNC_VALUE_NOTSET;
+    int rc = sqlite3_bind_blob(vm, 1, (const void *)site_id, site_len, SQLITE_STATIC);
+    if (rc != SQLITE_OK) goto cleanup_getset;
+    
+    rc = sqlite3_step(vm);
+    if (rc != SQLITE_ROW) goto cleanup_getset;
+    
+    *ord = sqlite3_column_int64(vm, 0);
+    rc = SQLITE_OK;
+    if (site_len == UUID_LEN) siteid_cache_add(db, data, site_id, *ord);
+    
+cleanup_getset:
+    stmt_reset(vm);
+    return rc;
+}
+
+sqlite3_int64 cloudsync_siteid_count (cloudsync_context *data) {
+    // rows are never deleted from cloudsync_site_id and the local site_id is rowid 0, so the max rowid counts them
+    // (an index lookup instead of a count of the table)
+    if (data->siteid_count == CLOUDSYNC_VALUE_NOTSET && data->siteid_max_ord_stmt) {
+        sqlite3_stmt *vm = data->siteid_max_ord_stmt;
+        if (sqlite3_step(vm) == SQLITE_ROW) data->siteid_count = sqlite3_column_int64(vm, 0) + 1;
+        stmt_reset(vm);
+    }
+    return data->siteid_count;
+}
+
+const void *cloudsync_siteid_from_ord (sqlite3 *db, cloudsync_context *data, sqlite3_int64 ord) {
+    if (ord == 0) return data->site_id;
+    
+    // a tentative entry is read again (the lookup below replaces or removes it)
+    bool tentative = false;
+    if (data->ord_to_siteid) {
+        khiter_t k = kh_get(ORD_TO_SITEID, data->ord_to_siteid, (khint64_t)ord);
+        if (k != kh_end(data->ord_to_siteid)) {
+            tentative = siteid_cache_is_tentative(db, data, ord);
+            if (!tentative) return kh_value(data->ord_to_siteid, k).bytes;
+        }
+    }
+    
+    sqlite3_stmt *vm = data->siteid_lookup_stmt;
+    if (!vm) return NULL;
+    
+    const void *result = NULL;
+    int rc = sqlite3_bind_int64(vm, 1, ord);
+    if (rc == SQLITE_OK) rc = sqlite3_step(vm);
+    if (tentative && (rc != SQLITE_ROW || sqlite3_column_bytes(vm, 0) != UUID_LEN)) {
+        khiter_t k = kh_get(ORD_TO_SITEID, data->ord_to_siteid, (khint64_t)ord);
+        siteid_cache_remove(data, kh_value(data->ord_to_siteid, k).bytes, ord);
+    }
+    if (rc == SQLITE_ROW && sqlite3_column_bytes(vm, 0) == UUID_LEN) {
+        siteid_cache_add(db, data, sqlite3_column_blob(vm, 0), ord);
+        
+        // when the value cannot be cached, the blob is valid until the next lookup
+        khiter_t k = (data->ord_to_siteid) ? kh_get(ORD_TO_SITEID, data->ord_to_siteid, (khint64_t)ord) : 0;
+        if (data->ord_to_siteid && k != kh_end(data->ord_to_siteid)) result = kh_value(data->ord_to_siteid, k).bytes;
+        else {
+            memcpy(data->siteid_lookup_buffer, sqlite3_column_blob(vm, 0), UUID_LEN);
+            result = data->siteid_lookup_buffer;
+        }
+    }
+    
+    stmt_reset(vm);
     return result;
 }
 
 // MARK: -
 
+sqlite3_int64 cloudsync_table_max_db_version (cloudsync_context *data, const char *table_name) {
+    cloudsync_table_context *table = table_lookup(data, table_name);
+    if (!table || !table->meta_max_db_version_stmt) return CLOUDSYNC_VALUE_NOTSET;
+    
+    if (table->max_db_version == CLOUDSYNC_VALUE_NOTSET) {
+        sqlite3_stmt *vm = table->meta_max_db_version_stmt;
+        int rc = sqlite3_step(vm);
+        if (rc == SQLITE_ROW) table->max_db_version = sqlite3_column_int64(vm, 0);
+        sqlite3_reset(vm);
+    }
+    
+    return table->max_db_version;
+}
+
+sqlite3_int64 table_estimated_rows (cloudsync_context *data, cloudsync_table_context *table) {
+    if (table->estimated_rows != CLOUDSYNC_VALUE_NOTSET) return table->estimated_rows;
+    if (!table->meta_max_db_version_stmt) return CLOUDSYNC_VALUE_NOTSET;
+    
+    sqlite3 *db = sqlite3_db_handle(table->meta_max_db_version_stmt);
+    sqlite3_int64 nrows = CLOUDSYNC_VALUE_NOTSET;
+    
+    // statistics collected by ANALYZE do not require a scan of the meta table
+    // (the first integer of the stat column is the number of rows in the table)
+    if (dbutils_table_exists(db, "sqlite_stat1")) {
+        char *sql = cloudsync_memory_mprintf("SELECT stat FROM sqlite_stat1 WHERE tbl='%q_cloudsync' LIMIT 1;", table->name);
+        char *stat = (sql) ? dbutils_text_select(db, sql) : NULL;
+        if (stat) nrows = strtoll(stat, NULL, 10);
+        if (stat) cloudsync_memory_free(stat);
+        if (sql) cloudsync_memory_free(sql);
+    }
+    
+    // no statistics available and a scan of the meta table is too expensive for a cost estimate, so each db_version
+    // is assumed to have changed all the columns of one row (the high-water mark is an index lookup)
+    if (nrows < 0) {
+        sqlite3_int64 max_db_version = cloudsync_table_max_db_version(data, table->name);
+        nrows = (max_db_version >= 0) ? max_db_version * (table->ncols + 1) : CLOUDSYNC_ESTIMATED_ROWS_DEFAULT;
+    }
+    
+    table->estimated_rows = nrows;
+    return nrows;
+}
+
+bool cloudsync_table_stats (cloudsync_context *data, int index, const char **table_name, sqlite3_int64 *nrows, sqlite3_int64 *max_db_version) {
+    // statistics of the index-th table in the context (false if the slot is empty or statistics are unavailable)
+    if (!data || index < 0 || index >= data->tables_count) return false;
+    cloudsync_table_context *table = data->tables[index];
+    if (!table) return false;
+    
+    *nrows = table_estimated_rows(data, table);
+    if (*nrows < 0) return false;
+    
+    *table_name = table->name;
+    *max_db_version = cloudsync_table_max_db_version(data, table->name);
+    return true;
+}
+
+const char *cloudsync_table_values_sql (cloudsync_context *data, const char *table_name) {
+    // SQL used to retrieve all the non primary key column values of a row (NULL if the table has no such columns)
+    cloudsync_table_context *table = table_lookup(data, table_name);
+    return (table && table->real_col_values_stmt) ? sqlite3_sql(table->real_col_values_stmt) : NULL;
+}
+
+int cloudsync_table_column_index (cloudsync_context *data, const char *table_name, const char *col_name) {
+    // index of a non primary key column, it is also its index in the statement returned by cloudsync_table_values_sql
+    cloudsync_table_context *table = table_lookup(data, table_name);
+    return (table) ? table_column_index(table, col_name) : -1;
+}
+
+int cloudsync_tables_count (cloudsync_context *data) {
+    return (data) ? data->tables_count : 0;
+}
+
+// MARK: -
+
 void *cloudsync_get_auxdata (sqlite3_context *context) {
     cloudsync_context *data = (context) ? (cloudsync_context *)sqlite3_user_data(context) : NULL;
     return (data) ? data->aux_data : NULL;
@@ -447,6 +948,10 @@ void cloudsync_set_auxdata (sqlite3_context *context, void *xdata) {
     if (data) data->aux_data = xdata;
 }
 
+void cloudsync_set_changes_vtab (cloudsync_context *data, sqlite3_vtab *vtab) {
+    if (data) data->changes_vtab = vtab;
+}
+
 // MARK: - PK Context -
 
 char *cloudsync_pk_context_tbl (cloudsync_pk_decode_bind_context *ctx, int64_t *tbl_len) {
@@ -582,6 +1087,79 @@ char *table_build_mergeinsert_sql (sqlite3 *db, cloudsync_table_context *table,
     return query;
 }
 
+char *table_build_mergeinsert_multi_sql (sqlite3 *db, cloudsync_table_context *table, uint64_t mask) {
+    // INSERT INTO customers (first_name,last_name,age,note) VALUES (?,?,?,?) ON CONFLICT DO UPDATE SET age=excluded.age,note=excluded.note;
+    char *cols = NULL;
+    char *sets = NULL;
+    char *binds = NULL;
+    char *sql = NULL;
+    
+    for (int i=0; i<table->ncols; ++i) {
+        if ((mask & (1ULL << i)) == 0) continue;
+        
+        const char *name = table->col_name[i];
+        char *c = (cols) ? cloudsync_memory_mprintf("%s,\"%w\"", cols, name) : cloudsync_memory_mprintf("\"%w\"", name);
+        char *s = (sets) ? cloudsync_memory_mprintf("%s,\"%w\"=excluded.\"%w\"", sets, name, name) : cloudsync_memory_mprintf("\"%w\"=excluded.\"%w\"", name, name);
+        char *b = (binds) ? cloudsync_memory_mprintf("%s,?", binds) : cloudsync_memory_mprintf("?");
+        if (cols) cloudsync_memory_free(cols);
+        if (sets) cloudsync_memory_free(sets);
+        if (binds) cloudsync_memory_free(binds);
+        cols = c; sets = s; binds = b;
+        if (!cols || !sets || !binds) goto cleanup;
+    }
+    if (!cols) goto cleanup;
+    
+    #if !CLOUDSYNC_DISABLE_ROWIDONLY_TABLES
+    if (table->rowid_only) {
+        sql = memory_mprintf("INSERT INTO \"%w\" (rowid,%s) VALUES (?,%s) ON CONFLICT DO UPDATE SET %s;", table->name, cols, binds, sets);
+        goto cleanup;
+    }
+    #endif
+    
+    char *singlequote_escaped_table_name = cloudsync_memory_mprintf("%q", table->name);
+    char *query = cloudsync_memory_mprintf("WITH pk_where AS (SELECT group_concat('\"' || format('%%w', name) || '\"') AS pk_clause FROM pragma_table_info('%q') WHERE pk>0 ORDER BY pk), pk_bind AS (SELECT group_concat('?') AS pk_binding FROM pragma_table_info('%q') WHERE pk>0 ORDER BY pk) SELECT 'INSERT INTO \"%w\" (' || (SELECT pk_clause FROM pk_where) || ',%q) VALUES ('  || (SELECT pk_binding FROM pk_bind) || ',%q) ON CONFLICT DO UPDATE SET %q;'", table->name, table->name, singlequote_escaped_table_name, cols, binds, sets);
+    cloudsync_memory_free(singlequote_escaped_table_name);
+    if (query) {
+        sql = dbutils_text_select(db, query);
+        cloudsync_memory_free(query);
+    }
+    
+cleanup:
+    if (cols) cloudsync_memory_free(cols);
+    if (sets) cloudsync_memory_free(sets);
+    if (binds) cloudsync_memory_free(binds);
+    return sql;
+}
+
+sqlite3_stmt *table_merge_multi_stmt (cloudsync_table_context *table, uint64_t mask) {
+    // lookup the statement for this exact set of columns, otherwise replace the least recently used one
+    cloudsync_merge_stmt *entry = &table->merge_multi_stmt[0];
+    for (int i=0; i<CLOUDSYNC_MERGE_STMT_CACHE_SIZE; ++i) {
+        cloudsync_merge_stmt *current = &table->merge_multi_stmt[i];
+        if (current->vm && current->mask == mask) {
+            current->tick = ++table->merge_multi_tick;
+            return current->vm;
+        }
+        if (current->tick < entry->tick) entry = current;
+    }
+    
+    sqlite3 *db = sqlite3_db_handle(table->meta_pkexists_stmt);
+    char *sql = table_build_mergeinsert_multi_sql(db, table, mask);
+    if (!sql) return NULL;
+    DEBUG_SQL("merge_multi_stmt: %s", sql);
+    
+    sqlite3_stmt *vm = NULL;
+    int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &vm, NULL);
+    cloudsync_memory_free(sql);
+    if (rc != SQLITE_OK) return NULL;
+    
+    if (entry->vm) sqlite3_finalize(entry->vm);
+    entry->vm = vm;
+    entry->mask = mask;
+    entry->tick = ++table->merge_multi_tick;
+    return vm;
+}
+
 char *table_build_value_sql (sqlite3 *db, cloudsync_table_context *table, const char *colname) {
     char *colnamequote = dbutils_is_star_table(colname) ? "" : "\"";
 
@@ -619,6 +1197,8 @@ cloudsync_table_context *table_create (const char *name, table_algo algo) {
         return NULL;
     }
     table->enabled = true;
+    table->max_db_version = CLOUDSYNC_VALUE_NOTSET;
+    table->estimated_rows = CLOUDSYNC_VALUE_NOTSET;
         
     return table;
 }
@@ -650,6 +1230,7 @@ void table_free (cloudsync_table_context *table) {
             cloudsync_memory_free(table->col_id);
         }
     }
+    if (table->col_index) kh_destroy(NAME_TO_INDEX, table->col_index);
     
     if (table->pk_name) sqlite3_free_table(table->pk_name);
     if (table->name) cloudsync_memory_free(table->name);
@@ -659,16 +1240,25 @@ void table_free (cloudsync_table_context *table) {
     if (table->meta_row_insert_update_stmt) sqlite3_finalize(table->meta_row_insert_update_stmt);
     if (table->meta_row_drop_stmt) sqlite3_finalize(table->meta_row_drop_stmt);
     if (table->meta_update_move_stmt) sqlite3_finalize(table->meta_update_move_stmt);
-    if (table->meta_local_cl_stmt) sqlite3_finalize(table->meta_local_cl_stmt);
+    if (table->meta_row_clocks_stmt) sqlite3_finalize(table->meta_row_clocks_stmt);
     if (table->meta_winner_clock_stmt) sqlite3_finalize(table->meta_winner_clock_stmt);
     if (table->meta_merge_delete_drop) sqlite3_finalize(table->meta_merge_delete_drop);
     if (table->meta_zero_clock_stmt) sqlite3_finalize(table->meta_zero_clock_stmt);
     if (table->meta_col_version_stmt) sqlite3_finalize(table->meta_col_version_stmt);
     if (table->meta_site_id_stmt) sqlite3_finalize(table->meta_site_id_stmt);
+    if (table->meta_max_db_version_stmt) sqlite3_finalize(table->meta_max_db_version_stmt);
+    if (table->meta_fingerprint_stmt) sqlite3_finalize(table->meta_fingerprint_stmt);
+    if (table->meta_deferred_stmt) sqlite3_finalize(table->meta_deferred_stmt);
+    if (table->meta_deferred_batch_stmt) sqlite3_finalize(table->meta_deferred_batch_stmt);
+    if (table->meta_tombstone_clock_stmt) sqlite3_finalize(table->meta_tombstone_clock_stmt);
     
     if (table->real_col_values_stmt) sqlite3_finalize(table->real_col_values_stmt);
+    if (table->real_row_exists_stmt) sqlite3_finalize(table->real_row_exists_stmt);
     if (table->real_merge_delete_stmt) sqlite3_finalize(table->real_merge_delete_stmt);
     if (table->real_merge_sentinel_stmt) sqlite3_finalize(table->real_merge_sentinel_stmt);
+    for (int i=0; i<CLOUDSYNC_MERGE_STMT_CACHE_SIZE; ++i) {
+        if (table->merge_multi_stmt[i].vm) sqlite3_finalize(table->merge_multi_stmt[i].vm);
+    }
     
     cloudsync_memory_free(table);
 }
@@ -712,7 +1302,10 @@ int table_add_stmts (sqlite3 *db, cloudsync_table_context *table, int ncols) {
     if (rc != SQLITE_OK) goto cleanup;
 
     // precompile the insert/update local row statement
-    sql = cloudsync_memory_mprintf("INSERT INTO \"%w_cloudsync\" (pk, col_name, col_version, db_version, seq, site_id ) SELECT ?, ?, ?, ?, ?, 0 WHERE 1 ON CONFLICT DO UPDATE SET col_version = col_version + 1, db_version = ?, seq = ?, site_id = 0;", table->name);
+    // (the value fingerprint is always replaced, a NULL fingerprint means that the local value must be read)
+    table->has_fingerprint = dbutils_metatable_has_fingerprint(db, table->name);
+    if (table->has_fingerprint) sql = cloudsync_memory_mprintf("INSERT INTO \"%w_cloudsync\" (pk, col_name, col_version, db_version, seq, site_id, col_fingerprint) SELECT ?1, ?2, ?3, ?4, ?5, 0, ?8 WHERE 1 ON CONFLICT DO UPDATE SET col_version = col_version + 1, db_version = ?6, seq = ?7, site_id = 0, col_fingerprint = ?8;", table->name);
+    else sql = cloudsync_memory_mprintf("INSERT INTO \"%w_cloudsync\" (pk, col_name, col_version, db_version, seq, site_id ) SELECT ?, ?, ?, ?, ?, 0 WHERE 1 ON CONFLICT DO UPDATE SET col_version = col_version + 1, db_version = ?, seq = ?, site_id = 0;", table->name);
     if (!sql) {rc = SQLITE_NOMEM; goto cleanup;}
     DEBUG_SQL("meta_row_insert_update_stmt: %s", sql);
     
@@ -739,12 +1332,13 @@ int table_add_stmts (sqlite3 *db, cloudsync_table_context *table, int ncols) {
     cloudsync_memory_free(sql);
     if (rc != SQLITE_OK) goto cleanup;
     
-    // local cl
-    sql = cloudsync_memory_mprintf("SELECT COALESCE((SELECT col_version FROM \"%w_cloudsync\" WHERE pk=? AND col_name='%s'), (SELECT 1 FROM \"%w_cloudsync\" WHERE pk=?));", table->name, CLOUDSYNC_TOMBSTONE_VALUE, table->name);
+    // column clocks of a row, used by the merge to compute both the local cl and the col versions with a single lookup
+    // EXPLAIN QUERY PLAN reports: SEARCH table_name USING PRIMARY KEY (pk=?)
+    sql = cloudsync_memory_mprintf("SELECT col_name, col_version FROM \"%w_cloudsync\" WHERE pk=?;", table->name);
     if (!sql) {rc = SQLITE_NOMEM; goto cleanup;}
-    DEBUG_SQL("meta_local_cl_stmt: %s", sql);
+    DEBUG_SQL("meta_row_clocks_stmt: %s", sql);
     
-    rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &table->meta_local_cl_stmt, NULL);
+    rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &table->meta_row_clocks_stmt, NULL);
     cloudsync_memory_free(sql);
     if (rc != SQLITE_OK) goto cleanup;
     
@@ -766,7 +1360,8 @@ int table_add_stmts (sqlite3 *db, cloudsync_table_context *table, int ncols) {
     if (rc != SQLITE_OK) goto cleanup;
     
     // zero clock
-    sql = cloudsync_memory_mprintf("UPDATE \"%w_cloudsync\" SET col_version = 0, db_version = cloudsync_db_version_next(?) WHERE pk=? AND col_name!='%s';", table->name, CLOUDSYNC_TOMBSTONE_VALUE);
+    if (table->has_fingerprint) sql = cloudsync_memory_mprintf("UPDATE \"%w_cloudsync\" SET col_version = 0, db_version = cloudsync_db_version_next(?), col_fingerprint = NULL WHERE pk=? AND col_name!='%s';", table->name, CLOUDSYNC_TOMBSTONE_VALUE);
+    else sql = cloudsync_memory_mprintf("UPDATE \"%w_cloudsync\" SET col_version = 0, db_version = cloudsync_db_version_next(?) WHERE pk=? AND col_name!='%s';", table->name, CLOUDSYNC_TOMBSTONE_VALUE);
     if (!sql) {rc = SQLITE_NOMEM; goto cleanup;}
     DEBUG_SQL("meta_zero_clock_stmt: %s", sql);
     
@@ -792,6 +1387,27 @@ int table_add_stmts (sqlite3 *db, cloudsync_table_context *table, int ncols) {
     cloudsync_memory_free(sql);
     if (rc != SQLITE_OK) goto cleanup;
     
+    // value fingerprint
+    if (table->has_fingerprint) {
+        sql = cloudsync_memory_mprintf("SELECT col_fingerprint FROM \"%w_cloudsync\" WHERE pk=? AND col_name=?;", table->name);
+        if (!sql) {rc = SQLITE_NOMEM; goto cleanup;}
+        DEBUG_SQL("meta_fingerprint_stmt: %s", sql);
+        
+        rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &table->meta_fingerprint_stmt, NULL);
+        cloudsync_memory_free(sql);
+        if (rc != SQLITE_OK) goto cleanup;
+    }
+    
+    // max db_version
+    // EXPLAIN QUERY PLAN reports: SEARCH table_name USING COVERING INDEX table_name_db_idx
+    sql = cloudsync_memory_mprintf("SELECT max(db_version) FROM \"%w_cloudsync\";", table->name);
+    if (!sql) {rc = SQLITE_NOMEM; goto cleanup;}
+    DEBUG_SQL("meta_max_db_version_stmt: %s", sql);
+    
+    rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &table->meta_max_db_version_stmt, NULL);
+    cloudsync_memory_free(sql);
+    if (rc != SQLITE_OK) goto cleanup;
+    
     // REAL TABLE statements
     
     // precompile the get column value statement
@@ -829,36 +1445,36 @@ cleanup:
 cloudsync_table_context *table_lookup (cloudsync_context *data, const char *table_name) {
     DEBUG_DBFUNCTION("table_lookup %s", table_name);
     
-    for (int i=0; i<data->tables_count; ++i) {
-        const char *name = (data->tables[i]) ? data->tables[i]->name : NULL;
-        if ((name) && (strcasecmp(name, table_name) == 0)) {
-            return data->tables[i];
-        }
-    }
-    
-    return NULL;
+    if (!data->tables_index || !table_name) return NULL;
+    khiter_t k = kh_get(NAME_TO_TABLE, data->tables_index, table_name);
+    return (k != kh_end(data->tables_index)) ? kh_value(data->tables_index, k) : NULL;
+}
+
+int table_column_index (cloudsync_table_context *table, const char *col_name) {
+    if (!table->col_index || !col_name) return -1;
+    khiter_t k = kh_get(NAME_TO_INDEX, table->col_index, col_name);
+    return (k != kh_end(table->col_index)) ? kh_value(table->col_index, k) : -1;
 }
 
 sqlite3_stmt *table_column_lookup (cloudsync_table_context *table, const char *col_name, bool is_merge, int *index) {
     DEBUG_DBFUNCTION("table_column_lookup %s", col_name);
     
-    for (int i=0; i<table->ncols; ++i) {
-        if (strcasecmp(table->col_name[i], col_name) == 0) {
-            if (index) *index = i;
-            return (is_merge) ? table->col_merge_stmt[i] : table->col_value_stmt[i];
-        }
-    }
-    
-    if (index) *index = -1;
-    return NULL;
+    int i = table_column_index(table, col_name);
+    if (index) *index = i;
+    if (i < 0) return NULL;
+    return (is_merge) ? table->col_merge_stmt[i] : table->col_value_stmt[i];
 }
 
 int table_remove (cloudsync_context *data, const char *table_name) {
     DEBUG_DBFUNCTION("table_remove %s", table_name);
     
+    cloudsync_table_context *table = table_lookup(data, table_name);
+    if (!table) return -1;
+    
+    // the key is owned by the table, so it must be removed from the index before the table is freed
+    kh_del(NAME_TO_TABLE, data->tables_index, kh_get(NAME_TO_TABLE, data->tables_index, table_name));
     for (int i=0; i<data->tables_count; ++i) {
-        const char *name = (data->tables[i]) ? data->tables[i]->name : NULL;
-        if ((name) && (strcasecmp(name, table_name) == 0)) {
+        if (data->tables[i] == table) {
             data->tables[i] = NULL;
             return i;
         }
@@ -881,6 +1497,11 @@ int table_add_to_context_cb (void *xdata, int ncols, char **values, char **names
         table->col_name[index] = cloudsync_string_dup(name, true);
         if (!table->col_name[index]) return 1;
         
+        int absent = 0;
+        khiter_t k = kh_put(NAME_TO_INDEX, table->col_index, table->col_name[index], &absent);
+        if (absent < 0) return SQLITE_NOMEM;
+        kh_value(table->col_index, k) = index;
+        
         char *sql = table_build_mergeinsert_sql(db, table, name);
         if (!sql) return SQLITE_NOMEM;
         DEBUG_SQL("col_merge_stmt[%d]: %s", index, sql);
@@ -941,6 +1562,7 @@ bool table_add_to_context (sqlite3 *db, cloudsync_context *data, table_algo algo
         goto abort_add_table;
     }
     
+    
     if (table->npks == 0) {
         #if CLOUDSYNC_DISABLE_ROWIDONLY_TABLES
         return false;
@@ -976,6 +1598,9 @@ bool table_add_to_context (sqlite3 *db, cloudsync_context *data, table_algo algo
         table->col_value_stmt = (sqlite3_stmt **)cloudsync_memory_alloc((sqlite3_uint64)(sizeof(sqlite3_stmt *) * ncols));
         if (!table->col_value_stmt) goto abort_add_table;
         
+        table->col_index = kh_init(NAME_TO_INDEX);
+        if (!table->col_index) goto abort_add_table;
+        
         sql = cloudsync_memory_mprintf("SELECT name, cid FROM pragma_table_info('%q') WHERE pk=0 ORDER BY cid;", table_name);
         if (!sql) goto abort_add_table;
         int rc = sqlite3_exec(db, sql, table_add_to_context_cb, (void *)table, NULL);
@@ -983,6 +1608,14 @@ bool table_add_to_context (sqlite3 *db, cloudsync_context *data, table_algo algo
         if (rc == SQLITE_ABORT) goto abort_add_table;
     }
     
+    // index the table by name (the key is owned by the table)
+    if (!data->tables_index) data->tables_index = kh_init(NAME_TO_TABLE);
+    if (!data->tables_index) goto abort_add_table;
+    int absent = 0;
+    khiter_t k = kh_put(NAME_TO_TABLE, data->tables_index, table->name, &absent);
+    if (absent < 0) goto abort_add_table;
+    kh_value(data->tables_index, k) = table;
+    
     // lookup the first free slot
     for (int i=0; i<data->tables_alloc; ++i) {
         if (data->tables[i] == NULL) {
@@ -1025,28 +1658,119 @@ sqlite3_stmt *cloudsync_colvalue_stmt (sqlite3 *db, cloudsync_context *data, con
     return vm;
 }
 
-// MARK: - Merge Insert -
+// MARK: - Apply Errors -
+
+void apply_errors_clear (cloudsync_context *data) {
+    for (int i=0; i<data->apply_errors_count; ++i) {
+        cloudsync_memory_free(data->apply_errors[i].tbl);
+        if (data->apply_errors[i].message) cloudsync_memory_free(data->apply_errors[i].message);
+    }
+    data->apply_errors_count = 0;
+}
 
-sqlite3_int64 merge_get_local_cl (cloudsync_table_context *table, const char *pk, int pklen, const char **err) {
-    sqlite3_stmt *vm = table->meta_local_cl_stmt;
-    sqlite3_int64 result = -1;
+void apply_errors_add (cloudsync_context *data, const char *tbl, int64_t tbl_len, int code, sqlite3_int64 db_version, sqlite3_int64 seq, const char *message) {
+    // count a change rejected by the payload apply: no I/O here, the groups are reported by apply_errors_save
+    if (!tbl) tbl_len = 0;
+    for (int i=0; i<data->apply_errors_count; ++i) {
+        cloudsync_apply_error *error = &data->apply_errors[i];
+        if ((error->code == code) && (strlen(error->tbl) == (size_t)tbl_len) && (strncmp(error->tbl, tbl, (size_t)tbl_len) == 0)) {
+            ++error->count;
+            return;
+        }
+    }
     
-    int rc = sqlite3_bind_blob(vm, 1, (const void *)pk, pklen, SQLITE_STATIC);
+    // groups past the limit are not counted
+    if (data->apply_errors_count >= CLOUDSYNC_APPLY_ERRORS_MAX_GROUPS) return;
+    if (data->apply_errors_count >= data->apply_errors_alloc) {
+        int alloc = (data->apply_errors_alloc) ? data->apply_errors_alloc * 2 : 8;
+        cloudsync_apply_error *errors = (cloudsync_apply_error *)cloudsync_memory_realloc(data->apply_errors, (sqlite3_uint64)(alloc * sizeof(cloudsync_apply_error)));
+        if (!errors) return;
+        data->apply_errors = errors;
+        data->apply_errors_alloc = alloc;
+    }
+    
+    char *name = cloudsync_memory_mprintf("%.*s", (int)tbl_len, (tbl) ? tbl : "");
+    if (!name) return;
+    
+    cloudsync_apply_error *error = &data->apply_errors[data->apply_errors_count++];
+    error->tbl = name;
+    error->code = code;
+    error->count = 1;
+    error->db_version = db_version;
+    error->seq = seq;
+    error->message = (message) ? cloudsync_string_dup(message, false) : NULL;
+}
+
+bool apply_error_is_fatal (int rc) {
+    // a change rejected by the merge (constraint, RLS policy, ...) is counted and the apply goes on,
+    // while I/O, memory and locking errors make all the following changes fail too
+    switch (rc & 0xFF) {
+        case SQLITE_NOMEM:
+        case SQLITE_IOERR:
+        case SQLITE_CORRUPT:
+        case SQLITE_FULL:
+        case SQLITE_CANTOPEN:
+        case SQLITE_PROTOCOL:
+        case SQLITE_NOTADB:
+        case SQLITE_BUSY:
+        case SQLITE_LOCKED:
+        case SQLITE_READONLY:
+        case SQLITE_INTERRUPT:
+            return true;
+    }
+    return false;
+}
+
+int apply_errors_save (sqlite3 *db, cloudsync_context *data) {
+    // write the error groups of the payload apply to the cloudsync_apply_errors table (if enabled by the apply_errors setting)
+    // and keep only its last apply_errors rows
+    sqlite3_stmt *vm = NULL;
+    int rc = SQLITE_OK;
+    if (data->apply_errors_count == 0) return SQLITE_OK;
+    
+    if (data->debug) {
+        for (int i=0; i<data->apply_errors_count; ++i) {
+            cloudsync_apply_error *error = &data->apply_errors[i];
+            printf("cloudsync_payload_apply: %d changes of %s rejected (%d), first on db_version %lld/%lld: %s\n", error->count, error->tbl, error->code, error->db_version, error->seq, (error->message) ? error->message : "");
+        }
+    }
+    if (data->apply_errors_max <= 0) goto cleanup;
+    
+    const char *sql = "CREATE TABLE IF NOT EXISTS cloudsync_apply_errors (id INTEGER PRIMARY KEY, tbl TEXT, code INTEGER, count INTEGER, db_version INTEGER, seq INTEGER, message TEXT, created_at INTEGER DEFAULT (strftime('%s','now')));";
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
     if (rc != SQLITE_OK) goto cleanup;
     
-    rc = sqlite3_bind_blob(vm, 2, (const void *)pk, pklen, SQLITE_STATIC);
+    sql = "INSERT INTO cloudsync_apply_errors (tbl, code, count, db_version, seq, message) VALUES (?1, ?2, ?3, ?4, ?5, ?6);";
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
     if (rc != SQLITE_OK) goto cleanup;
     
-    rc = sqlite3_step(vm);
-    if (rc == SQLITE_ROW) result = sqlite3_column_int64(vm, 0);
-    else if (rc == SQLITE_DONE) result = 0;
+    for (int i=0; i<data->apply_errors_count; ++i) {
+        cloudsync_apply_error *error = &data->apply_errors[i];
+        sqlite3_bind_text(vm, 1, error->tbl, -1, SQLITE_STATIC);
+        sqlite3_bind_int(vm, 2, error->code);
+        sqlite3_bind_int(vm, 3, error->count);
+        sqlite3_bind_int64(vm, 4, error->db_version);
+        sqlite3_bind_int64(vm, 5, error->seq);
+        if (error->message) sqlite3_bind_text(vm, 6, error->message, -1, SQLITE_STATIC);
+        else sqlite3_bind_null(vm, 6);
+        
+        rc = sqlite3_step(vm);
+        stmt_reset(vm);
+        if (rc != SQLITE_DONE) goto cleanup;
+    }
+    
+    char buf[256];
+    snprintf(buf, sizeof(buf), "DELETE FROM cloudsync_apply_errors WHERE id <= (SELECT max(id) FROM cloudsync_apply_errors) - %d;", data->apply_errors_max);
+    rc = sqlite3_exec(db, buf, NULL, NULL, NULL);
     
 cleanup:
-    if (result == -1) *err = sqlite3_errmsg(sqlite3_db_handle(vm));
-    stmt_reset(vm);
-    return result;
+    if (vm) sqlite3_finalize(vm);
+    apply_errors_clear(data);
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
 }
 
+// MARK: - Merge Insert -
+
 int merge_get_col_version (cloudsync_table_context *table, const char *col_name, const char *pk, int pklen, sqlite3_int64 *version, const char **err) {
     sqlite3_stmt *vm = table->meta_col_version_stmt;
     
@@ -1070,17 +1794,18 @@ cleanup:
 
 int merge_set_winner_clock (cloudsync_context *data, cloudsync_table_context *table, const char *pk, int pk_len, const char *colname, sqlite3_int64 col_version, sqlite3_int64 db_version, const char *site_id, int site_len, sqlite3_int64 seq, sqlite3_int64 *rowid, const char **err) {
     
-    // get/set site_id
+    // get/set site_id (the dictionary is validated so a site_id table re-created by another connection is detected)
+    // no other connection can write until the write transaction ends, so the validation is performed once per transaction
+    sqlite3 *db = sqlite3_db_handle(table->meta_winner_clock_stmt);
+    if (!data->caches_checked) {
+        data->caches_checked = cloudsync_context_validate_caches(data) && (sqlite3_txn_state(db, "main") == SQLITE_TXN_WRITE);
+    }
+    
+    sqlite3_int64 ord = 0;
     sqlite3_stmt *vm = data->getset_siteid_stmt;
-    int rc = sqlite3_bind_blob(vm, 1, (const void *)site_id, site_len, SQLITE_STATIC);
+    int rc = siteid_cache_getset_ord(db, data, site_id, site_len, &ord);
     if (rc != SQLITE_OK) goto cleanup_merge;
     
-    rc = sqlite3_step(vm);
-    if (rc != SQLITE_ROW) goto cleanup_merge;
-    
-    int64_t ord = sqlite3_column_int64(vm, 0);
-    stmt_reset(vm);
-    
     vm = table->meta_winner_clock_stmt;
     rc = sqlite3_bind_blob(vm, 1, (const void *)pk, pk_len, SQLITE_STATIC);
     if (rc != SQLITE_OK) goto cleanup_merge;
@@ -1104,6 +1829,10 @@ int merge_set_winner_clock (cloudsync_context *data, cloudsync_table_context *ta
     if (rc == SQLITE_ROW) {
         *rowid = sqlite3_column_int64(vm, 0);
         rc = SQLITE_OK;
+        
+        sqlite3_int64 new_db_version, new_seq;
+        cloudsync_rowid_decode(*rowid, &new_db_version, &new_seq);
+        table_set_max_db_version(table, new_db_version);
     }
     
 cleanup_merge:
@@ -1165,6 +1894,278 @@ int merge_insert_col (cloudsync_context *data, cloudsync_table_context *table, c
     return merge_set_winner_clock(data, table, pk, pklen, col_name, col_version, db_version, site_id, site_len, seq, rowid, err);
 }
 
+int merge_group_column_index (cloudsync_table_context *table, const char *col_name) {
+    // same (case-insensitive) match used by table_column_lookup to pick the column merge statement
+    if (strcmp(col_name, CLOUDSYNC_TOMBSTONE_VALUE) == 0) return table->ncols;
+    return table_column_index(table, col_name);
+}
+
+void merge_cl_cache_clear (cloudsync_merge_group *group) {
+    if (!group->local_cl) return;
+    
+    for (khiter_t k = kh_begin(group->local_cl); k != kh_end(group->local_cl); ++k) {
+        if (kh_exist(group->local_cl, k)) cloudsync_memory_free(kh_key(group->local_cl, k).pk);
+    }
+    kh_clear(ROW_TO_CL, group->local_cl);
+}
+
+bool merge_cl_cache_get (cloudsync_merge_group *group, cloudsync_table_context *table, const char *pk, int pklen, sqlite3_int64 *cl) {
+    if (!group->batch || !group->local_cl) return false;
+    
+    cloudsync_row_key key = {table, (char *)pk, pklen};
+    khiter_t k = kh_get(ROW_TO_CL, group->local_cl, key);
+    if (k == kh_end(group->local_cl)) return false;
+    
+    *cl = kh_value(group->local_cl, k);
+    return true;
+}
+
+void merge_cl_cache_set (cloudsync_merge_group *group, sqlite3_int64 cl) {
+    // the cache is just an optimization, so it is silently skipped in case of errors
+    if (!group->batch || !group->table) return;
+    if (!group->local_cl) {
+        group->local_cl = kh_init(ROW_TO_CL);
+        if (!group->local_cl) return;
+    }
+    
+    cloudsync_row_key key = {group->table, group->pk, group->pk_len};
+    khiter_t k = kh_get(ROW_TO_CL, group->local_cl, key);
+    if (k != kh_end(group->local_cl)) {
+        kh_value(group->local_cl, k) = cl;
+        return;
+    }
+    
+    // bound the memory used by huge payloads
+    if (kh_size(group->local_cl) >= CLOUDSYNC_MERGE_CL_CACHE_SIZE) merge_cl_cache_clear(group);
+    
+    key.pk = (char *)cloudsync_memory_alloc((sqlite3_uint64)group->pk_len);
+    if (!key.pk) return;
+    memcpy(key.pk, group->pk, group->pk_len);
+    
+    int absent = 0;
+    k = kh_put(ROW_TO_CL, group->local_cl, key, &absent);
+    if (absent < 0) {cloudsync_memory_free(key.pk); return;}
+    kh_value(group->local_cl, k) = cl;
+}
+
+void merge_group_free (cloudsync_context *data) {
+    // pending columns are discarded (the context is going away)
+    cloudsync_merge_group *group = &data->merge_group;
+    for (int i=0; i<group->npending; ++i) sqlite3_value_free(group->pending[i].value);
+    if (group->pending) cloudsync_memory_free(group->pending);
+    merge_cl_cache_clear(group);
+    if (group->local_cl) kh_destroy(ROW_TO_CL, group->local_cl);
+    if (group->pk) cloudsync_memory_free(group->pk);
+    if (group->col_version) cloudsync_memory_free(group->col_version);
+    memset(group, 0, sizeof(cloudsync_merge_group));
+}
+
+sqlite3_int64 merge_group_local_cl (cloudsync_merge_group *group) {
+    // the tombstone col_version or 1 if any other clock exists (0 if the row is unknown)
+    sqlite3_int64 cl = group->col_version[group->table->ncols];
+    if (cl != CLOUDSYNC_VALUE_NOTSET) return cl;
+    return (group->has_rows) ? 1 : 0;
+}
+
+int merge_group_load (cloudsync_context *data, cloudsync_table_context *table, const char *pk, int pklen, const char **err) {
+    cloudsync_merge_group *group = &data->merge_group;
+    if ((group->table == table) && (group->pk_len == pklen) && (memcmp(group->pk, pk, pklen) == 0)) return SQLITE_OK;
+    int rc = merge_group_reset(data);
+    if (apply_error_is_fatal(rc)) {*err = "Unable to write the pending columns of the previous row."; return rc;}
+    
+    // make room for the new row
+    if (group->pk_alloc < pklen) {
+        char *buffer = (char *)cloudsync_memory_realloc(group->pk, (sqlite3_uint64)pklen);
+        if (!buffer) {*err = "Not enough memory to cache the row clocks."; return SQLITE_NOMEM;}
+        group->pk = buffer;
+        group->pk_alloc = pklen;
+    }
+    if (group->col_alloc < table->ncols + 1) {
+        sqlite3_int64 *clocks = (sqlite3_int64 *)cloudsync_memory_realloc(group->col_version, (sqlite3_uint64)((table->ncols + 1) * sizeof(sqlite3_int64)));
+        if (!clocks) {*err = "Not enough memory to cache the row clocks."; return SQLITE_NOMEM;}
+        group->col_version = clocks;
+        group->col_alloc = table->ncols + 1;
+    }
+    
+    memcpy(group->pk, pk, pklen);
+    group->pk_len = pklen;
+    group->has_rows = false;
+    for (int i=0; i<=table->ncols; ++i) group->col_version[i] = CLOUDSYNC_VALUE_NOTSET;
+    
+    sqlite3_stmt *vm = table->meta_row_clocks_stmt;
+    rc = sqlite3_bind_blob(vm, 1, (const void *)pk, pklen, SQLITE_STATIC);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    while ((rc = sqlite3_step(vm)) == SQLITE_ROW) {
+        group->has_rows = true;
+        int index = merge_group_column_index(table, (const char *)sqlite3_column_text(vm, 0));
+        if (index >= 0) group->col_version[index] = sqlite3_column_int64(vm, 1);
+    }
+    if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    
+cleanup:
+    if (rc != SQLITE_OK) *err = sqlite3_errmsg(sqlite3_db_handle(vm));
+    else group->table = table;
+    stmt_reset(vm);
+    if (rc == SQLITE_OK) merge_cl_cache_set(group, merge_group_local_cl(group));
+    return rc;
+}
+
+void merge_group_set_clock (cloudsync_merge_group *group, const char *col_name, sqlite3_int64 col_version) {
+    if (!group->table) return;
+    
+    // a clock for a column not in the schema is not tracked (merge_group_col_version always reads it from the meta table)
+    int index = merge_group_column_index(group->table, (col_name) ? col_name : CLOUDSYNC_TOMBSTONE_VALUE);
+    if (index >= 0) group->col_version[index] = col_version;
+    group->has_rows = true;
+    merge_cl_cache_set(group, merge_group_local_cl(group));
+}
+
+void merge_group_drop_clocks (cloudsync_merge_group *group, sqlite3_int64 col_version) {
+    if (!group->table) return;
+    
+    // mirror meta_merge_delete_drop (CLOUDSYNC_VALUE_NOTSET) and meta_zero_clock_stmt (0) on the non tombstone clocks
+    for (int i=0; i<group->table->ncols; ++i) {
+        if (group->col_version[i] != CLOUDSYNC_VALUE_NOTSET) group->col_version[i] = col_version;
+    }
+}
+
+int merge_group_col_version (cloudsync_context *data, cloudsync_table_context *table, const char *col_name, const char *pk, int pklen, sqlite3_int64 *version, const char **err) {
+    cloudsync_merge_group *group = &data->merge_group;
+    int index = (group->table == table) ? merge_group_column_index(table, col_name) : -1;
+    if (index < 0) return merge_get_col_version(table, col_name, pk, pklen, version, err);
+    
+    if (group->col_version[index] == CLOUDSYNC_VALUE_NOTSET) return SQLITE_DONE;
+    *version = group->col_version[index];
+    return SQLITE_OK;
+}
+
+int merge_group_flush (cloudsync_context *data) {
+    // write the pending winning columns of the cached row with a single UPSERT on the augmented table
+    // the winner clocks are written only after the UPSERT succeeds, exactly as merge_insert_col does
+    cloudsync_merge_group *group = &data->merge_group;
+    cloudsync_table_context *table = group->table;
+    if (group->npending == 0 || !table) return SQLITE_OK;
+    
+    int npending = group->npending;
+    group->npending = 0;
+    
+    // a single column does not need a dedicated statement
+    const char *err = NULL;
+    sqlite3_int64 rowid = 0;
+    sqlite3_stmt *vm = NULL;
+    int rc = SQLITE_ERROR;
+    if (npending > 1) {
+        uint64_t mask = 0;
+        for (int i=0; i<npending; ++i) mask |= (1ULL << group->pending[i].index);
+        vm = table_merge_multi_stmt(table, mask);
+    }
+    
+    if (vm) {
+        rc = pk_decode_prikey(group->pk, (size_t)group->pk_len, pk_decode_bind_callback, vm);
+        rc = (rc < 0) ? sqlite3_errcode(sqlite3_db_handle(vm)) : SQLITE_OK;
+        
+        // values are bound in column order (the same order used to build the statement)
+        int bind_index = table->npks;
+        for (int c=0; c<table->ncols && rc == SQLITE_OK; ++c) {
+            for (int i=0; i<npending; ++i) {
+                if (group->pending[i].index != c) continue;
+                rc = sqlite3_bind_value(vm, ++bind_index, group->pending[i].value);
+                break;
+            }
+        }
+        
+        if (rc == SQLITE_OK) {
+            SYNCBIT_SET(data);
+            rc = sqlite3_step(vm);
+            DEBUG_MERGE("merge_flush(%02x%02x): %s (%d)", data->site_id[UUID_LEN-2], data->site_id[UUID_LEN-1], sqlite3_expanded_sql(vm), rc);
+            SYNCBIT_RESET(data);
+        }
+        stmt_reset(vm);
+        if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    }
+    
+    // every rejected column is counted in the apply errors, the first error is returned
+    int result = SQLITE_OK;
+    for (int i=0; i<npending; ++i) {
+        cloudsync_merge_pending *pending = &group->pending[i];
+        const char *col_name = table->col_name[pending->index];
+        
+        // the row UPSERT failed (or it was not available), so retry one column at a time to report the right error
+        int rc2 = (rc == SQLITE_OK) ?
+            merge_set_winner_clock(data, table, group->pk, group->pk_len, col_name, pending->col_version, pending->db_version, (const char *)pending->site_id, pending->site_len, pending->seq, &rowid, &err) :
+            merge_insert_col(data, table, group->pk, group->pk_len, col_name, pending->value, pending->col_version, pending->db_version, (const char *)pending->site_id, pending->site_len, pending->seq, &rowid, &err);
+        if (rc2 != SQLITE_OK) {
+            apply_errors_add(data, table->name, (int64_t)strlen(table->name), rc2, pending->db_version, pending->seq, err);
+            merge_cl_cache_clear(group);
+            group->table = NULL;
+            if (result == SQLITE_OK) result = rc2;
+        }
+        sqlite3_value_free(pending->value);
+        pending->value = NULL;
+    }
+    
+    return result;
+}
+
+int merge_group_flush_if_changed (cloudsync_context *data, const char *tbl, int64_t tbl_len, const void *pk, int64_t pk_len) {
+    // flush the pending columns only if the next change targets a different row
+    cloudsync_merge_group *group = &data->merge_group;
+    if (group->npending == 0 || !group->table) return SQLITE_OK;
+    
+    cloudsync_table_context *table = group->table;
+    bool same_table = (tbl && (strlen(table->name) == (size_t)tbl_len) && (strncasecmp(table->name, tbl, (size_t)tbl_len) == 0));
+    bool same_pk = (pk && (group->pk_len == pk_len) && (memcmp(group->pk, pk, (size_t)pk_len) == 0));
+    return (!same_table || !same_pk) ? merge_group_flush(data) : SQLITE_OK;
+}
+
+int merge_group_reset (cloudsync_context *data) {
+    // the rejected columns are already counted in the apply errors by merge_group_flush
+    int rc = merge_group_flush(data);
+    data->merge_group.table = NULL;
+    return rc;
+}
+
+int merge_group_defer_col (cloudsync_context *data, cloudsync_table_context *table, const char *col_name, sqlite3_value *col_value, sqlite3_int64 col_version, sqlite3_int64 db_version, const char *site_id, int site_len, sqlite3_int64 seq, bool *deferred) {
+    // in a payload batch the winning columns of a row are accumulated and written together by merge_group_flush
+    cloudsync_merge_group *group = &data->merge_group;
+    *deferred = false;
+    if (!group->coalesce || group->table != table || table->ncols > CLOUDSYNC_MERGE_MAX_COLUMNS || site_len > UUID_LEN) return SQLITE_OK;
+    
+    int index = merge_group_column_index(table, col_name);
+    if (index < 0 || index == table->ncols) return SQLITE_OK;
+    
+    // a newer winner for a column already pending replaces it
+    cloudsync_merge_pending *pending = NULL;
+    for (int i=0; i<group->npending; ++i) {
+        if (group->pending[i].index == index) {pending = &group->pending[i]; break;}
+    }
+    
+    if (!pending && group->npending >= group->pending_alloc) {
+        int new_alloc = (group->pending_alloc) ? group->pending_alloc * 2 : 16;
+        cloudsync_merge_pending *pending = (cloudsync_merge_pending *)cloudsync_memory_realloc(group->pending, (sqlite3_uint64)(new_alloc * sizeof(cloudsync_merge_pending)));
+        if (!pending) return SQLITE_NOMEM;
+        group->pending = pending;
+        group->pending_alloc = new_alloc;
+    }
+    
+    sqlite3_value *value = sqlite3_value_dup(col_value);
+    if (!value) return SQLITE_NOMEM;
+    
+    if (pending) sqlite3_value_free(pending->value);
+    else pending = &group->pending[group->npending++];
+    pending->index = index;
+    pending->value = value;
+    pending->col_version = col_version;
+    pending->db_version = db_version;
+    pending->seq = seq;
+    pending->site_len = site_len;
+    memcpy(pending->site_id, site_id, site_len);
+    
+    *deferred = true;
+    return SQLITE_OK;
+}
+
 int merge_delete (cloudsync_context *data, cloudsync_table_context *table, const char *pk, int pklen, const char *colname, sqlite3_int64 cl, sqlite3_int64 db_version, const char *site_id, int site_len, sqlite3_int64 seq, sqlite3_int64 *rowid, const char **err) {
     int rc = SQLITE_OK;
     
@@ -1222,6 +2223,9 @@ int merge_zeroclock_on_resurrect(cloudsync_table_context *table, sqlite3_int64 d
     rc = sqlite3_step(vm);
     if (rc == SQLITE_DONE) rc = SQLITE_OK;
     
+    // db_version is computed inside the statement, so just force a reload of the high-water mark
+    table->max_db_version = CLOUDSYNC_VALUE_NOTSET;
+    
 cleanup:
     if (rc != SQLITE_OK) *err = sqlite3_errmsg(sqlite3_db_handle(vm));
     stmt_reset(vm);
@@ -1229,12 +2233,51 @@ cleanup:
 }
 
 // executed only if insert_cl == local_cl
+int merge_compare_fingerprint (cloudsync_context *data, cloudsync_table_context *table, const char *pk, int pklen, sqlite3_value *insert_value, const char *col_name, int *ret, bool *decided, const char **err) {
+    // compare the incoming value with the fingerprint of the local one (same result of dbutils_value_compare),
+    // decided is false when there is no local fingerprint or when the values themselves must be compared
+    *decided = false;
+    if (!table->has_fingerprint || !insert_value) return SQLITE_OK;
+    
+    // a column still pending in the merge group has not its clock written yet
+    cloudsync_merge_group *group = &data->merge_group;
+    if (group->npending > 0) {
+        int index = merge_group_column_index(table, col_name);
+        for (int i=0; i<group->npending; ++i) {
+            if (group->pending[i].index == index) return SQLITE_OK;
+        }
+    }
+    
+    sqlite3_int64 insert_fingerprint;
+    if (!dbutils_value_fingerprint(insert_value, &insert_fingerprint)) return SQLITE_OK;
+    
+    sqlite3_stmt *vm = table->meta_fingerprint_stmt;
+    int rc = sqlite3_bind_blob(vm, 1, (const void *)pk, pklen, SQLITE_STATIC);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_bind_text(vm, 2, col_name, -1, SQLITE_STATIC);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_step(vm);
+    if (rc == SQLITE_ROW) {
+        if (sqlite3_column_type(vm, 0) == SQLITE_INTEGER) *ret = dbutils_fingerprint_compare(insert_fingerprint, sqlite3_column_int64(vm, 0), decided);
+        rc = SQLITE_OK;
+    } else if (rc == SQLITE_DONE) {
+        rc = SQLITE_OK;
+    }
+    
+cleanup:
+    if (rc != SQLITE_OK) *err = sqlite3_errmsg(sqlite3_db_handle(vm));
+    stmt_reset(vm);
+    return rc;
+}
+
 int merge_did_cid_win (cloudsync_context *data, cloudsync_table_context *table, const char *pk, int pklen, sqlite3_value *insert_value, const char *site_id, int site_len, const char *col_name, sqlite3_int64 col_version, bool *didwin_flag, const char **err) {
     
     if (col_name == NULL) col_name = CLOUDSYNC_TOMBSTONE_VALUE;
     
     sqlite3_int64 local_version;
-    int rc = merge_get_col_version(table, col_name, pk, pklen, &local_version, err);
+    int rc = merge_group_col_version(data, table, col_name, pk, pklen, &local_version, err);
     if (rc == SQLITE_DONE) {
         // no rows returned, the incoming change wins if there's nothing there locally
         *didwin_flag = true;
@@ -1249,9 +2292,21 @@ int merge_did_cid_win (cloudsync_context *data, cloudsync_table_context *table,
     }
     
     // rc == SQLITE_ROW and col_version == local_version, need to compare values
+    // the fingerprint of the local value decides most of the ties without reading the augmented table
+    int ret = 0;
+    bool decided = false;
+    rc = merge_compare_fingerprint(data, table, pk, pklen, insert_value, col_name, &ret, &decided, err);
+    if (rc != SQLITE_OK) return rc;
+    
+    sqlite3_stmt *vm = NULL;
+    if (decided) goto decide_winner;
+    
+    // pending columns of the row must be written before reading the local value
+    rc = merge_group_flush(data);
+    if (apply_error_is_fatal(rc)) {*err = "Unable to write the pending columns in merge_did_cid_win."; return rc;}
     
     // retrieve col_value precompiled statement
-    sqlite3_stmt *vm = table_column_lookup(table, col_name, false, NULL);
+    vm = table_column_lookup(table, col_name, false, NULL);
     if (!vm) {
         *err = "Unable to retrieve column value precompiled statement in merge_did_cid_win.";
         return SQLITE_ERROR;
@@ -1283,10 +2338,11 @@ int merge_did_cid_win (cloudsync_context *data, cloudsync_table_context *table,
     }
     
     // compare values
-    int ret = dbutils_value_compare(insert_value, local_value);
+    ret = dbutils_value_compare(insert_value, local_value);
     // reset after compare, otherwise local value would be deallocated
     vm = stmt_reset(vm);
     
+decide_winner:;
     bool compare_site_id = (ret == 0 && data->merge_equal_values == true);
     if (!compare_site_id) {
         *didwin_flag = (ret > 0);
@@ -1366,95 +2422,70 @@ int cloudsync_merge_insert_gos (sqlite3_vtab *vtab, cloudsync_context *data, clo
     return rc;
 }
 
-int cloudsync_merge_insert (sqlite3_vtab *vtab, int argc, sqlite3_value **argv, sqlite3_int64 *rowid) {
-    // this function performs the merging logic for an insert in a cloud-synchronized table. It handles
-    // different scenarios including conflicts, causal lengths, delete operations, and resurrecting rows
-    // based on the incoming data (from remote nodes or clients) and the local database state
-
-    // this function handles different CRDT algorithms (GOS, DWS, AWS, and CLS).
-    // the merging strategy is determined based on the table->algo value.
-    
-    // meta table declaration:
-    // tbl TEXT NOT NULL, pk BLOB NOT NULL, col_name TEXT NOT NULL,"
-    // "col_value ANY, col_version INTEGER NOT NULL, db_version INTEGER NOT NULL,"
-    // "site_id BLOB NOT NULL, cl INTEGER NOT NULL, seq INTEGER NOT NULL
-    
-    // meta information to retrieve from arguments:
-    // argv[0] -> table name (TEXT)
-    // argv[1] -> primary key (BLOB)
-    // argv[2] -> column name (TEXT or NULL if sentinel)
-    // argv[3] -> column value (ANY)
-    // argv[4] -> column version (INTEGER)
-    // argv[5] -> database version (INTEGER)
-    // argv[6] -> site ID (BLOB, identifies the origin of the update)
-    // argv[7] -> causal length (INTEGER, tracks the order of operations)
-    // argv[8] -> sequence number (INTEGER, unique per operation)
+int cloudsync_merge_insert_cls (sqlite3_vtab *vtab, cloudsync_context *data, cloudsync_table_context *table, const char *insert_pk, int insert_pk_len, const char *insert_name, sqlite3_value *insert_value, sqlite3_int64 insert_col_version, sqlite3_int64 insert_db_version, const char *insert_site_id, int insert_site_id_len, sqlite3_int64 insert_cl, sqlite3_int64 insert_seq, sqlite3_int64 *rowid) {
+    // Causal-Length Set (CLS) Algorithm (default)
     
-    // extract table name
-    const char *insert_tbl = (const char *)sqlite3_value_text(argv[0]);
+    // check if the operation is a delete by examining the causal length
+    // even causal lengths typically signify delete operations
+    bool is_delete = (insert_cl % 2 == 0);
+    bool is_sentinel_only = (strcmp(insert_name, CLOUDSYNC_TOMBSTONE_VALUE) == 0);
     
-    // lookup table
-    cloudsync_context *data = cloudsync_vtab_get_context(vtab);
-    cloudsync_table_context *table = table_lookup(data, insert_tbl);
-    if (!table) return cloudsync_vtab_set_error(vtab, "Unable to find table %s,", insert_tbl);
+    // a row already merged by this payload can be discarded without reading its clocks
+    // when the causal length alone decides the outcome (same checks performed below)
+    sqlite3_int64 local_cl;
+    cloudsync_merge_group *group = &data->merge_group;
+    if (merge_cl_cache_get(group, table, insert_pk, insert_pk_len, &local_cl)) {
+        if (insert_cl < local_cl) return SQLITE_OK;
+        if ((insert_cl == local_cl) && (is_delete || is_sentinel_only)) return SQLITE_OK;
+    }
     
-    // extract the remaining fields from the input values
-    const char *insert_pk = (const char *)sqlite3_value_blob(argv[1]);
-    int insert_pk_len = sqlite3_value_bytes(argv[1]);
-    const char *insert_name = (sqlite3_value_type(argv[2]) == SQLITE_NULL) ? CLOUDSYNC_TOMBSTONE_VALUE : (const char *)sqlite3_value_text(argv[2]);
-    sqlite3_value *insert_value = argv[3];
-    sqlite3_int64 insert_col_version = sqlite3_value_int64(argv[4]);
-    sqlite3_int64 insert_db_version = sqlite3_value_int64(argv[5]);
-    const char *insert_site_id = (const char *)sqlite3_value_blob(argv[6]);
-    int insert_site_id_len = sqlite3_value_bytes(argv[6]);
-    sqlite3_int64 insert_cl = sqlite3_value_int64(argv[7]);
-    sqlite3_int64 insert_seq = sqlite3_value_int64(argv[8]);
+    // load the clocks of the row (a no-op if the previous change of the batch targeted the same row)
     const char *err = NULL;
-    
-    // perform different logic for each different table algorithm
-    if (table->algo == table_algo_crdt_gos) return cloudsync_merge_insert_gos(vtab, data, table, insert_pk, insert_pk_len, insert_name, insert_value, insert_col_version, insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid);
-    
-    // Handle DWS and AWS algorithms here
-    // Delete-Wins Set (DWS): table_algo_crdt_dws
-    // Add-Wins Set (AWS): table_algo_crdt_aws
-    
-    // Causal-Length Set (CLS) Algorithm (default)
+    int rc = merge_group_load(data, table, insert_pk, insert_pk_len, &err);
+    if (rc != SQLITE_OK) {
+        // keep the error code, the payload apply stops on I/O, memory and locking errors
+        cloudsync_vtab_set_error(vtab, "Unable to compute local causal length: %s", err);
+        return rc;
+    }
     
     // compute the local causal length for the row based on the primary key
     // the causal length is used to determine the order of operations and resolve conflicts.
-    sqlite3_int64 local_cl = merge_get_local_cl(table, insert_pk, insert_pk_len, &err);
-    if (local_cl < 0) {
-        return cloudsync_vtab_set_error(vtab, "Unable to compute local causal length: %s", err);
-    }
+    local_cl = merge_group_local_cl(group);
     
     // if the incoming causal length is older than the local causal length, we can safely ignore it
     // because the local changes are more recent
     if (insert_cl < local_cl) return SQLITE_OK;
     
-    // check if the operation is a delete by examining the causal length
-    // even causal lengths typically signify delete operations
-    bool is_delete = (insert_cl % 2 == 0);
     if (is_delete) {
         // if it's a delete, check if the local state is at the same causal length
         // if it is, no further action is needed
         if (local_cl == insert_cl) return SQLITE_OK;
         
         // perform a delete merge if the causal length is newer than the local one
-        int rc = merge_delete(data, table, insert_pk, insert_pk_len, insert_name, insert_col_version,
-                              insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid, &err);
-        if (rc != SQLITE_OK) cloudsync_vtab_set_error(vtab, "Unable to perform merge_delete: %s", err);
+        rc = merge_group_flush(data);
+        if (apply_error_is_fatal(rc)) {cloudsync_vtab_set_error(vtab, "Unable to write the pending columns: %s", sqlite3_errstr(rc)); return rc;}
+        rc = merge_delete(data, table, insert_pk, insert_pk_len, insert_name, insert_col_version,
+                          insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid, &err);
+        if (rc != SQLITE_OK) return cloudsync_vtab_set_error(vtab, "Unable to perform merge_delete: %s", err);
+        
+        merge_group_set_clock(group, insert_name, insert_col_version);
+        merge_group_drop_clocks(group, CLOUDSYNC_VALUE_NOTSET);
         return rc;
     }
     
     // if the operation is a sentinel-only insert (indicating a new row or resurrected row with no column update), handle it separately.
-    bool is_sentinel_only = (strcmp(insert_name, CLOUDSYNC_TOMBSTONE_VALUE) == 0);
     if (is_sentinel_only) {
         if (local_cl == insert_cl) return SQLITE_OK;
         
         // perform a sentinel-only insert to track the existence of the row
-        int rc = merge_sentinel_only_insert(data, table, insert_pk, insert_pk_len, insert_col_version,
-                                            insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid, &err);
-        if (rc != SQLITE_OK) cloudsync_vtab_set_error(vtab, "Unable to perform merge_sentinel_only_insert: %s", err);
+        rc = merge_group_flush(data);
+        if (apply_error_is_fatal(rc)) {cloudsync_vtab_set_error(vtab, "Unable to write the pending columns: %s", sqlite3_errstr(rc)); return rc;}
+        rc = merge_sentinel_only_insert(data, table, insert_pk, insert_pk_len, insert_col_version,
+                                        insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid, &err);
+        if (rc != SQLITE_OK) return cloudsync_vtab_set_error(vtab, "Unable to perform merge_sentinel_only_insert: %s", err);
+        
+        merge_group_drop_clocks(group, 0);
+        merge_group_set_clock(group, NULL, insert_col_version);
         return rc;
     }
     
@@ -1468,45 +2499,129 @@ int cloudsync_merge_insert (sqlite3_vtab *vtab, int argc, sqlite3_value **argv,
     // if a resurrection is needed, insert a sentinel to mark the row as alive
     // this handles out-of-order deliveries where the row was deleted and is now being re-inserted
     if (needs_resurrect && (row_exists_locally || (!row_exists_locally && insert_cl > 1))) {
-        int rc = merge_sentinel_only_insert(data, table, insert_pk, insert_pk_len, insert_cl,
-                                            insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid, &err);
-        if (rc != SQLITE_OK) {
-            cloudsync_vtab_set_error(vtab, "Unable to perform merge_sentinel_only_insert: %s", err);
-            return rc;
-        }
+        rc = merge_group_flush(data);
+        if (apply_error_is_fatal(rc)) {cloudsync_vtab_set_error(vtab, "Unable to write the pending columns: %s", sqlite3_errstr(rc)); return rc;}
+        rc = merge_sentinel_only_insert(data, table, insert_pk, insert_pk_len, insert_cl,
+                                        insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid, &err);
+        if (rc != SQLITE_OK) return cloudsync_vtab_set_error(vtab, "Unable to perform merge_sentinel_only_insert: %s", err);
+        
+        merge_group_drop_clocks(group, 0);
+        merge_group_set_clock(group, NULL, insert_cl);
     }
     
     // at this point, we determine whether the incoming change wins based on causal length
     // this can be due to a resurrection, a non-existent local row, or a conflict resolution
     bool flag = false;
-    int rc = merge_did_cid_win(data, table, insert_pk, insert_pk_len, insert_value, insert_site_id, insert_site_id_len, insert_name, insert_col_version, &flag, &err);
-    if (rc != SQLITE_OK) {
-        cloudsync_vtab_set_error(vtab, "Unable to perform merge_did_cid_win: %s", err);
-        return rc;
-    }
+    rc = merge_did_cid_win(data, table, insert_pk, insert_pk_len, insert_value, insert_site_id, insert_site_id_len, insert_name, insert_col_version, &flag, &err);
+    if (rc != SQLITE_OK) {cloudsync_vtab_set_error(vtab, "Unable to perform merge_did_cid_win: %s", err); return rc;}
     
     // check if the incoming change wins and should be applied
     bool does_cid_win = ((needs_resurrect) || (!row_exists_locally) || (flag));
     if (!does_cid_win) return SQLITE_OK;
     
     // perform the final column insert or update if the incoming change wins
-    rc = merge_insert_col(data, table, insert_pk, insert_pk_len, insert_name, insert_value, insert_col_version, insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid, &err);
-    if (rc != SQLITE_OK) cloudsync_vtab_set_error(vtab, "Unable to perform merge_insert_col: %s", err);
+    // (inside a payload batch the column is queued and written together with the other winning columns of the row)
+    bool deferred = false;
+    rc = merge_group_defer_col(data, table, insert_name, insert_value, insert_col_version, insert_db_version, insert_site_id, insert_site_id_len, insert_seq, &deferred);
+    if (rc != SQLITE_OK) return cloudsync_vtab_set_error(vtab, "Unable to queue merge_insert_col: %s", sqlite3_errstr(rc));
+    
+    if (!deferred) {
+        rc = merge_insert_col(data, table, insert_pk, insert_pk_len, insert_name, insert_value, insert_col_version, insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid, &err);
+        if (rc != SQLITE_OK) return cloudsync_vtab_set_error(vtab, "Unable to perform merge_insert_col: %s", err);
+    }
+    
+    merge_group_set_clock(group, insert_name, insert_col_version);
     return rc;
 }
 
-// MARK: - Private -
-
-bool cloudsync_config_exists (sqlite3 *db) {
-    return dbutils_table_exists(db, CLOUDSYNC_SITEID_NAME) == true;
-}
+int cloudsync_merge_insert (sqlite3_vtab *vtab, int argc, sqlite3_value **argv, sqlite3_int64 *rowid) {
+    // this function performs the merging logic for an insert in a cloud-synchronized table. It handles
+    // different scenarios including conflicts, causal lengths, delete operations, and resurrecting rows
+    // based on the incoming data (from remote nodes or clients) and the local database state
 
-void *cloudsync_context_create (void) {
-    cloudsync_context *data = (cloudsync_context *)cloudsync_memory_zeroalloc((uint64_t)(sizeof(cloudsync_context)));
-    DEBUG_SETTINGS("cloudsync_context_create %p", data);
+    // this function handles different CRDT algorithms (GOS, DWS, AWS, and CLS).
+    // the merging strategy is determined based on the table->algo value.
     
-    data->libversion = CLOUDSYNC_VERSION;
-    #if CLOUDSYNC_DEBUG
+    // meta table declaration:
+    // tbl TEXT NOT NULL, pk BLOB NOT NULL, col_name TEXT NOT NULL,"
+    // "col_value ANY, col_version INTEGER NOT NULL, db_version INTEGER NOT NULL,"
+    // "site_id BLOB NOT NULL, cl INTEGER NOT NULL, seq INTEGER NOT NULL
+    
+    // meta information to retrieve from arguments:
+    // argv[0] -> table name (TEXT)
+    // argv[1] -> primary key (BLOB)
+    // argv[2] -> column name (TEXT or NULL if sentinel)
+    // argv[3] -> column value (ANY)
+    // argv[4] -> column version (INTEGER)
+    // argv[5] -> database version (INTEGER)
+    // argv[6] -> site ID (BLOB, identifies the origin of the update)
+    // argv[7] -> causal length (INTEGER, tracks the order of operations)
+    // argv[8] -> sequence number (INTEGER, unique per operation)
+    
+    // extract table name
+    const char *insert_tbl = (const char *)sqlite3_value_text(argv[0]);
+    
+    // lookup table
+    cloudsync_context *data = cloudsync_vtab_get_context(vtab);
+    cloudsync_table_context *table = table_lookup(data, insert_tbl);
+    if (!table) return cloudsync_vtab_set_error(vtab, "Unable to find table %s,", insert_tbl);
+    
+    // the merge reads the local clocks from the meta table
+    int rc = cloudsync_deferred_flush(data);
+    if (rc != SQLITE_OK) return cloudsync_vtab_set_error(vtab, "Unable to write the deferred meta changes (%d).", rc);
+    
+    // extract the remaining fields from the input values
+    const char *insert_pk = (const char *)sqlite3_value_blob(argv[1]);
+    int insert_pk_len = sqlite3_value_bytes(argv[1]);
+    const char *insert_name = (sqlite3_value_type(argv[2]) == SQLITE_NULL) ? CLOUDSYNC_TOMBSTONE_VALUE : (const char *)sqlite3_value_text(argv[2]);
+    sqlite3_value *insert_value = argv[3];
+    sqlite3_int64 insert_col_version = sqlite3_value_int64(argv[4]);
+    sqlite3_int64 insert_db_version = sqlite3_value_int64(argv[5]);
+    const char *insert_site_id = (const char *)sqlite3_value_blob(argv[6]);
+    int insert_site_id_len = sqlite3_value_bytes(argv[6]);
+    sqlite3_int64 insert_cl = sqlite3_value_int64(argv[7]);
+    sqlite3_int64 insert_seq = sqlite3_value_int64(argv[8]);
+    
+    // perform different logic for each different table algorithm
+    // GOS does not use the row clocks, so any cached row is simply discarded
+    if (table->algo == table_algo_crdt_gos) {
+        rc = merge_group_reset(data);
+        if (apply_error_is_fatal(rc)) {cloudsync_vtab_set_error(vtab, "Unable to write the pending columns: %s", sqlite3_errstr(rc)); return rc;}
+        return cloudsync_merge_insert_gos(vtab, data, table, insert_pk, insert_pk_len, insert_name, insert_value, insert_col_version, insert_db_version, insert_site_id, insert_site_id_len, insert_seq, rowid);
+    }
+    
+    // Handle DWS and AWS algorithms here
+    // Delete-Wins Set (DWS): table_algo_crdt_dws
+    // Add-Wins Set (AWS): table_algo_crdt_aws
+    
+    rc = cloudsync_merge_insert_cls(vtab, data, table, insert_pk, insert_pk_len, insert_name, insert_value, insert_col_version, insert_db_version, insert_site_id, insert_site_id_len, insert_cl, insert_seq, rowid);
+    
+    // the cached clocks are reused only by the next change of the same payload batch and only
+    // if they are known to reflect the meta table (a failed merge can leave it partially updated)
+    if ((rc != SQLITE_OK) || (!data->merge_group.batch)) {
+        int reset_rc = merge_group_reset(data);
+        if (apply_error_is_fatal(reset_rc) && rc == SQLITE_OK) {
+            cloudsync_vtab_set_error(vtab, "Unable to write the pending columns: %s", sqlite3_errstr(reset_rc));
+            rc = reset_rc;
+        }
+    }
+    if (rc != SQLITE_OK) merge_cl_cache_clear(&data->merge_group);
+    if (rc != SQLITE_OK) db_version_store_reset(data);
+    return rc;
+}
+
+// MARK: - Private -
+
+bool cloudsync_config_exists (sqlite3 *db) {
+    return dbutils_table_exists(db, CLOUDSYNC_SITEID_NAME) == true;
+}
+
+void *cloudsync_context_create (void) {
+    cloudsync_context *data = (cloudsync_context *)cloudsync_memory_zeroalloc((uint64_t)(sizeof(cloudsync_context)));
+    DEBUG_SETTINGS("cloudsync_context_create %p", data);
+    
+    data->libversion = CLOUDSYNC_VERSION;
+    #if CLOUDSYNC_DEBUG
     data->debug = 1;
     #endif
     
@@ -1518,6 +2633,13 @@ void *cloudsync_context_create (void) {
     }
     data->tables_alloc = CLOUDSYNC_INIT_NTABLES;
     data->tables_count = 0;
+    data->cache_data_version = CLOUDSYNC_VALUE_NOTSET;
+    data->stored_db_version = CLOUDSYNC_VALUE_NOTSET;
+    data->siteid_base_ord = CLOUDSYNC_VALUE_NOTSET;
+    data->siteid_count = CLOUDSYNC_VALUE_NOTSET;
+    data->page_db_version = CLOUDSYNC_VALUE_NOTSET;
+    data->page_seq = CLOUDSYNC_VALUE_NOTSET;
+    data->payload_version = CLOUDSYNC_PAYLOAD_VERSION_DEFAULT;
         
     return data;
 }
@@ -1527,6 +2649,13 @@ void cloudsync_context_free (void *ptr) {
     if (!ptr) return;
         
     cloudsync_context *data = (cloudsync_context*)ptr;
+    siteid_cache_free(data);
+    merge_group_free(data);
+    deferred_meta_free(data);
+    cloudsync_arena_free(&data->arena);
+    apply_errors_clear(data);
+    if (data->apply_errors) cloudsync_memory_free(data->apply_errors);
+    if (data->tables_index) kh_destroy(NAME_TO_TABLE, data->tables_index);
     cloudsync_memory_free(data->tables);
     cloudsync_memory_free(data);
 }
@@ -1564,6 +2693,24 @@ void cloudsync_sync_key(cloudsync_context *data, const char *key, const char *va
         if (value && (value[0] != 0) && (value[0] != '0')) data->debug = 1;
         return;
     }
+    
+    if (strcmp(key, CLOUDSYNC_KEY_APPLY_SORTED) == 0) {
+        data->apply_sorted = (value && (value[0] != 0) && (value[0] != '0'));
+        return;
+    }
+    
+    if (strcmp(key, CLOUDSYNC_KEY_APPLY_ERRORS) == 0) {
+        data->apply_errors_max = (value) ? (int)strtol(value, NULL, 0) : 0;
+        if (data->apply_errors_max < 0) data->apply_errors_max = 0;
+        return;
+    }
+    
+    if (strcmp(key, CLOUDSYNC_KEY_PAYLOAD_VERSION) == 0) {
+        // newer versions must be enabled only when all the receivers can decode them
+        int version = (value) ? (int)strtol(value, NULL, 0) : 0;
+        data->payload_version = (version >= CLOUDSYNC_PAYLOAD_VERSION_1 && version <= CLOUDSYNC_PAYLOAD_VERSION) ? version : CLOUDSYNC_PAYLOAD_VERSION_DEFAULT;
+        return;
+    }
 }
 
 #if 0
@@ -1577,18 +2724,44 @@ void cloudsync_sync_table_key(cloudsync_context *data, const char *table, const
 int cloudsync_commit_hook (void *ctx) {
     cloudsync_context *data = (cloudsync_context *)ctx;
     
+    // the commit hook cannot write to the database, so deferred writes must be flushed (cloudsync_flush) before
+    // the commit: if they are not, the commit is turned into a rollback instead of losing the changes metadata
+    if (data->deferred_live > 0) {
+        deferred_meta_clear(data);
+        return 1;
+    }
+    
     data->db_version = data->pending_db_version;
     data->pending_db_version = CLOUDSYNC_VALUE_NOTSET;
+    data->db_version_checked = false;
+    data->stored_db_version = CLOUDSYNC_VALUE_NOTSET;
+    data->caches_checked = false;
     data->seq = 0;
     
+    // the site_id values inserted by the transaction are committed
+    data->siteid_base_ord = CLOUDSYNC_VALUE_NOTSET;
+    
     return SQLITE_OK;
 }
 
 void cloudsync_rollback_hook (void *ctx) {
     cloudsync_context *data = (cloudsync_context *)ctx;
+    deferred_meta_clear(data);
     
     data->pending_db_version = CLOUDSYNC_VALUE_NOTSET;
+    data->db_version_checked = false;
+    data->stored_db_version = CLOUDSYNC_VALUE_NOTSET;
+    data->caches_checked = false;
     data->seq = 0;
+    
+    // rowids assigned to new site_id values are not valid anymore
+    siteid_cache_clear(data);
+    data->siteid_base_ord = CLOUDSYNC_VALUE_NOTSET;
+    data->siteid_count = CLOUDSYNC_VALUE_NOTSET;
+    
+    // the returned page can contain changes of the rolled back transaction
+    data->page_db_version = CLOUDSYNC_VALUE_NOTSET;
+    data->page_seq = CLOUDSYNC_VALUE_NOTSET;
 }
 
 int cloudsync_finalize_alter (sqlite3_context *context, cloudsync_context *data, cloudsync_table_context *table) {
@@ -1672,6 +2845,17 @@ int cloudsync_finalize_alter (sqlite3_context *context, cloudsync_context *data,
             DEBUG_SQLITE_ERROR(rc, "cloudsync_finalize_alter", db);
             goto finalize;
         }
+        
+        // the altered columns could have a different affinity, so the values fingerprints are no longer reliable
+        if (table->has_fingerprint) {
+            sql = cloudsync_memory_mprintf("UPDATE \"%w_cloudsync\" SET col_fingerprint = NULL WHERE col_fingerprint IS NOT NULL;", table->name);
+            rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+            cloudsync_memory_free(sql);
+            if (rc != SQLITE_OK) {
+                DEBUG_SQLITE_ERROR(rc, "cloudsync_finalize_alter", db);
+                goto finalize;
+            }
+        }
 
     }
     
@@ -1691,7 +2875,8 @@ int cloudsync_refill_metatable (sqlite3 *db, cloudsync_context *data, const char
     if (!table) return SQLITE_INTERNAL;
     
     sqlite3_stmt *vm = NULL;
-    sqlite3_int64 db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
+    // the version is stored by db_version_next, so it is computed only if there are missing columns to mark
+    sqlite3_int64 db_version = CLOUDSYNC_VALUE_NOTSET;
     
     char *sql = cloudsync_memory_mprintf("SELECT group_concat('\"' || format('%%w', name) || '\"', ',') FROM pragma_table_info('%q') WHERE pk>0 ORDER BY pk;", table_name);
     char *pkclause_identifiers = dbutils_text_select(db, sql);
@@ -1732,7 +2917,8 @@ int cloudsync_refill_metatable (sqlite3 *db, cloudsync_context *data, const char
             if (rc == SQLITE_ROW) {
                 const char *pk = (const char *)sqlite3_column_text(vm, 0);
                 size_t pklen = strlen(pk);
-                rc = local_mark_insert_or_update_meta(db, table, pk, pklen, col_name, db_version, BUMP_SEQ(data));
+                if (db_version == CLOUDSYNC_VALUE_NOTSET) db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
+                rc = local_mark_insert_or_update_meta(db, table, pk, pklen, col_name, NULL, db_version, BUMP_SEQ(data));
             } else if (rc == SQLITE_DONE) {
                 rc = SQLITE_OK;
                 break;
@@ -1771,6 +2957,7 @@ int local_update_sentinel (sqlite3 *db, cloudsync_table_context *table, const ch
     
     rc = sqlite3_step(vm);
     if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    if (rc == SQLITE_OK) table_set_max_db_version(table, db_version);
     
 cleanup:
     DEBUG_SQLITE_ERROR(rc, "local_update_sentinel", db);
@@ -1799,6 +2986,7 @@ int local_mark_insert_sentinel_meta (sqlite3 *db, cloudsync_table_context *table
     
     rc = sqlite3_step(vm);
     if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    if (rc == SQLITE_OK) table_set_max_db_version(table, db_version);
     
 cleanup:
     DEBUG_SQLITE_ERROR(rc, "local_insert_sentinel", db);
@@ -1806,7 +2994,7 @@ cleanup:
     return rc;
 }
 
-int local_mark_insert_or_update_meta_impl (sqlite3 *db, cloudsync_table_context *table, const char *pk, size_t pklen, const char *col_name, int col_version, sqlite3_int64 db_version, int seq) {
+int local_mark_insert_or_update_meta_impl (sqlite3 *db, cloudsync_table_context *table, const char *pk, size_t pklen, const char *col_name, sqlite3_value *col_value, int col_version, sqlite3_int64 db_version, int seq) {
     
     sqlite3_stmt *vm = table->meta_row_insert_update_stmt;
     if (!vm) return -1;
@@ -1832,8 +3020,17 @@ int local_mark_insert_or_update_meta_impl (sqlite3 *db, cloudsync_table_context
     rc = sqlite3_bind_int(vm, 7, seq);
     if (rc != SQLITE_OK) goto cleanup;
     
+    // col_value is the new value of the column (NULL if unknown)
+    if (table->has_fingerprint) {
+        sqlite3_int64 fingerprint;
+        if (col_value && dbutils_value_fingerprint(col_value, &fingerprint)) rc = sqlite3_bind_int64(vm, 8, fingerprint);
+        else rc = sqlite3_bind_null(vm, 8);
+        if (rc != SQLITE_OK) goto cleanup;
+    }
+    
     rc = sqlite3_step(vm);
     if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    if (rc == SQLITE_OK) table_set_max_db_version(table, db_version);
     
 cleanup:
     DEBUG_SQLITE_ERROR(rc, "local_insert_or_update", db);
@@ -1841,12 +3038,12 @@ cleanup:
     return rc;
 }
 
-int local_mark_insert_or_update_meta (sqlite3 *db, cloudsync_table_context *table, const char *pk, size_t pklen, const char *col_name, sqlite3_int64 db_version, int seq) {
-    return local_mark_insert_or_update_meta_impl(db, table, pk, pklen, col_name, 1, db_version, seq);
+int local_mark_insert_or_update_meta (sqlite3 *db, cloudsync_table_context *table, const char *pk, size_t pklen, const char *col_name, sqlite3_value *col_value, sqlite3_int64 db_version, int seq) {
+    return local_mark_insert_or_update_meta_impl(db, table, pk, pklen, col_name, col_value, 1, db_version, seq);
 }
 
 int local_mark_delete_meta (sqlite3 *db, cloudsync_table_context *table, const char *pk, size_t pklen, sqlite3_int64 db_version, int seq) {
-    return local_mark_insert_or_update_meta_impl(db, table, pk, pklen, NULL, 2, db_version, seq);
+    return local_mark_insert_or_update_meta_impl(db, table, pk, pklen, NULL, NULL, 2, db_version, seq);
 }
 
 int local_drop_meta (sqlite3 *db, cloudsync_table_context *table, const char *pk, size_t pklen) {
@@ -1903,6 +3100,7 @@ int local_update_move_meta (sqlite3 *db, cloudsync_table_context *table, const c
     
     rc = sqlite3_step(vm);
     if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    if (rc == SQLITE_OK) table_set_max_db_version(table, db_version);
     
 cleanup:
     DEBUG_SQLITE_ERROR(rc, "local_update_move_meta", db);
@@ -1910,11 +3108,457 @@ cleanup:
     return rc;
 }
 
+// MARK: - Deferred Meta -
+
+bool deferred_meta_enabled (cloudsync_context *data, sqlite3 *db) {
+    // writes are buffered only within explicit transactions, an autocommit statement has no chance to call cloudsync_flush
+    return (data->defer_meta && sqlite3_get_autocommit(db) == 0);
+}
+
+void deferred_meta_clear (cloudsync_context *data) {
+    for (int i=0; i<data->deferred_count; ++i) {
+        if (data->deferred[i].before) sqlite3_value_free(data->deferred[i].before);
+    }
+    cloudsync_arena_reset(&data->deferred_arena);
+    if (data->deferred_index) kh_clear(META_DEFERRED, data->deferred_index);
+    data->deferred_count = 0;
+    data->deferred_live = 0;
+}
+
+void deferred_meta_free (cloudsync_context *data) {
+    deferred_meta_clear(data);
+    if (data->deferred_index) kh_destroy(META_DEFERRED, data->deferred_index);
+    if (data->deferred) cloudsync_memory_free(data->deferred);
+    cloudsync_arena_free(&data->deferred_arena);
+    data->deferred_index = NULL;
+    data->deferred = NULL;
+    data->deferred_alloc = 0;
+}
+
+int deferred_meta_add (cloudsync_context *data, cloudsync_table_context *table, const char *pk, size_t pklen, int col_index, sqlite3_value *col_value, sqlite3_value *old_value, sqlite3_int64 db_version, int seq) {
+    // buffer a local column write, a write to a (table, pk, column) already buffered is collapsed into its entry
+    // (old_value is the value replaced by an update, NULL for an insert)
+    if (!data->deferred_index) {
+        data->deferred_index = kh_init(META_DEFERRED);
+        if (!data->deferred_index) return SQLITE_NOMEM;
+    }
+    
+    cloudsync_deferred_meta *entry = NULL;
+    cloudsync_meta_key key = {.table = table, .pk = pk, .pk_len = (int)pklen, .col_index = col_index};
+    khiter_t k = kh_get(META_DEFERRED, data->deferred_index, key);
+    if (k != kh_end(data->deferred_index)) {
+        entry = &data->deferred[kh_value(data->deferred_index, k)];
+        ++entry->count;
+    } else {
+        if (data->deferred_count >= data->deferred_alloc) {
+            int alloc = (data->deferred_alloc) ? data->deferred_alloc * 2 : 1024;
+            cloudsync_deferred_meta *clone = (cloudsync_deferred_meta *)cloudsync_memory_realloc(data->deferred, (sqlite3_uint64)(alloc * sizeof(cloudsync_deferred_meta)));
+            if (!clone) return SQLITE_NOMEM;
+            data->deferred = clone;
+            data->deferred_alloc = alloc;
+        }
+        
+        char *buffer = cloudsync_arena_memdup(&data->deferred_arena, pk, pklen);
+        if (!buffer) return SQLITE_NOMEM;
+        
+        sqlite3_value *before = NULL;
+        if (old_value) {
+            before = sqlite3_value_dup(old_value);
+            if (!before) return SQLITE_NOMEM;
+        }
+        
+        // the key points to the pk of the entry
+        key.pk = buffer;
+        int absent = 0;
+        k = kh_put(META_DEFERRED, data->deferred_index, key, &absent);
+        if (absent < 0) {
+            if (before) sqlite3_value_free(before);
+            return SQLITE_NOMEM;
+        }
+        kh_value(data->deferred_index, k) = data->deferred_count;
+        
+        entry = &data->deferred[data->deferred_count++];
+        entry->table = table;
+        entry->pk = buffer;
+        entry->pk_len = (int)pklen;
+        entry->col_index = col_index;
+        entry->count = 1;
+        entry->delete_count = 0;
+        entry->before = before;
+        ++data->deferred_live;
+    }
+    
+    // the last write decides the clocks, the fingerprint is computed by the flush from the current value
+    // (the buffer does not see statement and savepoint rollbacks, so the written value may have been undone)
+    entry->db_version = db_version;
+    entry->seq = seq;
+    entry->has_fingerprint = (col_value != NULL);
+    return SQLITE_OK;
+}
+
+bool deferred_meta_has_pk (cloudsync_context *data, cloudsync_table_context *table, const char *pk, size_t pklen) {
+    if (data->deferred_live == 0) return false;
+    
+    cloudsync_meta_key key = {.table = table, .pk = pk, .pk_len = (int)pklen};
+    for (int i=0; i<table->ncols; ++i) {
+        key.col_index = i;
+        if (kh_get(META_DEFERRED, data->deferred_index, key) != kh_end(data->deferred_index)) return true;
+    }
+    return false;
+}
+
+void deferred_meta_mark_delete (cloudsync_context *data, cloudsync_table_context *table, const char *pk, size_t pklen, sqlite3_int64 db_version, int seq) {
+    // the buffered writes of a deleted row are discarded by the flush, as local_drop_meta does with the stored ones,
+    // but only if the tombstone is still there (the delete can be undone by a statement or savepoint rollback)
+    if (data->deferred_live == 0) return;
+    
+    cloudsync_meta_key key = {.table = table, .pk = pk, .pk_len = (int)pklen};
+    for (int i=0; i<table->ncols; ++i) {
+        key.col_index = i;
+        khiter_t k = kh_get(META_DEFERRED, data->deferred_index, key);
+        if (k == kh_end(data->deferred_index)) continue;
+        
+        cloudsync_deferred_meta *entry = &data->deferred[kh_value(data->deferred_index, k)];
+        entry->delete_count = entry->count;
+        entry->delete_db_version = db_version;
+        entry->delete_seq = seq;
+    }
+}
+
+int deferred_meta_compare (const void *p1, const void *p2) {
+    // group the entries by table and sort them by pk, so each multi-row INSERT writes adjacent meta rows
+    const cloudsync_deferred_meta *e1 = (const cloudsync_deferred_meta *)p1;
+    const cloudsync_deferred_meta *e2 = (const cloudsync_deferred_meta *)p2;
+    if (e1->table != e2->table) return ((uintptr_t)e1->table < (uintptr_t)e2->table) ? -1 : 1;
+    
+    int len = (e1->pk_len < e2->pk_len) ? e1->pk_len : e2->pk_len;
+    int res = memcmp(e1->pk, e2->pk, (size_t)len);
+    if (res != 0) return res;
+    if (e1->pk_len != e2->pk_len) return (e1->pk_len < e2->pk_len) ? -1 : 1;
+    return e1->col_index - e2->col_index;
+}
+
+sqlite3_stmt *table_deferred_meta_stmt (cloudsync_table_context *table, int nrows) {
+    // INSERT of nrows deferred entries: col_version is the number of collapsed writes and it is added to the stored one
+    sqlite3_stmt **vm = (nrows == 1) ? &table->meta_deferred_stmt : &table->meta_deferred_batch_stmt;
+    if (*vm) return *vm;
+    
+    const char *row = (table->has_fingerprint) ? "(?,?,?,?,?,0,?)" : "(?,?,?,?,?,0)";
+    size_t rowlen = strlen(row);
+    char *values = cloudsync_memory_alloc((sqlite3_uint64)(nrows * (rowlen + 1)));
+    if (!values) return NULL;
+    
+    size_t seek = 0;
+    for (int i=0; i<nrows; ++i) {
+        if (i > 0) values[seek++] = ',';
+        memcpy(values + seek, row, rowlen);
+        seek += rowlen;
+    }
+    values[seek] = 0;
+    
+    char *sql = NULL;
+    if (table->has_fingerprint) sql = cloudsync_memory_mprintf("INSERT INTO \"%w_cloudsync\" (pk, col_name, col_version, db_version, seq, site_id, col_fingerprint) VALUES %s ON CONFLICT DO UPDATE SET col_version = col_version + excluded.col_version, db_version = excluded.db_version, seq = excluded.seq, site_id = 0, col_fingerprint = excluded.col_fingerprint;", table->name, values);
+    else sql = cloudsync_memory_mprintf("INSERT INTO \"%w_cloudsync\" (pk, col_name, col_version, db_version, seq, site_id) VALUES %s ON CONFLICT DO UPDATE SET col_version = col_version + excluded.col_version, db_version = excluded.db_version, seq = excluded.seq, site_id = 0;", table->name, values);
+    cloudsync_memory_free(values);
+    if (!sql) return NULL;
+    DEBUG_SQL("meta_deferred_stmt: %s", sql);
+    
+    sqlite3 *db = sqlite3_db_handle(table->meta_row_insert_update_stmt);
+    int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, vm, NULL);
+    cloudsync_memory_free(sql);
+    return (rc == SQLITE_OK) ? *vm : NULL;
+}
+
+sqlite3_stmt *table_real_row_stmt (cloudsync_table_context *table) {
+    // column values of a row, used to check the buffered changes against the real table
+    // (a table without columns other than the primary key is checked by the WHERE clause of its merge delete statement)
+    if (!table->real_row_exists_stmt) {
+        const char *sql = (table->real_col_values_stmt) ? sqlite3_sql(table->real_col_values_stmt) : NULL;
+        char *exists_sql = NULL;
+        if (!sql && table->real_merge_delete_stmt) {
+            const char *where = strstr(sqlite3_sql(table->real_merge_delete_stmt), " WHERE ");
+            if (!where) return NULL;
+            exists_sql = cloudsync_memory_mprintf("SELECT 1 FROM \"%w\"%s", table->name, where);
+            if (!exists_sql) return NULL;
+            sql = exists_sql;
+        }
+        if (!sql) return NULL;
+        
+        sqlite3 *db = sqlite3_db_handle(table->meta_pkexists_stmt);
+        int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &table->real_row_exists_stmt, NULL);
+        if (exists_sql) cloudsync_memory_free(exists_sql);
+        if (rc != SQLITE_OK) return NULL;
+    }
+    return table->real_row_exists_stmt;
+}
+
+bool deferred_meta_row_deleted (cloudsync_table_context *table, cloudsync_deferred_meta *entry) {
+    // the delete of the entry has not been rolled back if the sentinel row still has its clock (or a later one)
+    sqlite3_stmt **vm = &table->meta_tombstone_clock_stmt;
+    if (!*vm) {
+        char *sql = cloudsync_memory_mprintf("SELECT db_version, seq FROM \"%w_cloudsync\" WHERE pk = ? AND col_name = '%s';", table->name, CLOUDSYNC_TOMBSTONE_VALUE);
+        if (!sql) return true;
+        DEBUG_SQL("meta_tombstone_clock_stmt: %s", sql);
+        
+        sqlite3 *db = sqlite3_db_handle(table->meta_row_insert_update_stmt);
+        int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, vm, NULL);
+        cloudsync_memory_free(sql);
+        if (rc != SQLITE_OK) return true;
+    }
+    
+    bool deleted = false;
+    int rc = sqlite3_bind_blob(*vm, 1, entry->pk, entry->pk_len, SQLITE_STATIC);
+    if (rc == SQLITE_OK && sqlite3_step(*vm) == SQLITE_ROW) {
+        sqlite3_int64 db_version = sqlite3_column_int64(*vm, 0);
+        int seq = sqlite3_column_int(*vm, 1);
+        deleted = (db_version > entry->delete_db_version) || (db_version == entry->delete_db_version && seq >= entry->delete_seq);
+    }
+    stmt_reset(*vm);
+    return deleted;
+}
+
+sqlite3_stmt *deferred_meta_row_read (cloudsync_table_context *table, const char *pk, int pklen, bool *exists) {
+    // statement and savepoint rollbacks are not seen by the buffer, so a row must still exist to be written
+    // the returned statement (NULL if the row cannot be read) is positioned on the row and it must be reset by the caller
+    *exists = true;
+    sqlite3_stmt *vm = table_real_row_stmt(table);
+    if (!vm) return NULL;
+    
+    int rc = pk_decode_prikey((char *)pk, (size_t)pklen, pk_decode_bind_callback, vm);
+    if (rc >= 0 && sqlite3_step(vm) == SQLITE_ROW) return vm;
+    
+    *exists = (rc < 0);
+    stmt_reset(vm);
+    return NULL;
+}
+
+int deferred_meta_bind (cloudsync_table_context *table, sqlite3_stmt *vm, int index, cloudsync_deferred_meta *entry) {
+    int rc = sqlite3_bind_blob(vm, ++index, entry->pk, entry->pk_len, SQLITE_STATIC);
+    if (rc == SQLITE_OK) rc = sqlite3_bind_text(vm, ++index, table->col_name[entry->col_index], -1, SQLITE_STATIC);
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int(vm, ++index, entry->count);
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int64(vm, ++index, entry->db_version);
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int(vm, ++index, entry->seq);
+    if (rc == SQLITE_OK && table->has_fingerprint) {
+        if (entry->has_fingerprint) rc = sqlite3_bind_int64(vm, ++index, entry->fingerprint);
+        else rc = sqlite3_bind_null(vm, ++index);
+    }
+    return rc;
+}
+
+int deferred_meta_flush (cloudsync_context *data, const char *moved_pk, int moved_pk_len) {
+    // write the buffered column writes with multi-row INSERTs (CLOUDSYNC_DEFER_META_BATCH rows at a time)
+    // moved_pk (if any) is the old primary key of a row being updated, written even if it does not exist anymore
+    if (data->deferred_count == 0) return SQLITE_OK;
+    if (data->deferred_live == 0) {deferred_meta_clear(data); return SQLITE_OK;}
+    
+    // the index points inside the array, so it is cleared before sorting
+    kh_clear(META_DEFERRED, data->deferred_index);
+    qsort(data->deferred, (size_t)data->deferred_count, sizeof(cloudsync_deferred_meta), deferred_meta_compare);
+    
+    int rc = SQLITE_OK;
+    int i = 0;
+    while (i < data->deferred_count && rc == SQLITE_OK) {
+        cloudsync_table_context *table = data->deferred[i].table;
+        if (!table) {++i; continue;}
+        
+        // entries of the same table whose row still exists
+        int batch[CLOUDSYNC_DEFER_META_BATCH];
+        int nbatch = 0;
+        sqlite3_int64 max_db_version = 0;
+        const char *last_pk = NULL;
+        int last_pk_len = 0;
+        bool last_exists = false;
+        sqlite3_stmt *row_vm = NULL;
+        for (; i < data->deferred_count && data->deferred[i].table == table && nbatch < CLOUDSYNC_DEFER_META_BATCH; ++i) {
+            cloudsync_deferred_meta *entry = &data->deferred[i];
+            if (!last_pk || last_pk_len != entry->pk_len || memcmp(last_pk, entry->pk, (size_t)entry->pk_len) != 0) {
+                if (row_vm) {stmt_reset(row_vm); row_vm = NULL;}
+                bool moved = (moved_pk && moved_pk_len == entry->pk_len && memcmp(moved_pk, entry->pk, (size_t)entry->pk_len) == 0);
+                if (moved) last_exists = true;
+                else row_vm = deferred_meta_row_read(table, entry->pk, entry->pk_len, &last_exists);
+                last_pk = entry->pk;
+                last_pk_len = entry->pk_len;
+            }
+            if (!last_exists) continue;
+            
+            // the row has been deleted and inserted again: the writes before the delete are not counted
+            bool reinserted = false;
+            if (entry->delete_count > 0 && deferred_meta_row_deleted(table, entry)) {
+                entry->count -= entry->delete_count;
+                entry->delete_count = 0;
+                reinserted = true;
+                if (entry->count <= 0) continue;
+            }
+            
+            // a column that still holds its value from before the first write has not changed (the writes
+            // have been undone by a rollback or reverted), otherwise the fingerprint is the one of the current value
+            sqlite3_value *value = (row_vm && entry->col_index < sqlite3_column_count(row_vm)) ? sqlite3_column_value(row_vm, entry->col_index) : NULL;
+            if (!reinserted && value && entry->before && dbutils_value_compare(value, entry->before) == 0) continue;
+            if (entry->has_fingerprint) entry->has_fingerprint = (value && dbutils_value_fingerprint(value, &entry->fingerprint));
+            
+            batch[nbatch++] = i;
+            if (entry->db_version > max_db_version) max_db_version = entry->db_version;
+        }
+        if (row_vm) stmt_reset(row_vm);
+        if (nbatch == 0) continue;
+        
+        // a full batch is written by a single statement, the remaining entries one at a time
+        int nrows = (nbatch == CLOUDSYNC_DEFER_META_BATCH) ? CLOUDSYNC_DEFER_META_BATCH : 1;
+        sqlite3_stmt *vm = table_deferred_meta_stmt(table, nrows);
+        if (!vm) {rc = SQLITE_NOMEM; break;}
+        
+        int nparams = (table->has_fingerprint) ? 6 : 5;
+        for (int j=0; j<nbatch && rc == SQLITE_OK; j += nrows) {
+            for (int r=0; r<nrows && rc == SQLITE_OK; ++r) rc = deferred_meta_bind(table, vm, r * nparams, &data->deferred[batch[j+r]]);
+            if (rc == SQLITE_OK) rc = sqlite3_step(vm);
+            if (rc == SQLITE_DONE) rc = SQLITE_OK;
+            stmt_reset(vm);
+        }
+        if (rc == SQLITE_OK) table_set_max_db_version(table, max_db_version);
+    }
+    
+    deferred_meta_clear(data);
+    return rc;
+}
+
+int cloudsync_deferred_flush (cloudsync_context *data) {
+    return deferred_meta_flush(data, NULL, 0);
+}
+
+// MARK: - Local Changes -
+
+int local_insert_row (cloudsync_context *data, cloudsync_table_context *table, const char *pk, size_t pklen) {
+    sqlite3 *db = sqlite3_db_handle(table->meta_pkexists_stmt);
+    
+    // compute the next database version for tracking changes
+    sqlite3_int64 db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
+    
+    // check if a row with the same primary key already exists
+    // if so, this means the row might have been previously deleted (sentinel)
+    bool pk_exists = (bool)stmt_count(table->meta_pkexists_stmt, pk, pklen, SQLITE_BLOB) || deferred_meta_has_pk(data, table, pk, pklen);
+    int rc = SQLITE_OK;
+    
+    if (table->ncols == 0) {
+        // if there are no columns other than primary keys, insert a sentinel record
+        rc = local_mark_insert_sentinel_meta(db, table, pk, pklen, db_version, BUMP_SEQ(data));
+        if (rc != SQLITE_OK) return rc;
+    } else if (pk_exists){
+        // if a row with the same primary key already exists, update the sentinel record
+        rc = local_update_sentinel(db, table, pk, pklen, db_version, BUMP_SEQ(data));
+        if (rc != SQLITE_OK) return rc;
+    }
+    
+    // process each non-primary key column for insert or update
+    for (int i=0; i<table->ncols; ++i) {
+        // mark the column as inserted or updated in the metadata
+        if (deferred_meta_enabled(data, db)) rc = deferred_meta_add(data, table, pk, pklen, i, NULL, NULL, db_version, BUMP_SEQ(data));
+        else rc = local_mark_insert_or_update_meta(db, table, pk, pklen, table->col_name[i], NULL, db_version, BUMP_SEQ(data));
+        if (rc != SQLITE_OK) return rc;
+    }
+    
+    // bound the memory used by the deferred writes
+    if (data->deferred_count >= CLOUDSYNC_DEFER_META_MAX_ENTRIES) rc = deferred_meta_flush(data, NULL, 0);
+    return rc;
+}
+
+int local_update_row (cloudsync_context *data, cloudsync_table_context *table, const char *pk, size_t pklen, const char *oldpk, size_t oldpklen, sqlite3_value **new_values, sqlite3_value **old_values, int stride) {
+    // oldpk is the OLD primary key if it has been changed by the update (NULL otherwise)
+    // new_values[i*stride] is the NEW value of the i-th column, without old_values a NULL pointer means unchanged
+    // (new_values is NULL if no column has been changed)
+    sqlite3 *db = sqlite3_db_handle(table->meta_pkexists_stmt);
+    
+    // compute the next database version for tracking changes
+    sqlite3_int64 db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
+    int rc = SQLITE_OK;
+    
+    if (oldpk) {
+        // if the primary key has changed, we need to handle the row differently:
+        // 1. mark the old row (OLD primary key) as deleted
+        // 2. create a new row (NEW primary key)
+        
+        // mark the rows with the old primary key as deleted in the metadata (old row handling)
+        rc = local_mark_delete_meta(db, table, oldpk, oldpklen, db_version, BUMP_SEQ(data));
+        if (rc != SQLITE_OK) return rc;
+        
+        // move non-sentinel metadata entries from OLD primary key to NEW primary key
+        // handles the case where some metadata is retained across primary key change
+        // see https://github.com/sqliteai/sqlite-sync/blob/main/docs/PriKey.md for more details
+        // (the deferred writes of the old primary key must be in the meta table to be moved)
+        rc = deferred_meta_flush(data, oldpk, (int)oldpklen);
+        if (rc != SQLITE_OK) return rc;
+        rc = local_update_move_meta(db, table, pk, pklen, oldpk, oldpklen, db_version);
+        if (rc != SQLITE_OK) return rc;
+        
+        // mark a new sentinel row with the new primary key in the metadata
+        rc = local_mark_insert_sentinel_meta(db, table, pk, pklen, db_version, BUMP_SEQ(data));
+        if (rc != SQLITE_OK) return rc;
+    }
+    
+    // compare NEW and OLD values (excluding primary keys) to handle column updates
+    int ncols = (new_values) ? table->ncols : 0;
+    for (int i=0; i<ncols; i++) {
+        sqlite3_value *value = new_values[i*stride];
+        bool changed = (old_values) ? (dbutils_value_compare(value, old_values[i*stride]) != 0) : (value != NULL);
+        if (!changed) continue;
+        
+        // if a column value has changed, mark it as updated in the metadata
+        // columns are in cid order
+        if (deferred_meta_enabled(data, db)) rc = deferred_meta_add(data, table, pk, pklen, i, value, (old_values) ? old_values[i*stride] : NULL, db_version, BUMP_SEQ(data));
+        else rc = local_mark_insert_or_update_meta(db, table, pk, pklen, table->col_name[i], value, db_version, BUMP_SEQ(data));
+        if (rc != SQLITE_OK) return rc;
+    }
+    
+    // bound the memory used by the deferred writes
+    if (data->deferred_count >= CLOUDSYNC_DEFER_META_MAX_ENTRIES) rc = deferred_meta_flush(data, NULL, 0);
+    return rc;
+}
+
+int local_update_column (cloudsync_context *data, cloudsync_table_context *table, const char *pk, size_t pklen, int col_index, sqlite3_value *value, sqlite3_value *old_value) {
+    // called by the column specific update triggers, only when the primary key is unchanged
+    // and the value of the col_index column differs from its OLD value (old_value is NULL for the
+    // triggers of previous versions, which pass the NEW value only)
+    sqlite3 *db = sqlite3_db_handle(table->meta_pkexists_stmt);
+    
+    // compute the next database version for tracking changes
+    sqlite3_int64 db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
+    
+    int rc;
+    if (deferred_meta_enabled(data, db)) rc = deferred_meta_add(data, table, pk, pklen, col_index, value, old_value, db_version, BUMP_SEQ(data));
+    else rc = local_mark_insert_or_update_meta(db, table, pk, pklen, table->col_name[col_index], value, db_version, BUMP_SEQ(data));
+    if (rc != SQLITE_OK) return rc;
+    
+    // bound the memory used by the deferred writes
+    if (data->deferred_count >= CLOUDSYNC_DEFER_META_MAX_ENTRIES) rc = deferred_meta_flush(data, NULL, 0);
+    return rc;
+}
+
+int local_delete_row (cloudsync_context *data, cloudsync_table_context *table, const char *pk, size_t pklen) {
+    sqlite3 *db = sqlite3_db_handle(table->meta_pkexists_stmt);
+    
+    // compute the next database version for tracking changes
+    sqlite3_int64 db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
+    
+    // mark the row as deleted by inserting a delete sentinel into the metadata
+    int seq = BUMP_SEQ(data);
+    int rc = local_mark_delete_meta(db, table, pk, pklen, db_version, seq);
+    if (rc != SQLITE_OK) return rc;
+    
+    // remove any metadata related to the old rows associated with this primary key
+    rc = local_drop_meta(db, table, pk, pklen);
+    if (rc != SQLITE_OK) return rc;
+    deferred_meta_mark_delete(data, table, pk, pklen, db_version, seq);
+    
+    return SQLITE_OK;
+}
+
 // MARK: - Payload Encode / Decode -
 
 bool cloudsync_buffer_free (cloudsync_network_payload *payload) {
     if (payload) {
         if (payload->buffer) cloudsync_memory_free(payload->buffer);
+        if (payload->dict) kh_destroy(PAYLOAD_DICT, payload->dict);
+        for (int i=0; i<payload->dict_count; ++i) cloudsync_memory_free(payload->dict_names[i]);
+        if (payload->dict_names) cloudsync_memory_free(payload->dict_names);
         memset(payload, 0, sizeof(cloudsync_network_payload));
     }
         
@@ -1938,7 +3582,7 @@ bool cloudsync_buffer_check (cloudsync_network_payload *payload, size_t needed)
     return true;
 }
 
-void cloudsync_network_header_init (cloudsync_network_header *header, uint32_t expanded_size, uint16_t ncols, uint32_t nrows, uint64_t hash) {
+void cloudsync_network_header_init (cloudsync_network_header *header, uint8_t version, uint32_t expanded_size, uint16_t ncols, uint32_t nrows, uint64_t hash) {
     memset(header, 0, sizeof(cloudsync_network_header));
     assert(sizeof(cloudsync_network_header)==32);
     
@@ -1946,7 +3590,7 @@ void cloudsync_network_header_init (cloudsync_network_header *header, uint32_t e
     sscanf(CLOUDSYNC_VERSION, "%d.%d.%d", &major, &minor, &patch);
     
     header->signature = htonl(CLOUDSYNC_PAYLOAD_SIGNATURE);
-    header->version = CLOUDSYNC_PAYLOAD_VERSION;
+    header->version = version;
     header->libversion[0] = major;
     header->libversion[1] = minor;
     header->libversion[2] = patch;
@@ -1956,29 +3600,222 @@ void cloudsync_network_header_init (cloudsync_network_header *header, uint32_t e
     header->schema_hash = htonll(hash);
 }
 
-void cloudsync_payload_encode_step (sqlite3_context *context, int argc, sqlite3_value **argv) {
-    DEBUG_FUNCTION("cloudsync_payload_encode_step");
-    // debug_values(argc, argv);
+int cloudsync_payload_dict_id (cloudsync_network_payload *payload, sqlite3_value *value) {
+    // return the dictionary id of the name in value, adding it to the dictionary the first time it is seen
+    const char *name = (const char *)sqlite3_value_text(value);
+    if (!name) return -1;
     
-    // allocate/get the session context
-    cloudsync_network_payload *payload = (cloudsync_network_payload *)sqlite3_aggregate_context(context, sizeof(cloudsync_network_payload));
-    if (!payload) return;
+    if (!payload->dict) {
+        payload->dict = kh_init(PAYLOAD_DICT);
+        if (!payload->dict) return -1;
+    }
+    
+    khiter_t k = kh_get(PAYLOAD_DICT, payload->dict, name);
+    if (k != kh_end(payload->dict)) return kh_value(payload->dict, k);
+    
+    if (payload->dict_count >= payload->dict_alloc) {
+        int dict_alloc = (payload->dict_alloc) ? payload->dict_alloc * 2 : 32;
+        char **dict_names = cloudsync_memory_realloc(payload->dict_names, (sqlite3_uint64)(sizeof(char *) * dict_alloc));
+        if (!dict_names) return -1;
+        payload->dict_names = dict_names;
+        payload->dict_alloc = dict_alloc;
+    }
     
-    // check if the step function is called for the first time
+    char *copy = cloudsync_string_dup(name, false);
+    if (!copy) return -1;
+    
+    int absent;
+    k = kh_put(PAYLOAD_DICT, payload->dict, copy, &absent);
+    if (absent < 0) {cloudsync_memory_free(copy); return -1;}
+    
+    int id = payload->dict_count++;
+    payload->dict_names[id] = copy;
+    payload->dict_size += pk_encode_text_size(strlen(copy));
+    kh_value(payload->dict, k) = id;
+    return id;
+}
+
+bool cloudsync_payload_encode_add (cloudsync_network_payload *payload, int argc, sqlite3_value **argv) {
+    // check if the row is the first one
     if (payload->nrows == 0) payload->ncols = argc;
     
-    size_t breq = pk_encode_size(argv, argc, 0);
-    if (cloudsync_buffer_check(payload, breq) == false) return;
+    // rows of cloudsync_changes reference tbl and col_name by their dictionary id (from version 2)
+    int tbl_id = -1, col_id = -1;
+    if (payload->version >= CLOUDSYNC_PAYLOAD_VERSION_DICT && argc == CLOUDSYNC_PK_INDEX_SEQ + 1 && sqlite3_value_type(argv[CLOUDSYNC_PK_INDEX_TBL]) == SQLITE_TEXT && sqlite3_value_type(argv[CLOUDSYNC_PK_INDEX_COLNAME]) == SQLITE_TEXT) {
+        tbl_id = cloudsync_payload_dict_id(payload, argv[CLOUDSYNC_PK_INDEX_TBL]);
+        col_id = cloudsync_payload_dict_id(payload, argv[CLOUDSYNC_PK_INDEX_COLNAME]);
+        if (tbl_id < 0 || col_id < 0) return false;
+    }
+    
+    size_t breq = 0;
+    if (tbl_id >= 0) {
+        breq = pk_encode_integer_size(tbl_id) + pk_encode_size(&argv[CLOUDSYNC_PK_INDEX_PK], 1, 0) + pk_encode_integer_size(col_id) + pk_encode_size(&argv[CLOUDSYNC_PK_INDEX_COLVALUE], argc - CLOUDSYNC_PK_INDEX_COLVALUE, 0);
+    } else {
+        breq = pk_encode_size(argv, argc, 0);
+    }
+    if (cloudsync_buffer_check(payload, breq) == false) return false;
     
     char *buffer = payload->buffer + payload->bused;
-    char *ptr = pk_encode(argv, argc, buffer, false, NULL);
-    assert(buffer == ptr);
+    if (tbl_id >= 0) {
+        size_t bseek = pk_encode_integer(buffer, 0, tbl_id);
+        pk_encode(&argv[CLOUDSYNC_PK_INDEX_PK], 1, buffer + bseek, false, NULL);
+        bseek += pk_encode_size(&argv[CLOUDSYNC_PK_INDEX_PK], 1, 0);
+        bseek = pk_encode_integer(buffer, bseek, col_id);
+        pk_encode(&argv[CLOUDSYNC_PK_INDEX_COLVALUE], argc - CLOUDSYNC_PK_INDEX_COLVALUE, buffer + bseek, false, NULL);
+    } else {
+        char *ptr = pk_encode(argv, argc, buffer, false, NULL);
+        assert(buffer == ptr);
+    }
     
     // update buffer
     payload->bused += breq;
     
     // increment row counter
     ++payload->nrows;
+    return true;
+}
+
+size_t cloudsync_payload_block_write (char *dest, const char *src, size_t len, bool uncompressed) {
+    // write a block header (compressed size or 0 if the block is stored uncompressed, then the original size)
+    // followed by the block data and return the number of bytes written
+    char *buffer = dest + CLOUDSYNC_PAYLOAD_BLOCK_HEADER;
+    int zused = (uncompressed) ? 0 : LZ4_compress_default(src, buffer, (int)len, LZ4_compressBound((int)len));
+    
+    // if compression fails or if compressed size is not smaller than the original block, then store it uncompressed
+    if (zused <= 0 || (size_t)zused >= len) {
+        memcpy(buffer, src, len);
+        zused = 0;
+    }
+    
+    uint32_t zsize = htonl((uint32_t)zused);
+    uint32_t size = htonl((uint32_t)len);
+    memcpy(dest, &zsize, sizeof(uint32_t));
+    memcpy(dest + sizeof(uint32_t), &size, sizeof(uint32_t));
+    return CLOUDSYNC_PAYLOAD_BLOCK_HEADER + ((zused) ? (size_t)zused : len);
+}
+
+char *cloudsync_payload_dict_encode (cloudsync_network_payload *payload, size_t extra, size_t *dict_size) {
+    // encode the names dictionary (count followed by the names) in a buffer with extra bytes left at its end
+    *dict_size = pk_encode_integer_size(payload->dict_count) + payload->dict_size;
+    char *dict = cloudsync_memory_alloc((sqlite3_uint64)(*dict_size + extra));
+    if (!dict) return NULL;
+    
+    size_t dseek = pk_encode_integer(dict, 0, payload->dict_count);
+    for (int i=0; i<payload->dict_count; ++i) {
+        dseek = pk_encode_text(dict, dseek, payload->dict_names[i], strlen(payload->dict_names[i]));
+    }
+    return dict;
+}
+
+int cloudsync_payload_encode_buffer (cloudsync_context *data, cloudsync_network_payload *payload, char **blob, int *blob_size) {
+    // version 1 and 2 payloads are a single buffer (the names dictionary of version 2 followed by the rows),
+    // compressed as a whole unless compression does not reduce its size (expanded_size is 0 in that case)
+    size_t header_size = sizeof(cloudsync_network_header);
+    size_t rows_size = payload->bused - header_size;
+    const char *src = payload->buffer + header_size;
+    size_t expanded_size = rows_size;
+    
+    char *joined = NULL;
+    if (payload->version >= CLOUDSYNC_PAYLOAD_VERSION_DICT) {
+        size_t dict_size = 0;
+        joined = cloudsync_payload_dict_encode(payload, rows_size, &dict_size);
+        if (!joined) return SQLITE_NOMEM;
+        memcpy(joined + dict_size, src, rows_size);
+        src = joined;
+        expanded_size += dict_size;
+    }
+    
+    int zbound = LZ4_compressBound((int)expanded_size);
+    char *buffer = cloudsync_memory_alloc((sqlite3_uint64)(header_size + zbound));
+    if (!buffer) {
+        if (joined) cloudsync_memory_free(joined);
+        return SQLITE_NOMEM;
+    }
+    
+    int zused = LZ4_compress_default(src, buffer + header_size, (int)expanded_size, zbound);
+    bool use_uncompressed_buffer = (zused <= 0 || (size_t)zused >= expanded_size);
+    CHECK_FORCE_UNCOMPRESSED_BUFFER();
+    
+    if (use_uncompressed_buffer) {
+        memcpy(buffer + header_size, src, expanded_size);
+        zused = (int)expanded_size;
+    }
+    if (joined) cloudsync_memory_free(joined);
+    
+    // setup payload network header
+    cloudsync_network_header header;
+    cloudsync_network_header_init(&header, payload->version, (use_uncompressed_buffer) ? 0 : (uint32_t)expanded_size, payload->ncols, (uint32_t)payload->nrows, data->schema_hash);
+    
+    // copy header
+    memcpy(buffer, &header, sizeof(cloudsync_network_header));
+    *blob = buffer;
+    *blob_size = (int)header_size + zused;
+    return SQLITE_OK;
+}
+
+int cloudsync_payload_encode_blob (cloudsync_context *data, cloudsync_network_payload *payload, char **blob, int *blob_size) {
+    // compress the rows encoded in payload and return a blob (header + blocks) allocated with cloudsync_memory_alloc
+    // the first block is the names dictionary (count followed by the names), the next ones contain whole rows
+    // so the receiver can decompress and apply the payload one block at a time
+    if (payload->version < CLOUDSYNC_PAYLOAD_VERSION) return cloudsync_payload_encode_buffer(data, payload, blob, blob_size);
+    
+    size_t header_size = sizeof(cloudsync_network_header);
+    size_t rows_size = payload->bused - header_size;
+    const char *rows_buffer = payload->buffer + header_size;
+    
+    size_t dict_size = 0;
+    char *dict = cloudsync_payload_dict_encode(payload, 0, &dict_size);
+    if (!dict) return SQLITE_NOMEM;
+    
+    // every row block but the last one is at least CLOUDSYNC_PAYLOAD_BLOCK_SIZE bytes, so the blob cannot be bigger
+    // than the LZ4 bound of the whole data plus the block headers and the per block LZ4 overhead
+    size_t expanded_size = dict_size + rows_size;
+    size_t nblocks = (rows_size / CLOUDSYNC_PAYLOAD_BLOCK_SIZE) + 2;
+    size_t bsize = header_size + expanded_size + (expanded_size / 255) + nblocks * (CLOUDSYNC_PAYLOAD_BLOCK_HEADER + 16);
+    char *buffer = cloudsync_memory_alloc((sqlite3_uint64)bsize);
+    if (!buffer) {cloudsync_memory_free(dict); return SQLITE_NOMEM;}
+    
+    bool use_uncompressed_buffer = false;
+    CHECK_FORCE_UNCOMPRESSED_BUFFER();
+    
+    size_t bused = header_size;
+    bused += cloudsync_payload_block_write(buffer + bused, dict, dict_size, use_uncompressed_buffer);
+    cloudsync_memory_free(dict);
+    
+    // split the rows at row boundaries
+    size_t start = 0, seek = 0;
+    for (uint64_t i=0; i<payload->nrows; ++i) {
+        pk_decode((char *)rows_buffer, rows_size, payload->ncols, &seek, NULL, NULL);
+        if ((seek - start >= CLOUDSYNC_PAYLOAD_BLOCK_SIZE) || (i == payload->nrows - 1)) {
+            bused += cloudsync_payload_block_write(buffer + bused, rows_buffer + start, seek - start, use_uncompressed_buffer);
+            start = seek;
+        }
+    }
+    
+    // setup payload network header
+    cloudsync_network_header header;
+    cloudsync_network_header_init(&header, payload->version, (uint32_t)expanded_size, payload->ncols, (uint32_t)payload->nrows, data->schema_hash);
+    
+    // copy header
+    memcpy(buffer, &header, sizeof(cloudsync_network_header));
+    *blob = buffer;
+    *blob_size = (int)bused;
+    return SQLITE_OK;
+}
+
+void cloudsync_payload_encode_step (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    DEBUG_FUNCTION("cloudsync_payload_encode_step");
+    // debug_values(argc, argv);
+    
+    // allocate/get the session context
+    cloudsync_network_payload *payload = (cloudsync_network_payload *)sqlite3_aggregate_context(context, sizeof(cloudsync_network_payload));
+    if (!payload) return;
+    
+    if (payload->nrows == 0) {
+        cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
+        payload->version = (uint8_t)data->payload_version;
+    }
+    cloudsync_payload_encode_add(payload, argc, argv);
 }
 
 void cloudsync_payload_encode_final (sqlite3_context *context) {
@@ -1994,42 +3831,173 @@ void cloudsync_payload_encode_final (sqlite3_context *context) {
     }
     
     // encode payload
-    int header_size = (int)sizeof(cloudsync_network_header);
-    int real_buffer_size = (int)(payload->bused - header_size);
-    int zbound = LZ4_compressBound(real_buffer_size);
-    char *buffer = cloudsync_memory_alloc(zbound + header_size);
-    if (!buffer) {
-        cloudsync_buffer_free(payload);
-        sqlite3_result_error_code(context, SQLITE_NOMEM);
+    cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
+    char *blob = NULL;
+    int blob_size = 0;
+    int rc = cloudsync_payload_encode_blob(data, payload, &blob, &blob_size);
+    cloudsync_buffer_free(payload);
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(context, rc);
         return;
     }
     
-    // adjust buffer to compress to skip the reserved header
-    char *src_buffer = payload->buffer + sizeof(cloudsync_network_header);
-    int zused = LZ4_compress_default(src_buffer, buffer+header_size, real_buffer_size, zbound);
-    bool use_uncompressed_buffer = (!zused || zused > real_buffer_size);
-    CHECK_FORCE_UNCOMPRESSED_BUFFER();
+    // copy data to SQLite BLOB
+    sqlite3_result_blob(context, blob, blob_size, SQLITE_TRANSIENT);
+    cloudsync_memory_free(blob);
+}
+
+int cloudsync_payload_page (sqlite3 *db, cloudsync_context *data, sqlite3_int64 max_bytes, sqlite3_int64 max_rows, char **blob, int *blob_size, sqlite3_int64 *db_version, sqlite3_int64 *seq) {
+    // encode the local changes that follow the (db_version, seq) cursor until max_bytes (uncompressed) or max_rows
+    // are reached (at least one row is always encoded) and advance the cursor to the last encoded change
+    // *blob is set to NULL when there are no more changes to send
+    *blob = NULL;
+    *blob_size = 0;
     
-    // setup payload network header
+    const char *sql = "SELECT tbl, pk, col_name, col_value, col_version, db_version, site_id, cl, seq FROM cloudsync_changes "
+                      "WHERE site_id=cloudsync_siteid() AND db_version>=?1 AND (db_version>?1 OR seq>?2) ORDER BY db_version, seq;";
+    sqlite3_stmt *vm = NULL;
+    cloudsync_network_payload payload = {.version = (uint8_t)data->payload_version};
+    sqlite3_int64 last_db_version = *db_version;
+    sqlite3_int64 last_seq = *seq;
+    
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_bind_int64(vm, 1, *db_version);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    rc = sqlite3_bind_int64(vm, 2, *seq);
+    if (rc != SQLITE_OK) goto cleanup;
+    
+    sqlite3_value *values[9];
+    while ((rc = sqlite3_step(vm)) == SQLITE_ROW) {
+        int ncols = sqlite3_column_count(vm);
+        for (int i=0; i<ncols; ++i) values[i] = sqlite3_column_value(vm, i);
+        if (!cloudsync_payload_encode_add(&payload, ncols, values)) {rc = SQLITE_NOMEM; goto cleanup;}
+        
+        last_db_version = sqlite3_column_int64(vm, CLOUDSYNC_PK_INDEX_DBVERSION);
+        last_seq = sqlite3_column_int64(vm, CLOUDSYNC_PK_INDEX_SEQ);
+        
+        // the page is complete, so stop reading changes
+        sqlite3_int64 used = (sqlite3_int64)(payload.bused - sizeof(cloudsync_network_header));
+        if ((max_bytes > 0 && used >= max_bytes) || (max_rows > 0 && (sqlite3_int64)payload.nrows >= max_rows)) break;
+    }
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) goto cleanup;
+    rc = SQLITE_OK;
+    
+    if (payload.nrows > 0) {
+        rc = cloudsync_payload_encode_blob(data, &payload, blob, blob_size);
+        if (rc != SQLITE_OK) goto cleanup;
+        *db_version = last_db_version;
+        *seq = last_seq;
+    }
+    
+cleanup:
+    if (vm) sqlite3_finalize(vm);
+    cloudsync_buffer_free(&payload);
+    return rc;
+}
+
+void cloudsync_payload_next (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    DEBUG_FUNCTION("cloudsync_payload_next");
+    
+    // sanity check arguments
+    if (sqlite3_value_type(argv[0]) != SQLITE_INTEGER || sqlite3_value_int64(argv[0]) <= 0) {
+        dbutils_context_result_error(context, "Error on cloudsync_payload_next: max_bytes must be a positive integer.");
+        return;
+    }
+    if (argc > 1 && (sqlite3_value_type(argv[1]) != SQLITE_INTEGER || sqlite3_value_int64(argv[1]) <= 0)) {
+        dbutils_context_result_error(context, "Error on cloudsync_payload_next: max_rows must be a positive integer.");
+        return;
+    }
+    sqlite3_int64 max_bytes = sqlite3_value_int64(argv[0]);
+    sqlite3_int64 max_rows = (argc > 1) ? sqlite3_value_int64(argv[1]) : 0;
+    
+    // retrieve context
+    sqlite3 *db = sqlite3_context_db_handle(context);
     cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
-    cloudsync_network_header header;
-    cloudsync_network_header_init(&header, (use_uncompressed_buffer) ? 0 : real_buffer_size, payload->ncols, (uint32_t)payload->nrows, data->schema_hash);
     
-    // if compression fails or if compressed size is bigger than original buffer, then use the uncompressed buffer
-    if (use_uncompressed_buffer) {
-        cloudsync_memory_free(buffer);
-        buffer = payload->buffer;
-        zused = real_buffer_size;
+    // resume from the last sent change
+    sqlite3_int64 db_version = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_SEND_DBVERSION);
+    sqlite3_int64 seq = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_SEND_SEQ);
+    if (db_version < 0 || seq < 0) {
+        dbutils_context_result_error(context, "Error on cloudsync_payload_next: unable to retrieve the send cursor.");
+        return;
     }
     
-    // copy header and data to SQLite BLOB
-    memcpy(buffer, &header, sizeof(cloudsync_network_header));
-    int blob_size = zused+sizeof(cloudsync_network_header);
-    sqlite3_result_blob(context, buffer, blob_size, SQLITE_TRANSIENT);
+    char *blob = NULL;
+    int blob_size = 0;
+    int rc = cloudsync_payload_page(db, data, max_bytes, max_rows, &blob, &blob_size, &db_version, &seq);
+    if (rc != SQLITE_OK) {
+        dbutils_context_result_error(context, "Error on cloudsync_payload_next: unable to retrieve changes (%s).", sqlite3_errmsg(db));
+        sqlite3_result_error_code(context, rc);
+        return;
+    }
     
-    // cleanup memory
-    cloudsync_buffer_free(payload);
-    if (!use_uncompressed_buffer) cloudsync_memory_free(buffer);
+    // no more changes to send
+    if (!blob) {
+        sqlite3_result_null(context);
+        return;
+    }
+    
+    // the send cursor is advanced by cloudsync_payload_ack once the page has been delivered
+    data->page_db_version = db_version;
+    data->page_seq = seq;
+    
+    sqlite3_result_blob(context, blob, blob_size, SQLITE_TRANSIENT);
+    cloudsync_memory_free(blob);
+}
+
+void cloudsync_payload_ack (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    DEBUG_FUNCTION("cloudsync_payload_ack");
+    
+    // retrieve context
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
+    
+    // without arguments acknowledge the last page returned by cloudsync_payload_next
+    sqlite3_int64 db_version = data->page_db_version;
+    sqlite3_int64 seq = data->page_seq;
+    if (argc == 2) {
+        if (sqlite3_value_type(argv[0]) != SQLITE_INTEGER || sqlite3_value_int64(argv[0]) < 0 ||
+            sqlite3_value_type(argv[1]) != SQLITE_INTEGER || sqlite3_value_int64(argv[1]) < 0) {
+            dbutils_context_result_error(context, "Error on cloudsync_payload_ack: db_version and seq must be non-negative integers.");
+            return;
+        }
+        db_version = sqlite3_value_int64(argv[0]);
+        seq = sqlite3_value_int64(argv[1]);
+    } else if (db_version == CLOUDSYNC_VALUE_NOTSET) {
+        dbutils_context_result_error(context, "Error on cloudsync_payload_ack: no page to acknowledge.");
+        return;
+    }
+    
+    sqlite3_int64 sent_db_version = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_SEND_DBVERSION);
+    sqlite3_int64 sent_seq = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_SEND_SEQ);
+    if (sent_db_version < 0 || sent_seq < 0) {
+        dbutils_context_result_error(context, "Error on cloudsync_payload_ack: unable to retrieve the send cursor.");
+        return;
+    }
+    
+    // the send cursor only moves forward
+    if (db_version < sent_db_version || (db_version == sent_db_version && seq <= sent_seq)) {
+        sqlite3_result_int(context, 0);
+        return;
+    }
+    
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%lld", db_version);
+    int rc = dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_SEND_DBVERSION, buf);
+    if (rc == SQLITE_OK) {
+        snprintf(buf, sizeof(buf), "%lld", seq);
+        rc = dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_SEND_SEQ, buf);
+    }
+    if (rc != SQLITE_OK) return;
+    
+    if (argc == 0) {
+        data->page_db_version = CLOUDSYNC_VALUE_NOTSET;
+        data->page_seq = CLOUDSYNC_VALUE_NOTSET;
+    }
+    sqlite3_result_int(context, 1);
 }
 
 cloudsync_payload_apply_callback_t cloudsync_get_payload_apply_callback(sqlite3 *db) {
@@ -2044,7 +4012,17 @@ void cloudsync_set_payload_apply_callback(sqlite3 *db, cloudsync_payload_apply_c
 
 int cloudsync_pk_decode_bind_callback (void *xdata, int index, int type, int64_t ival, double dval, char *pval) {
     cloudsync_pk_decode_bind_context *decode_context = (cloudsync_pk_decode_bind_context*)xdata;
-    int rc = pk_decode_bind_callback(decode_context->vm, index, type, ival, dval, pval);
+    
+    // version 2 payloads reference table and column names by their index in the payload dictionary
+    if (type == SQLITE_INTEGER && decode_context->dict && (index == CLOUDSYNC_PK_INDEX_TBL || index == CLOUDSYNC_PK_INDEX_COLNAME)) {
+        if (ival < 0 || ival >= decode_context->dict->count) return SQLITE_CORRUPT;
+        pval = decode_context->dict->names[ival];
+        ival = decode_context->dict->lens[ival];
+        type = SQLITE_TEXT;
+    }
+    
+    // without a vm the row is only decoded (see cloudsync_payload_sort)
+    int rc = (decode_context->vm) ? pk_decode_bind_callback(decode_context->vm, index, type, ival, dval, pval) : SQLITE_OK;
     
     if (rc == SQLITE_OK) {
         // the dbversion index is smaller than seq index, so it is processed first
@@ -2090,12 +4068,180 @@ int cloudsync_pk_decode_bind_callback (void *xdata, int index, int type, int64_t
         }
     }
         
-    return rc;
+    return rc;
+}
+
+int cloudsync_payload_dict_callback (void *xdata, int index, int type, int64_t ival, double dval, char *pval) {
+    cloudsync_payload_dict *dict = (cloudsync_payload_dict *)xdata;
+    if (type != SQLITE_TEXT || index >= dict->count) return SQLITE_CORRUPT;
+    
+    dict->names[index] = pval;
+    dict->lens[index] = ival;
+    return SQLITE_OK;
+}
+
+int cloudsync_payload_dict_count_callback (void *xdata, int index, int type, int64_t ival, double dval, char *pval) {
+    if (type != SQLITE_INTEGER || ival < 0) return SQLITE_CORRUPT;
+    *(int64_t *)xdata = ival;
+    return SQLITE_OK;
+}
+
+int cloudsync_payload_dict_decode (cloudsync_payload_dict *dict, const char *buffer, size_t blen, size_t *seek) {
+    // decode the names dictionary placed in front of the rows of a version 2 payload
+    int64_t count = 0;
+    if (pk_decode((char *)buffer, blen, 1, seek, cloudsync_payload_dict_count_callback, &count) != 1) return SQLITE_CORRUPT;
+    
+    // each name takes at least one byte
+    if (*seek > blen || count > (int64_t)(blen - *seek) || count > INT_MAX) return SQLITE_CORRUPT;
+    if (count == 0) return SQLITE_OK;
+    
+    dict->names = (char **)cloudsync_memory_alloc((sqlite3_uint64)(sizeof(char *) * count));
+    dict->lens = (int64_t *)cloudsync_memory_alloc((sqlite3_uint64)(sizeof(int64_t) * count));
+    if (!dict->names || !dict->lens) return SQLITE_NOMEM;
+    dict->count = count;
+    
+    if (pk_decode((char *)buffer, blen, (int)count, seek, cloudsync_payload_dict_callback, dict) != (int)count) return SQLITE_CORRUPT;
+    return SQLITE_OK;
+}
+
+void cloudsync_payload_dict_free (cloudsync_payload_dict *dict) {
+    if (dict->names) cloudsync_memory_free(dict->names);
+    if (dict->lens) cloudsync_memory_free(dict->lens);
+    memset(dict, 0, sizeof(cloudsync_payload_dict));
+}
+
+typedef struct {
+    const char      *tbl;
+    int64_t         tbl_len;
+    const void      *pk;
+    int64_t         pk_len;
+    size_t          offset;         // offset of the encoded row in the decoded buffer
+    uint32_t        index;          // position of the row in the payload
+} cloudsync_payload_row;
+
+int cloudsync_payload_row_compare (const void *a, const void *b) {
+    const cloudsync_payload_row *r1 = (const cloudsync_payload_row *)a;
+    const cloudsync_payload_row *r2 = (const cloudsync_payload_row *)b;
+    
+    int64_t len = (r1->tbl_len < r2->tbl_len) ? r1->tbl_len : r2->tbl_len;
+    int cmp = memcmp(r1->tbl, r2->tbl, (size_t)len);
+    if (cmp == 0 && r1->tbl_len != r2->tbl_len) cmp = (r1->tbl_len < r2->tbl_len) ? -1 : 1;
+    if (cmp != 0) return cmp;
+    
+    len = (r1->pk_len < r2->pk_len) ? r1->pk_len : r2->pk_len;
+    cmp = memcmp(r1->pk, r2->pk, (size_t)len);
+    if (cmp == 0 && r1->pk_len != r2->pk_len) cmp = (r1->pk_len < r2->pk_len) ? -1 : 1;
+    if (cmp != 0) return cmp;
+    
+    // changes of the same row keep the payload order (so the causal order of its columns is preserved)
+    return (r1->index < r2->index) ? -1 : (r1->index > r2->index);
+}
+
+cloudsync_payload_row *cloudsync_payload_sort (const char *buffer, int blen, uint16_t ncols, uint32_t nrows, cloudsync_payload_dict *dict, sqlite3_int64 *max_db_version, sqlite3_int64 *max_seq) {
+    // index the rows of the payload by (tbl, pk) so that changes are applied grouped by table and row:
+    // base and meta tables are then visited in primary key order instead of db_version order
+    // (also returns the greatest (db_version, seq) of the payload, which is no longer the one of the last applied row)
+    cloudsync_payload_row *rows = (cloudsync_payload_row *)cloudsync_memory_alloc((sqlite3_uint64)(sizeof(cloudsync_payload_row) * nrows));
+    if (!rows) return NULL;
+    
+    cloudsync_pk_decode_bind_context decoded_context = {.vm = NULL, .dict = dict};
+    size_t offset = 0;
+    for (uint32_t i=0; i<nrows; ++i) {
+        size_t seek = offset;
+        if (pk_decode((char *)buffer, (size_t)blen, ncols, &seek, cloudsync_pk_decode_bind_callback, &decoded_context) != ncols) {
+            cloudsync_memory_free(rows);
+            return NULL;
+        }
+        
+        rows[i].tbl = decoded_context.tbl;
+        rows[i].tbl_len = decoded_context.tbl_len;
+        rows[i].pk = decoded_context.pk;
+        rows[i].pk_len = decoded_context.pk_len;
+        rows[i].offset = offset;
+        rows[i].index = i;
+        
+        if (i == 0 || decoded_context.db_version > *max_db_version || (decoded_context.db_version == *max_db_version && decoded_context.seq > *max_seq)) {
+            *max_db_version = decoded_context.db_version;
+            *max_seq = decoded_context.seq;
+        }
+        offset = seek;
+    }
+    
+    qsort(rows, nrows, sizeof(cloudsync_payload_row), cloudsync_payload_row_compare);
+    return rows;
+}
+
+int cloudsync_payload_block_read (const char **buffer, size_t *blen, char **block, size_t *balloc, const char **data, size_t *dlen) {
+    // read the next block of a version 3 payload and advance buffer past it: a stored block is returned in place,
+    // a compressed one is expanded into block (reallocated when too small)
+    if (*blen < CLOUDSYNC_PAYLOAD_BLOCK_HEADER) return SQLITE_CORRUPT;
+    
+    uint32_t zsize, size;
+    memcpy(&zsize, *buffer, sizeof(uint32_t));
+    memcpy(&size, *buffer + sizeof(uint32_t), sizeof(uint32_t));
+    zsize = ntohl(zsize);
+    size = ntohl(size);
+    
+    size_t stored = (zsize) ? zsize : size;
+    if (stored > *blen - CLOUDSYNC_PAYLOAD_BLOCK_HEADER || size > INT_MAX || (zsize && size == 0)) return SQLITE_CORRUPT;
+    const char *src = *buffer + CLOUDSYNC_PAYLOAD_BLOCK_HEADER;
+    
+    if (zsize == 0) {
+        *data = src;
+    } else {
+        if (size > *balloc) {
+            char *clone = (char *)cloudsync_memory_realloc(*block, (sqlite3_uint64)size);
+            if (!clone) return SQLITE_NOMEM;
+            *block = clone;
+            *balloc = size;
+        }
+        
+        int rc = LZ4_decompress_safe(src, *block, (int)zsize, (int)size);
+        if (rc <= 0 || (uint32_t)rc != size) return SQLITE_CORRUPT;
+        *data = *block;
+    }
+    
+    *dlen = size;
+    *buffer += CLOUDSYNC_PAYLOAD_BLOCK_HEADER + stored;
+    *blen -= CLOUDSYNC_PAYLOAD_BLOCK_HEADER + stored;
+    return SQLITE_OK;
+}
+
+int cloudsync_payload_block_seek (const char **buffer, size_t *blen, size_t offset, size_t *base) {
+    // skip (without decompressing them) the blocks of a version 3 payload that end before offset in the expanded rows,
+    // base is set to the expanded offset of the first block left in buffer
+    *base = 0;
+    while (*blen >= CLOUDSYNC_PAYLOAD_BLOCK_HEADER) {
+        uint32_t zsize, size;
+        memcpy(&zsize, *buffer, sizeof(uint32_t));
+        memcpy(&size, *buffer + sizeof(uint32_t), sizeof(uint32_t));
+        zsize = ntohl(zsize);
+        size = ntohl(size);
+        if (*base + size > offset) break;
+        
+        size_t stored = (zsize) ? zsize : size;
+        if (stored > *blen - CLOUDSYNC_PAYLOAD_BLOCK_HEADER) return SQLITE_CORRUPT;
+        *buffer += CLOUDSYNC_PAYLOAD_BLOCK_HEADER + stored;
+        *blen -= CLOUDSYNC_PAYLOAD_BLOCK_HEADER + stored;
+        *base += size;
+    }
+    return SQLITE_OK;
+}
+
+void cloudsync_payload_identity (const char *payload, int blen, char *buffer, size_t size) {
+    // identify a payload by its size and by the hash of all its bytes (computed once per checkpointed call),
+    // two payloads that differ only in the middle rows must not share a checkpoint
+    uint64_t h = cloudsync_hash_bytes(payload, (size_t)blen);
+    snprintf(buffer, size, "%d-%016llx", blen, (unsigned long long)h);
 }
 
 // #ifndef CLOUDSYNC_OMIT_RLS_VALIDATION
 
-int cloudsync_payload_apply (sqlite3_context *context, const char *payload, int blen) {
+int cloudsync_payload_apply (sqlite3_context *context, const char *payload, int blen, int max_rows) {
+    // apply the whole payload or, if max_rows is greater than 0, at most max_rows rows of it starting from the
+    // checkpoint saved in the settings by the previous call with the same payload (each call can then be
+    // committed separately and an interrupted apply resumes where the last committed call stopped)
+    // return the number of applied rows
     // decode header
     cloudsync_network_header header;
     memcpy(&header, payload, sizeof(cloudsync_network_header));
@@ -2123,34 +4269,84 @@ int cloudsync_payload_apply (sqlite3_context *context, const char *payload, int
         return -1;
     }
     
+    if (header.version > CLOUDSYNC_PAYLOAD_VERSION) {
+        dbutils_context_result_error(context, "Error on cloudsync_payload_apply: unsupported payload version %d.", header.version);
+        sqlite3_result_error_code(context, SQLITE_MISUSE);
+        return -1;
+    }
+    
     const char *buffer = payload + sizeof(cloudsync_network_header);
-    blen -= sizeof(cloudsync_network_header);
-    
-    // check if payload is compressed
-    char *clone = NULL;
-    if (header.expanded_size != 0) {
-        clone = (char *)cloudsync_memory_alloc(header.expanded_size);
-        if (!clone) {sqlite3_result_error_code(context, SQLITE_NOMEM); return -1;}
-        
-        uint32_t rc = LZ4_decompress_safe(buffer, clone, blen, header.expanded_size);
-        if (rc <= 0 || rc != header.expanded_size) {
-            dbutils_context_result_error(context, "Error on cloudsync_payload_apply: unable to decompress BLOB (%d).", rc);
-            sqlite3_result_error_code(context, SQLITE_MISUSE);
-            return -1;
+    size_t remaining = (size_t)blen - sizeof(cloudsync_network_header);
+    
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    sqlite3_stmt *vm = NULL;
+    cloudsync_payload_dict dict = {0};
+    cloudsync_payload_row *rows = NULL;
+    char *clone = NULL;             // all the rows decompressed at once
+    char *dict_block = NULL;        // decompressed names dictionary of a version 3 payload
+    char *block = NULL;             // decompressed row block of a version 3 payload (reused between blocks)
+    size_t dict_alloc = 0, block_alloc = 0;
+    char *lasterr = NULL;
+    char identity[128] = {0};
+    int result = -1;
+    int rc = SQLITE_OK;
+    
+    // a version 3 payload is a sequence of blocks decompressed and applied one at a time,
+    // older versions are a single (optionally compressed) buffer
+    bool streaming = (header.version >= CLOUDSYNC_PAYLOAD_VERSION);
+    const char *rows_buffer = buffer;
+    size_t rows_len = remaining;
+    
+    if (!streaming) {
+        // check if payload is compressed
+        if (header.expanded_size != 0) {
+            clone = (char *)cloudsync_memory_alloc(header.expanded_size);
+            if (!clone) {sqlite3_result_error_code(context, SQLITE_NOMEM); goto cleanup;}
+            
+            int n = LZ4_decompress_safe(buffer, clone, (int)remaining, (int)header.expanded_size);
+            if (n <= 0 || (uint32_t)n != header.expanded_size) {
+                dbutils_context_result_error(context, "Error on cloudsync_payload_apply: unable to decompress BLOB (%d).", n);
+                sqlite3_result_error_code(context, SQLITE_MISUSE);
+                goto cleanup;
+            }
+            
+            rows_buffer = (const char *)clone;
+            rows_len = header.expanded_size;
         }
         
-        buffer = (const char *)clone;
+        // the rows of a version 2 payload reference the table and column names of its dictionary
+        if (header.version >= CLOUDSYNC_PAYLOAD_VERSION_DICT) {
+            size_t seek = 0;
+            rc = cloudsync_payload_dict_decode(&dict, rows_buffer, rows_len, &seek);
+            if (rc != SQLITE_OK) {
+                dbutils_context_result_error(context, "Error on cloudsync_payload_apply: invalid names dictionary.");
+                sqlite3_result_error_code(context, rc);
+                goto cleanup;
+            }
+            rows_buffer += seek;
+            rows_len -= seek;
+        }
+    } else {
+        // the first block is the names dictionary, kept in memory while the row blocks are applied
+        const char *dict_data = NULL;
+        size_t dict_len = 0, seek = 0;
+        rc = cloudsync_payload_block_read(&buffer, &remaining, &dict_block, &dict_alloc, &dict_data, &dict_len);
+        if (rc == SQLITE_OK) rc = cloudsync_payload_dict_decode(&dict, dict_data, dict_len, &seek);
+        if (rc != SQLITE_OK) {
+            dbutils_context_result_error(context, "Error on cloudsync_payload_apply: invalid names dictionary.");
+            sqlite3_result_error_code(context, rc);
+            goto cleanup;
+        }
+        rows_buffer = NULL;
+        rows_len = 0;
     }
     
-    // precompile the insert statement
-    sqlite3_stmt *vm = NULL;
-    sqlite3 *db = sqlite3_context_db_handle(context);
+    // precompile the insert statement (sqlite3_step must report the specific error code of a rejected change)
     const char *sql = "INSERT INTO cloudsync_changes(tbl, pk, col_name, col_value, col_version, db_version, site_id, cl, seq) VALUES (?,?,?,?,?,?,?,?,?);";
-    int rc = sqlite3_prepare(db, sql, -1, &vm, NULL);
+    rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
     if (rc != SQLITE_OK) {
         dbutils_context_result_error(context, "Error on cloudsync_payload_apply: error while compiling SQL statement (%s).", sqlite3_errmsg(db));
-        if (clone) cloudsync_memory_free(clone);
-        return -1;
+        goto cleanup;
     }
     
     // process buffer, one row at a time
@@ -2158,42 +4354,184 @@ int cloudsync_payload_apply (sqlite3_context *context, const char *payload, int
     uint32_t nrows = header.nrows;
     int dbversion = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_CHECK_DBVERSION);
     int seq = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_CHECK_SEQ);
-    cloudsync_pk_decode_bind_context decoded_context = {.vm = vm};
+    cloudsync_pk_decode_bind_context decoded_context = {.vm = vm, .dict = (dict.count > 0) ? &dict : NULL};
     void *payload_apply_xdata = NULL;
     cloudsync_payload_apply_callback_t payload_apply_callback = cloudsync_get_payload_apply_callback(db);
     
-    for (uint32_t i=0; i<nrows; ++i) {
-        size_t seek = 0;
-        pk_decode((char *)buffer, blen, ncols, &seek, cloudsync_pk_decode_bind_callback, &decoded_context);
+    // optionally apply the rows grouped by (tbl, pk) instead of in the sender order
+    sqlite3_int64 max_db_version = 0, max_seq = 0;
+    if (data && data->apply_sorted && nrows > 1) {
+        // rows can be sorted only if they are all in memory, so the blocks are joined first
+        if (streaming) {
+            clone = (char *)cloudsync_memory_alloc(header.expanded_size);
+            if (!clone) {sqlite3_result_error_code(context, SQLITE_NOMEM); goto cleanup;}
+            
+            while (remaining > 0) {
+                const char *block_data = NULL;
+                size_t block_len = 0;
+                rc = cloudsync_payload_block_read(&buffer, &remaining, &block, &block_alloc, &block_data, &block_len);
+                if (rc != SQLITE_OK || block_len > header.expanded_size - rows_len) {
+                    dbutils_context_result_error(context, "Error on cloudsync_payload_apply: unable to decompress BLOB block.");
+                    sqlite3_result_error_code(context, SQLITE_MISUSE);
+                    goto cleanup;
+                }
+                memcpy(clone + rows_len, block_data, block_len);
+                rows_len += block_len;
+            }
+            
+            rows_buffer = (const char *)clone;
+            streaming = false;
+        }
+        
+        rows = cloudsync_payload_sort(rows_buffer, (int)rows_len, ncols, nrows, decoded_context.dict, &max_db_version, &max_seq);
+        if (!rows) {
+            dbutils_context_result_error(context, "Error on cloudsync_payload_apply: unable to sort the payload rows.");
+            sqlite3_result_error_code(context, SQLITE_NOMEM);
+            goto cleanup;
+        }
+    }
+    
+    // rows are applied from first to last (excluded), offset is the position of row first in the expanded rows
+    // (a sorted payload resumes from its row index because its rows are not applied in the payload order)
+    uint32_t first = 0, last = nrows;
+    size_t offset = 0, rows_base = 0;
+    if (max_rows > 0) {
+        char buf[256];
+        cloudsync_payload_identity(payload, blen, identity, sizeof(identity));
+        if (dbutils_settings_get_value(db, CLOUDSYNC_KEY_APPLY_PAYLOAD, buf, sizeof(buf)) && strcmp(buf, identity) == 0) {
+            if (dbutils_settings_get_value(db, CLOUDSYNC_KEY_APPLY_ROW, buf, sizeof(buf))) first = (uint32_t)strtoll(buf, NULL, 0);
+            if (dbutils_settings_get_value(db, CLOUDSYNC_KEY_APPLY_OFFSET, buf, sizeof(buf))) offset = (size_t)strtoll(buf, NULL, 0);
+            if (first > nrows) first = nrows;
+        }
+        if (first == 0) offset = 0;
+        if (max_rows < (int64_t)nrows - first) last = first + (uint32_t)max_rows;
+        
+        // the blocks before the checkpoint are not decompressed again
+        if (streaming && offset > 0) {
+            rc = cloudsync_payload_block_seek(&buffer, &remaining, offset, &rows_base);
+            if (rc != SQLITE_OK) {
+                dbutils_context_result_error(context, "Error on cloudsync_payload_apply: invalid checkpoint offset.");
+                sqlite3_result_error_code(context, rc);
+                goto cleanup;
+            }
+            offset -= rows_base;
+        }
+    }
+    
+    // changes of the same row are adjacent in the payload, so let the merge reuse the row clocks between them
+    // and write the winning columns of each row with a single UPSERT
+    // (everything is applied within the statement executing cloudsync_payload_decode, so no one else can modify them)
+    // the columns are written one at a time if a callback must see each change written (with its result) by DID_APPLY
+    if (data) {
+        merge_group_reset(data);
+        data->merge_group.batch = true;
+        data->merge_group.coalesce = (payload_apply_callback == NULL);
+    }
+    
+    rc = SQLITE_DONE;
+    int64_t pending_cl = -1;
+    for (uint32_t i=first; i<last; ++i) {
+        // the next block is decompressed only when all the rows of the current one have been applied
+        if (streaming && (!rows_buffer || offset >= rows_len)) {
+            if (rows_buffer) {
+                rows_base += rows_len;
+                offset = 0;
+            }
+            rc = cloudsync_payload_block_read(&buffer, &remaining, &block, &block_alloc, &rows_buffer, &rows_len);
+            if (rc != SQLITE_OK) {
+                lasterr = cloudsync_string_dup("Error on cloudsync_payload_apply: unable to decompress BLOB block.", false);
+                break;
+            }
+        }
+        
+        size_t seek = (rows) ? rows[i].offset : offset;
+        pk_decode((char *)rows_buffer, rows_len, ncols, &seek, cloudsync_pk_decode_bind_callback, &decoded_context);
         // n is the pk_decode return value, I don't think I should assert here because in any case the next sqlite3_step would fail
         // assert(n == ncols);
         
+        // the pending columns are written before any change that can write on its own (another row, a sentinel or
+        // a causal length change): the callback must see them written and a rejected change rolls back all the writes
+        // of its statement (a flush of the pending columns included)
+        if (data) {
+            bool is_sentinel = (!decoded_context.col_name || ((decoded_context.col_name_len == (int64_t)strlen(CLOUDSYNC_TOMBSTONE_VALUE)) && (strncmp(decoded_context.col_name, CLOUDSYNC_TOMBSTONE_VALUE, (size_t)decoded_context.col_name_len) == 0)));
+            int flush_rc = (is_sentinel || decoded_context.cl != pending_cl) ? merge_group_flush(data) : merge_group_flush_if_changed(data, decoded_context.tbl, decoded_context.tbl_len, decoded_context.pk, decoded_context.pk_len);
+            pending_cl = decoded_context.cl;
+            
+            // the rejected columns are already counted in the apply errors
+            if (apply_error_is_fatal(flush_rc)) {
+                rc = flush_rc;
+                lasterr = cloudsync_string_dup(sqlite3_errmsg(db), false);
+                break;
+            }
+        }
+        
         bool approved = true;
         if (payload_apply_callback) approved = payload_apply_callback(&payload_apply_xdata, &decoded_context, db, data, CLOUDSYNC_PAYLOAD_APPLY_WILL_APPLY, SQLITE_OK);
 
+        int step_rc = SQLITE_DONE;
         if (approved) {
-            rc = sqlite3_step(vm);
-            if (rc != SQLITE_DONE) {
+            step_rc = sqlite3_step(vm);
+            if (step_rc != SQLITE_DONE && data && !apply_error_is_fatal(step_rc)) {
                 // don't "break;", the error can be due to a RLS policy.
                 // in case of error we try to apply the following changes
-                printf("cloudsync_payload_apply error on db_version %lld/%lld: (%d) %s\n", decoded_context.db_version, decoded_context.seq, rc, sqlite3_errmsg(db));
+                apply_errors_add(data, decoded_context.tbl, decoded_context.tbl_len, step_rc, decoded_context.db_version, decoded_context.seq, sqlite3_errmsg(db));
+                rc = SQLITE_DONE;
+            } else {
+                rc = step_rc;
             }
         }
         
-        if (payload_apply_callback) payload_apply_callback(&payload_apply_xdata, &decoded_context, db, data, CLOUDSYNC_PAYLOAD_APPLY_DID_APPLY, rc);
+        if (payload_apply_callback) payload_apply_callback(&payload_apply_xdata, &decoded_context, db, data, CLOUDSYNC_PAYLOAD_APPLY_DID_APPLY, step_rc);
         
-        buffer += seek;
-        blen -= seek;
+        offset = seek;
         stmt_reset(vm);
+        
+        // the following changes would fail too, so the chunk is not checkpointed
+        if (rc != SQLITE_DONE) {
+            lasterr = cloudsync_string_dup(sqlite3_errmsg(db), false);
+            break;
+        }
+    }
+    
+    if (data) {
+        // the pending columns of the last row are part of this call
+        int flush_rc = merge_group_flush(data);
+        if (apply_error_is_fatal(flush_rc) && (rc == SQLITE_OK || rc == SQLITE_DONE)) rc = flush_rc;
+        
+        merge_group_reset(data);
+        data->merge_group.batch = false;
+        data->merge_group.coalesce = false;
+        merge_cl_cache_clear(&data->merge_group);
     }
 
-    char *lasterr = NULL;
-    if (rc != SQLITE_OK && rc != SQLITE_DONE) lasterr = cloudsync_string_dup(sqlite3_errmsg(db), false);
+    if (rc != SQLITE_OK && rc != SQLITE_DONE && !lasterr) lasterr = cloudsync_string_dup(sqlite3_errmsg(db), false);
     
+    // decoded_context still points inside the last block
     if (payload_apply_callback) payload_apply_callback(&payload_apply_xdata, &decoded_context, db, data, CLOUDSYNC_PAYLOAD_APPLY_CLEANUP, rc);
+    
+    // in sorted mode the last applied row is not the most recent change of the payload
+    if (rows) {
+        decoded_context.db_version = max_db_version;
+        decoded_context.seq = max_seq;
+    }
 
     if (rc == SQLITE_DONE) rc = SQLITE_OK;
-    if (rc == SQLITE_OK) {
+    
+    // rejected changes are reported once per apply
+    if (data) apply_errors_save(db, data);
+    
+    // the checkpoint is written in the same transaction of the applied rows
+    if (rc == SQLITE_OK && max_rows > 0 && first < last) {
+        char buf[256];
+        dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_APPLY_PAYLOAD, identity);
+        snprintf(buf, sizeof(buf), "%u", last);
+        dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_APPLY_ROW, buf);
+        snprintf(buf, sizeof(buf), "%zu", rows_base + offset);
+        dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_APPLY_OFFSET, buf);
+    }
+    
+    // the receive checkpoint is advanced only when all the rows of the payload have been applied
+    if (rc == SQLITE_OK && last == nrows && first < last) {
         char buf[256];
         if (decoded_context.db_version >= dbversion) {
             snprintf(buf, sizeof(buf), "%lld", decoded_context.db_version);
@@ -2205,23 +4543,28 @@ int cloudsync_payload_apply (sqlite3_context *context, const char *payload, int
             }
         }
     }
-
-    // cleanup vm
-    if (vm) sqlite3_finalize(vm);
-    
-    // cleanup memory
-    if (clone) cloudsync_memory_free(clone);
     
     if (rc != SQLITE_OK) {
         sqlite3_result_error(context, lasterr, -1);
         sqlite3_result_error_code(context, SQLITE_MISUSE);
-        cloudsync_memory_free(lasterr);
-        return -1;
+    } else {
+        // return the number of processed rows
+        result = (int)(last - first);
+        sqlite3_result_int(context, result);
     }
     
-    // return the number of processed rows
-    sqlite3_result_int(context, nrows);
-    return nrows;
+cleanup:
+    // cleanup vm
+    if (vm) sqlite3_finalize(vm);
+    
+    // cleanup memory
+    cloudsync_payload_dict_free(&dict);
+    if (rows) cloudsync_memory_free(rows);
+    if (clone) cloudsync_memory_free(clone);
+    if (dict_block) cloudsync_memory_free(dict_block);
+    if (block) cloudsync_memory_free(block);
+    if (lasterr) cloudsync_memory_free(lasterr);
+    return result;
 }
 
 void cloudsync_payload_decode (sqlite3_context *context, int argc, sqlite3_value **argv) {
@@ -2246,8 +4589,9 @@ void cloudsync_payload_decode (sqlite3_context *context, int argc, sqlite3_value
     // obtain payload
     const char *payload = (const char *)sqlite3_value_blob(argv[0]);
     
-    // apply changes
-    cloudsync_payload_apply(context, payload, blen);
+    // apply changes (in checkpoint mode, with the optional max_rows argument, only the next max_rows rows)
+    int max_rows = (argc > 1) ? sqlite3_value_int(argv[1]) : 0;
+    cloudsync_payload_apply(context, payload, blen, (max_rows > 0) ? max_rows : 0);
 }
 
 // MARK: - Public -
@@ -2311,6 +4655,21 @@ void cloudsync_seq (sqlite3_context *context, int argc, sqlite3_value **argv) {
     sqlite3_result_int(context, BUMP_SEQ(data));
 }
 
+void cloudsync_flush (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    DEBUG_FUNCTION("cloudsync_flush");
+    
+    // write the deferred meta changes (defer_meta setting), it must be called before the commit
+    cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
+    int count = data->deferred_live;
+    int rc = cloudsync_deferred_flush(data);
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error(context, sqlite3_errmsg(sqlite3_context_db_handle(context)), -1);
+        sqlite3_result_error_code(context, rc);
+        return;
+    }
+    sqlite3_result_int(context, count);
+}
+
 void cloudsync_uuid (sqlite3_context *context, int argc, sqlite3_value **argv) {
     DEBUG_FUNCTION("cloudsync_uuid");
     
@@ -2332,6 +4691,24 @@ void cloudsync_set (sqlite3_context *context, int argc, sqlite3_value **argv) {
     if (key == NULL) return;
     
     sqlite3 *db = sqlite3_context_db_handle(context);
+    cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
+    
+    // defer_meta applies to the calling connection only, so it is not stored in cloudsync_settings
+    // (the commit of a connection that buffers its meta changes must be preceded by cloudsync_flush)
+    if (strcmp(key, CLOUDSYNC_KEY_DEFER_META) == 0) {
+        bool defer_meta = (value && (value[0] != 0) && (value[0] != '0'));
+        if (!defer_meta) {
+            int rc = cloudsync_deferred_flush(data);
+            if (rc != SQLITE_OK) {
+                sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+                sqlite3_result_error_code(context, rc);
+                return;
+            }
+        }
+        data->defer_meta = defer_meta;
+        return;
+    }
+    
     dbutils_settings_set_key_value(db, context, key, value);
 }
 
@@ -2505,44 +4882,22 @@ void cloudsync_insert (sqlite3_context *context, int argc, sqlite3_value **argv)
         return;
     }
     
-    // encode the primary key values into a buffer
-    char buffer[1024];
-    size_t pklen = sizeof(buffer);
-    char *pk = pk_encode_prikey(&argv[1], table->npks, buffer, &pklen);
+    // encode the primary key values into a buffer of the call arena
+    cloudsync_arena_mark mark = cloudsync_arena_get_mark(&data->arena);
+    size_t pklen = 0;
+    char *pk = pk_encode_prikey_arena(&data->arena, &argv[1], table->npks, &pklen);
     if (!pk) {
         sqlite3_result_error(context, "Not enough memory to encode the primary key(s).", -1);
         return;
     }
     
-    // compute the next database version for tracking changes
-    sqlite3_int64 db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
-    
-    // check if a row with the same primary key already exists
-    // if so, this means the row might have been previously deleted (sentinel)
-    bool pk_exists = (bool)stmt_count(table->meta_pkexists_stmt, pk, pklen, SQLITE_BLOB);
-    int rc = SQLITE_OK;
-    
-    if (table->ncols == 0) {
-        // if there are no columns other than primary keys, insert a sentinel record
-        rc = local_mark_insert_sentinel_meta(db, table, pk, pklen, db_version, BUMP_SEQ(data));
-        if (rc != SQLITE_OK) goto cleanup;
-    } else if (pk_exists){
-        // if a row with the same primary key already exists, update the sentinel record
-        rc = local_update_sentinel(db, table, pk, pklen, db_version, BUMP_SEQ(data));
-        if (rc != SQLITE_OK) goto cleanup;
-    }
-    
-    // process each non-primary key column for insert or update
-    for (int i=0; i<table->ncols; ++i) {
-        // mark the column as inserted or updated in the metadata
-        rc = local_mark_insert_or_update_meta(db, table, pk, pklen, table->col_name[i], db_version, BUMP_SEQ(data));
-        if (rc != SQLITE_OK) goto cleanup;
+    int rc = local_insert_row(data, table, pk, pklen);
+    if (rc != SQLITE_OK) {
+        db_version_store_reset(data);
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
     }
     
-cleanup:
-    if (rc != SQLITE_OK) sqlite3_result_error(context, sqlite3_errmsg(db), -1);
-    // free memory if the primary key was dynamically allocated
-    if (pk != buffer) cloudsync_memory_free(pk);
+    cloudsync_arena_release(&data->arena, mark);
 }
 
 void cloudsync_update (sqlite3_context *context, int argc, sqlite3_value **argv) {
@@ -2567,10 +4922,6 @@ void cloudsync_update (sqlite3_context *context, int argc, sqlite3_value **argv)
         return;
     }
     
-    // compute the next database version for tracking changes
-    sqlite3_int64 db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
-    int rc = SQLITE_OK;
-    
     // check if the primary key(s) have changed by comparing the NEW and OLD primary key values
     bool prikey_changed = false;
     for (int i=1; i<=table->npks; ++i) {
@@ -2580,68 +4931,86 @@ void cloudsync_update (sqlite3_context *context, int argc, sqlite3_value **argv)
         }
     }
     
-    // encode the NEW primary key values into a buffer (used later for indexing)
-    char buffer[1024];
-    char buffer2[1024];
-    size_t pklen = sizeof(buffer);
-    size_t oldpklen = sizeof(buffer2);
+    // encode the NEW primary key values into a buffer of the call arena (used later for indexing)
+    cloudsync_arena_mark mark = cloudsync_arena_get_mark(&data->arena);
+    size_t pklen = 0;
+    size_t oldpklen = 0;
     char *oldpk = NULL;
     
-    char *pk = pk_encode_prikey(&argv[1], table->npks, buffer, &pklen);
+    char *pk = pk_encode_prikey_arena(&data->arena, &argv[1], table->npks, &pklen);
     if (!pk) {
         sqlite3_result_error(context, "Not enough memory to encode the primary key(s).", -1);
         return;
     }
     
     if (prikey_changed) {
-        // if the primary key has changed, we need to handle the row differently:
-        // 1. mark the old row (OLD primary key) as deleted
-        // 2. create a new row (NEW primary key)
-        
         // encode the OLD primary key into a buffer
-        oldpk = pk_encode_prikey(&argv[1+table->npks], table->npks, buffer2, &oldpklen);
+        oldpk = pk_encode_prikey_arena(&data->arena, &argv[1+table->npks], table->npks, &oldpklen);
         if (!oldpk) {
-            if (pk != buffer) cloudsync_memory_free(pk);
+            cloudsync_arena_release(&data->arena, mark);
             sqlite3_result_error(context, "Not enough memory to encode the primary key(s).", -1);
             return;
         }
-        
-        // mark the rows with the old primary key as deleted in the metadata (old row handling)
-        rc = local_mark_delete_meta(db, table, oldpk, oldpklen, db_version, BUMP_SEQ(data));
-        if (rc != SQLITE_OK) goto cleanup;
-        
-        // move non-sentinel metadata entries from OLD primary key to NEW primary key
-        // handles the case where some metadata is retained across primary key change
-        // see https://github.com/sqliteai/sqlite-sync/blob/main/docs/PriKey.md for more details
-        rc = local_update_move_meta(db, table, pk, pklen, oldpk, oldpklen, db_version);
-        if (rc != SQLITE_OK) goto cleanup;
-        
-        // mark a new sentinel row with the new primary key in the metadata
-        rc = local_mark_insert_sentinel_meta(db, table, pk, pklen, db_version, BUMP_SEQ(data));
-        if (rc != SQLITE_OK) goto cleanup;
-        
-        // free memory if the OLD primary key was dynamically allocated
-        if (oldpk != buffer2) cloudsync_memory_free(oldpk);
-        oldpk = NULL;
     }
     
-    // compare NEW and OLD values (excluding primary keys) to handle column updates
-    // starting index for column values
+    // NEW and OLD values (excluding primary keys) are interleaved
     int index = 1 + (table->npks * 2);
-    for (int i=0; i<table->ncols; i++) {
-        if (dbutils_value_compare(argv[i+index], argv[i+index+1]) != 0) {
-            // if a column value has changed, mark it as updated in the metadata
-            // columns are in cid order
-            rc = local_mark_insert_or_update_meta(db, table, pk, pklen, table->col_name[i], db_version, BUMP_SEQ(data));
-            if (rc != SQLITE_OK) goto cleanup;
-        }
-        ++index;
+    int rc = local_update_row(data, table, pk, pklen, oldpk, oldpklen, &argv[index], &argv[index+1], 2);
+    if (rc != SQLITE_OK) {
+        db_version_store_reset(data);
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
     }
     
-cleanup:
-    if (rc != SQLITE_OK) sqlite3_result_error(context, sqlite3_errmsg(db), -1);
-    if (pk != buffer) cloudsync_memory_free(pk);
-    if (oldpk && (oldpk != buffer2)) cloudsync_memory_free(oldpk);
+    cloudsync_arena_release(&data->arena, mark);
+}
+
+void cloudsync_update_column (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    DEBUG_FUNCTION("cloudsync_update_column %s %s", sqlite3_value_text(argv[0]), sqlite3_value_text(argv[1]));
+    
+    // arguments are:
+    // [0]                  table name
+    // [1]                  column name
+    // [2..1+table->npks]   NEW.prikeys
+    // [2+table->npks]      NEW.value
+    // [3+table->npks]      OLD.value (optional)
+    
+    // retrieve context
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
+    
+    // lookup table
+    const char *table_name = (const char *)sqlite3_value_text(argv[0]);
+    cloudsync_table_context *table = table_lookup(data, table_name);
+    if (!table) {
+        dbutils_context_result_error(context, "Unable to retrieve table name %s in cloudsync_update_column.", table_name);
+        return;
+    }
+    
+    // lookup column
+    const char *col_name = (const char *)sqlite3_value_text(argv[1]);
+    int col_index = table_column_index(table, col_name);
+    if ((col_index < 0) || (argc != 3 + table->npks && argc != 4 + table->npks)) {
+        dbutils_context_result_error(context, "Unable to retrieve column %s of table %s in cloudsync_update_column.", col_name, table_name);
+        return;
+    }
+    
+    // encode the NEW primary key values into a buffer of the call arena
+    cloudsync_arena_mark mark = cloudsync_arena_get_mark(&data->arena);
+    size_t pklen = 0;
+    char *pk = pk_encode_prikey_arena(&data->arena, &argv[2], table->npks, &pklen);
+    if (!pk) {
+        sqlite3_result_error(context, "Not enough memory to encode the primary key(s).", -1);
+        return;
+    }
+    
+    sqlite3_value *old_value = (argc == 4 + table->npks) ? argv[3+table->npks] : NULL;
+    int rc = local_update_column(data, table, pk, pklen, col_index, argv[2+table->npks], old_value);
+    if (rc != SQLITE_OK) {
+        db_version_store_reset(data);
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+    }
+    
+    cloudsync_arena_release(&data->arena, mark);
 }
 
 void cloudsync_delete (sqlite3_context *context, int argc, sqlite3_value **argv) {
@@ -2660,31 +5029,22 @@ void cloudsync_delete (sqlite3_context *context, int argc, sqlite3_value **argv)
         return;
     }
     
-    // compute the next database version for tracking changes
-    sqlite3_int64 db_version = db_version_next(db, data, CLOUDSYNC_VALUE_NOTSET);
-    int rc = SQLITE_OK;
-    
-    // encode the primary key values into a buffer
-    char buffer[1024];
-    size_t pklen = sizeof(buffer);
-    char *pk = pk_encode_prikey(&argv[1], table->npks, buffer, &pklen);
+    // encode the primary key values into a buffer of the call arena
+    cloudsync_arena_mark mark = cloudsync_arena_get_mark(&data->arena);
+    size_t pklen = 0;
+    char *pk = pk_encode_prikey_arena(&data->arena, &argv[1], table->npks, &pklen);
     if (!pk) {
         sqlite3_result_error(context, "Not enough memory to encode the primary key(s).", -1);
         return;
     }
     
-    // mark the row as deleted by inserting a delete sentinel into the metadata
-    rc = local_mark_delete_meta(db, table, pk, pklen, db_version, BUMP_SEQ(data));
-    if (rc != SQLITE_OK) goto cleanup;
-    
-    // remove any metadata related to the old rows associated with this primary key
-    rc = local_drop_meta(db, table, pk, pklen);
-    if (rc != SQLITE_OK) goto cleanup;
+    int rc = local_delete_row(data, table, pk, pklen);
+    if (rc != SQLITE_OK) {
+        db_version_store_reset(data);
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+    }
     
-cleanup:
-    if (rc != SQLITE_OK) sqlite3_result_error(context, sqlite3_errmsg(db), -1);
-    // free memory if the primary key was dynamically allocated
-    if (pk != buffer) cloudsync_memory_free(pk);
+    cloudsync_arena_release(&data->arena, mark);
 }
 
 // MARK: -
@@ -2701,6 +5061,8 @@ int cloudsync_cleanup_internal (sqlite3_context *context, const char *table_name
     cloudsync_table_context *table = table_lookup(data, table_name);
     if (!table) return SQLITE_OK;
     
+    // deferred writes reference the table context
+    cloudsync_deferred_flush(data);
     table_remove_from_context(data, table);
     table_free(table);
         
@@ -2750,6 +5112,7 @@ void cloudsync_cleanup_all (sqlite3_context *context) {
     if (rc == SQLITE_OK) {
         cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
         data->site_id[0] = 0;
+        siteid_cache_clear(data);
         dbutils_settings_cleanup(db);
     }
     
@@ -2839,20 +5202,35 @@ void cloudsync_terminate (sqlite3_context *context, int argc, sqlite3_value **ar
     
     cloudsync_context *data = (cloudsync_context *)sqlite3_user_data(context);
     
+    // deferred writes reference the table contexts
+    cloudsync_deferred_flush(data);
     for (int i=0; i<data->tables_count; ++i) {
         if (data->tables[i]) table_free(data->tables[i]);
         data->tables[i] = NULL;
     }
+    if (data->tables_index) kh_clear(NAME_TO_TABLE, data->tables_index);
     
-    if (data->schema_version_stmt) sqlite3_finalize(data->schema_version_stmt);
     if (data->data_version_stmt) sqlite3_finalize(data->data_version_stmt);
     if (data->db_version_stmt) sqlite3_finalize(data->db_version_stmt);
+    if (data->db_version_store_stmt) sqlite3_finalize(data->db_version_store_stmt);
     if (data->getset_siteid_stmt) sqlite3_finalize(data->getset_siteid_stmt);
+    if (data->siteid_lookup_stmt) sqlite3_finalize(data->siteid_lookup_stmt);
+    if (data->siteid_max_ord_stmt) sqlite3_finalize(data->siteid_max_ord_stmt);
     
-    data->schema_version_stmt = NULL;
     data->data_version_stmt = NULL;
     data->db_version_stmt = NULL;
+    data->db_version_store_stmt = NULL;
     data->getset_siteid_stmt = NULL;
+    data->siteid_lookup_stmt = NULL;
+    data->siteid_max_ord_stmt = NULL;
+    data->siteid_base_ord = CLOUDSYNC_VALUE_NOTSET;
+    data->siteid_count = CLOUDSYNC_VALUE_NOTSET;
+    data->caches_checked = false;
+    siteid_cache_free(data);
+    merge_group_free(data);
+    
+    // finalize statements cached by the cloudsync_changes virtual table
+    cloudsync_vtab_reset_cache(data->changes_vtab);
     
     // reset the site_id so the cloudsync_context_init will be executed again
     // if any other cloudsync function is called after terminate
@@ -3062,8 +5440,16 @@ void cloudsync_begin_alter (sqlite3_context *context, int argc, sqlite3_value **
         return;
     }
     
+    // the meta tables are rebuilt by cloudsync_finalize_alter
+    int rc = cloudsync_deferred_flush(data);
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+        sqlite3_result_error_code(context, rc);
+        return;
+    }
+    
     // create a savepoint to manage the alter operations as a transaction
-    int rc = sqlite3_exec(db, "SAVEPOINT cloudsync_alter", NULL, NULL, NULL);
+    rc = sqlite3_exec(db, "SAVEPOINT cloudsync_alter", NULL, NULL, NULL);
     if (rc != SQLITE_OK) {
         sqlite3_result_error(context, "Unable to create cloudsync_alter savepoint.", -1);
         sqlite3_result_error_code(context, rc);
@@ -3260,6 +5646,18 @@ APIEXPORT int sqlite3_cloudsync_init (sqlite3 *db, char **pzErrMsg, const sqlite
     rc = dbutils_register_function(db, "cloudsync_payload_decode", cloudsync_payload_decode, -1, pzErrMsg, ctx, NULL);
     if (rc != SQLITE_OK) return rc;
     
+    rc = dbutils_register_function(db, "cloudsync_payload_next", cloudsync_payload_next, 1, pzErrMsg, ctx, NULL);
+    if (rc != SQLITE_OK) return rc;
+    
+    rc = dbutils_register_function(db, "cloudsync_payload_next", cloudsync_payload_next, 2, pzErrMsg, ctx, NULL);
+    if (rc != SQLITE_OK) return rc;
+    
+    rc = dbutils_register_function(db, "cloudsync_payload_ack", cloudsync_payload_ack, 0, pzErrMsg, ctx, NULL);
+    if (rc != SQLITE_OK) return rc;
+    
+    rc = dbutils_register_function(db, "cloudsync_payload_ack", cloudsync_payload_ack, 2, pzErrMsg, ctx, NULL);
+    if (rc != SQLITE_OK) return rc;
+    
     // PRIVATE functions
     rc = dbutils_register_function(db, "cloudsync_is_sync", cloudsync_is_sync, 1, pzErrMsg, ctx, NULL);
     if (rc != SQLITE_OK) return rc;
@@ -3270,6 +5668,9 @@ APIEXPORT int sqlite3_cloudsync_init (sqlite3 *db, char **pzErrMsg, const sqlite
     rc = dbutils_register_function(db, "cloudsync_update", cloudsync_update, -1, pzErrMsg, ctx, NULL);
     if (rc != SQLITE_OK) return rc;
     
+    rc = dbutils_register_function(db, "cloudsync_update_column", cloudsync_update_column, -1, pzErrMsg, ctx, NULL);
+    if (rc != SQLITE_OK) return rc;
+    
     rc = dbutils_register_function(db, "cloudsync_delete", cloudsync_delete, -1, pzErrMsg, ctx, NULL);
     if (rc != SQLITE_OK) return rc;
     
@@ -3284,6 +5685,9 @@ APIEXPORT int sqlite3_cloudsync_init (sqlite3 *db, char **pzErrMsg, const sqlite
     
     rc = dbutils_register_function(db, "cloudsync_seq", cloudsync_seq, 0, pzErrMsg, ctx, NULL);
     if (rc != SQLITE_OK) return rc;
+    
+    rc = dbutils_register_function(db, "cloudsync_flush", cloudsync_flush, 0, pzErrMsg, ctx, NULL);
+    if (rc != SQLITE_OK) return rc;
 
     // NETWORK LAYER
     #ifndef CLOUDSYNC_OMIT_NETWORK
@@ -31,12 +31,23 @@ typedef struct cloudsync_pk_decode_bind_context cloudsync_pk_decode_bind_context
 
 int cloudsync_merge_insert (sqlite3_vtab *vtab, int argc, sqlite3_value **argv, sqlite3_int64 *rowid);
 void cloudsync_sync_key (cloudsync_context *data, const char *key, const char *value);
+void cloudsync_set_changes_vtab (cloudsync_context *data, sqlite3_vtab *vtab);
+bool cloudsync_context_validate_caches (cloudsync_context *data);
+int cloudsync_deferred_flush (cloudsync_context *data);
+const void *cloudsync_siteid_from_ord (sqlite3 *db, cloudsync_context *data, sqlite3_int64 ord);
+sqlite3_int64 cloudsync_siteid_count (cloudsync_context *data);
+sqlite3_int64 cloudsync_table_max_db_version (cloudsync_context *data, const char *table_name);
+const char *cloudsync_table_values_sql (cloudsync_context *data, const char *table_name);
+int cloudsync_table_column_index (cloudsync_context *data, const char *table_name, const char *col_name);
+int cloudsync_tables_count (cloudsync_context *data);
+bool cloudsync_table_stats (cloudsync_context *data, int index, const char **table_name, sqlite3_int64 *nrows, sqlite3_int64 *max_db_version);
 
 // used by network layer
 const char *cloudsync_context_init (sqlite3 *db, cloudsync_context *data, sqlite3_context *context);
 void *cloudsync_get_auxdata (sqlite3_context *context);
 void cloudsync_set_auxdata (sqlite3_context *context, void *xdata);
-int cloudsync_payload_apply (sqlite3_context *context, const char *payload, int blen);
+int cloudsync_payload_apply (sqlite3_context *context, const char *payload, int blen, int max_rows);
+int cloudsync_payload_page (sqlite3 *db, cloudsync_context *data, sqlite3_int64 max_bytes, sqlite3_int64 max_rows, char **blob, int *blob_size, sqlite3_int64 *db_version, sqlite3_int64 *seq);
 
 // used by core
 typedef bool (*cloudsync_payload_apply_callback_t)(void **xdata, cloudsync_pk_decode_bind_context *decoded_change, sqlite3 *db, cloudsync_context *data, int step, int rc);
@@ -256,6 +256,88 @@ int dbutils_value_compare (sqlite3_value *lvalue, sqlite3_value *rvalue) {
     return 0;
 }
 
+// order-preserving 64-bit fingerprint of a value (consistent with dbutils_value_compare):
+// 3 bits of type, 60 bits of value prefix and 1 bit set when the prefix represents the whole value
+#define FINGERPRINT_BODY_BITS       60
+#define FINGERPRINT_BODY_MASK       ((UINT64_C(1) << FINGERPRINT_BODY_BITS) - 1)
+#define FINGERPRINT_PREFIX_LEN      7
+
+bool dbutils_value_fingerprint (sqlite3_value *value, sqlite3_int64 *fingerprint) {
+    int type = sqlite3_value_type(value);
+    uint64_t body = 0;
+    bool exact = false;
+    
+    switch (type) {
+        case SQLITE_INTEGER: {
+            // shift the range that fits into the body, values outside of it saturate
+            const sqlite3_int64 limit = (sqlite3_int64)1 << (FINGERPRINT_BODY_BITS - 1);
+            sqlite3_int64 v = sqlite3_value_int64(value);
+            if (v <= -limit) body = 0;
+            else if (v >= limit - 1) body = FINGERPRINT_BODY_MASK;
+            else {body = (uint64_t)(v + limit); exact = true;}
+        } break;
+            
+        case SQLITE_FLOAT: {
+            double d = sqlite3_value_double(value);
+            if (d != d) return false;
+            if (d == 0.0) d = 0.0;
+            
+            // flip the bits of negative values and the sign bit of the positive ones to sort them as unsigned integers
+            uint64_t u;
+            memcpy(&u, &d, sizeof(uint64_t));
+            u = (u & (UINT64_C(1) << 63)) ? ~u : (u | (UINT64_C(1) << 63));
+            body = u >> (64 - FINGERPRINT_BODY_BITS);
+            exact = ((u & ((UINT64_C(1) << (64 - FINGERPRINT_BODY_BITS)) - 1)) == 0);
+        } break;
+            
+        case SQLITE_TEXT: {
+            // strcmp stops at the first NUL character
+            const unsigned char *text = sqlite3_value_text(value);
+            int len = 0;
+            while (len <= FINGERPRINT_PREFIX_LEN && text && text[len]) ++len;
+            for (int i=0; i<FINGERPRINT_PREFIX_LEN; ++i) body = (body << 8) | ((i < len) ? text[i] : 0);
+            body <<= 4;
+            exact = (len <= FINGERPRINT_PREFIX_LEN);
+        } break;
+            
+        case SQLITE_BLOB: {
+            // memcmp then size: the size (saturated to 8) follows the prefix
+            const unsigned char *blob = (const unsigned char *)sqlite3_value_blob(value);
+            int len = sqlite3_value_bytes(value);
+            for (int i=0; i<FINGERPRINT_PREFIX_LEN; ++i) body = (body << 8) | ((i < len) ? blob[i] : 0);
+            body = (body << 4) | (uint64_t)((len > FINGERPRINT_PREFIX_LEN) ? FINGERPRINT_PREFIX_LEN + 1 : len);
+            exact = (len <= FINGERPRINT_PREFIX_LEN);
+        } break;
+            
+        case SQLITE_NULL:
+            exact = true;
+            break;
+    }
+    
+    uint64_t u = ((uint64_t)type << (FINGERPRINT_BODY_BITS + 1)) | (body << 1) | (exact ? 1 : 0);
+    *fingerprint = (sqlite3_int64)u;
+    return true;
+}
+
+// compares two fingerprints with the same result of dbutils_value_compare on the original values,
+// decided is false when the values must be compared because the fingerprints are not enough
+int dbutils_fingerprint_compare (sqlite3_int64 lfingerprint, sqlite3_int64 rfingerprint, bool *decided) {
+    uint64_t l = (uint64_t)lfingerprint;
+    uint64_t r = (uint64_t)rfingerprint;
+    *decided = true;
+    
+    int l_type = (int)(l >> (FINGERPRINT_BODY_BITS + 1));
+    int r_type = (int)(r >> (FINGERPRINT_BODY_BITS + 1));
+    if (l_type != r_type) return (r_type - l_type);
+    
+    uint64_t l_body = (l >> 1) & FINGERPRINT_BODY_MASK;
+    uint64_t r_body = (r >> 1) & FINGERPRINT_BODY_MASK;
+    if (l_body != r_body) return (l_body < r_body) ? -1 : 1;
+    
+    *decided = ((l & 1) && (r & 1));
+    return 0;
+}
+
 void dbutils_context_result_error (sqlite3_context *context, const char *format, ...) {
     char buffer[4096];
     
@@ -462,6 +544,28 @@ bool dbutils_table_sanity_check (sqlite3 *db, sqlite3_context *context, const ch
     return true;
 }
 
+int dbutils_delete_update_triggers (sqlite3 *db, const char *table) {
+    DEBUG_DBFUNCTION("dbutils_delete_update_triggers %s", table);
+    
+    char *sql = cloudsync_memory_mprintf("DROP TRIGGER IF EXISTS \"cloudsync_after_update_%w\";", table);
+    if (!sql) return SQLITE_NOMEM;
+    int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    cloudsync_memory_free(sql);
+    if (rc != SQLITE_OK) return rc;
+    
+    // column specific triggers are named after the cid of the column so collect them from the schema
+    sql = cloudsync_memory_mprintf("SELECT group_concat(format('DROP TRIGGER IF EXISTS \"%%w\";', name), ' ') FROM sqlite_master WHERE type='trigger' AND tbl_name=%Q AND name GLOB 'cloudsync_column_after_update_*';", table);
+    if (!sql) return SQLITE_NOMEM;
+    char *drop = dbutils_text_select(db, sql);
+    cloudsync_memory_free(sql);
+    
+    if (drop) {
+        rc = sqlite3_exec(db, drop, NULL, NULL, NULL);
+        cloudsync_memory_free(drop);
+    }
+    return rc;
+}
+
 int dbutils_delete_triggers (sqlite3 *db, const char *table) {
     DEBUG_DBFUNCTION("dbutils_delete_triggers %s", table);
     
@@ -482,8 +586,7 @@ int dbutils_delete_triggers (sqlite3 *db, const char *table) {
     rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
     if (rc != SQLITE_OK) goto finalize;
     
-    sql = sqlite3_snprintf((int)blen, buffer, "DROP TRIGGER IF EXISTS \"cloudsync_after_update_%w\";", table);
-    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    rc = dbutils_delete_update_triggers(db, table);
     if (rc != SQLITE_OK) goto finalize;
     
     sql = sqlite3_snprintf((int)blen, buffer, "DROP TRIGGER IF EXISTS \"cloudsync_after_delete_%w\";", table);
@@ -495,6 +598,140 @@ finalize:
     return rc;
 }
 
+int dbutils_check_update_triggers (sqlite3 *db, const char *table, const char *trigger_when) {
+    DEBUG_DBFUNCTION("dbutils_check_update_triggers %s", table);
+    
+    // SQLite loads in the OLD/NEW registers only the columns referenced by the triggers that fire,
+    // and an AFTER UPDATE OF trigger fires only when one of its columns is in the SET list of the UPDATE.
+    // So instead of a single trigger that receives and compares all the columns, each non primary key
+    // column has its own AFTER UPDATE OF trigger that calls cloudsync_update_column with the NEW and OLD values
+    // only when they differ (large unchanged values never reach the extension).
+    // A primary key change still needs all the columns, so it is handled by an AFTER UPDATE OF <prikeys>
+    // trigger that calls cloudsync_update with the full NEW/OLD layout; the WHEN clauses make the two
+    // paths mutually exclusive so their firing order does not matter.
+    // Rowid only tables cannot use UPDATE OF rowid and keep the single full-row trigger.
+    
+    char *trigger_name = NULL;
+    char *pkclause = NULL;
+    char *pknames = NULL;
+    char *pknew = NULL;
+    char *pkchanged = NULL;
+    char *colvalues = NULL;
+    char *sql = NULL;
+    int rc = SQLITE_NOMEM;
+    
+    trigger_name = cloudsync_memory_mprintf("cloudsync_after_update_%s", table);
+    if (!trigger_name) goto finalize;
+    
+    // NEW.prikey1, NEW.prikey2, OLD.prikey1, OLD.prikey2
+    sql = cloudsync_memory_mprintf("SELECT group_concat('NEW.\"' || format('%%w', name) || '\"', ',') || ',' || group_concat('OLD.\"' || format('%%w', name) || '\"', ',') FROM pragma_table_info('%q') WHERE pk>0 ORDER BY pk;", table);
+    if (!sql) goto finalize;
+    pkclause = dbutils_text_select(db, sql);
+    cloudsync_memory_free(sql);
+    sql = NULL;
+    
+    // the update triggers are up to date if the row trigger and one trigger for each column exist
+    // (databases created by previous versions only have the full-row trigger)
+    bool exists = dbutils_trigger_exists(db, trigger_name);
+    if (exists && pkclause) {
+        sql = cloudsync_memory_mprintf("SELECT (SELECT count(*) FROM pragma_table_info('%q') WHERE pk=0) = (SELECT count(*) FROM sqlite_master WHERE type='trigger' AND tbl_name=%Q AND name GLOB 'cloudsync_column_after_update_*');", table, table);
+        if (!sql) goto finalize;
+        exists = (dbutils_int_select(db, sql) == 1);
+        cloudsync_memory_free(sql);
+        sql = NULL;
+    }
+    if (exists) {
+        rc = SQLITE_OK;
+        goto finalize;
+    }
+    
+    rc = dbutils_delete_update_triggers(db, table);
+    if (rc != SQLITE_OK) goto finalize;
+    rc = SQLITE_NOMEM;
+    
+    // NEW.col1, OLD.col1, NEW.col2, OLD.col2...
+    sql = cloudsync_memory_mprintf("SELECT group_concat('NEW.\"' || format('%%w', name) || '\"' || ', OLD.\"' || format('%%w', name) || '\"', ',') FROM pragma_table_info('%q') WHERE pk=0 ORDER BY cid;", table);
+    if (!sql) goto finalize;
+    colvalues = dbutils_text_select(db, sql);
+    cloudsync_memory_free(sql);
+    sql = NULL;
+    
+    if (!pkclause) {
+        // rowid only table
+        if (colvalues == NULL) {
+            sql = cloudsync_memory_mprintf("CREATE TRIGGER \"%w\" AFTER UPDATE ON \"%w\" %s BEGIN SELECT cloudsync_update('%q',NEW.rowid,OLD.rowid); END", trigger_name, table, trigger_when, table);
+        } else {
+            sql = cloudsync_memory_mprintf("CREATE TRIGGER \"%w\" AFTER UPDATE ON \"%w\" %s BEGIN SELECT cloudsync_update('%q',NEW.rowid,OLD.rowid,%s); END", trigger_name, table, trigger_when, table, colvalues);
+        }
+        if (!sql) goto finalize;
+        
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        DEBUG_SQL("\n%s", sql);
+        goto finalize;
+    }
+    
+    // "prikey1","prikey2"
+    sql = cloudsync_memory_mprintf("SELECT group_concat('\"' || format('%%w', name) || '\"', ',') FROM pragma_table_info('%q') WHERE pk>0 ORDER BY pk;", table);
+    if (!sql) goto finalize;
+    pknames = dbutils_text_select(db, sql);
+    cloudsync_memory_free(sql);
+    sql = NULL;
+    
+    // NEW.prikey1, NEW.prikey2
+    sql = cloudsync_memory_mprintf("SELECT group_concat('NEW.\"' || format('%%w', name) || '\"', ',') FROM pragma_table_info('%q') WHERE pk>0 ORDER BY pk;", table);
+    if (!sql) goto finalize;
+    pknew = dbutils_text_select(db, sql);
+    cloudsync_memory_free(sql);
+    sql = NULL;
+    
+    // a value is changed when it differs byte by byte (regardless of the column collation) or in type
+    // (1 and 1.0 compare equal in SQL), the same rule used by dbutils_value_compare
+    sql = cloudsync_memory_mprintf("SELECT group_concat(format('(NEW.\"%%w\" IS NOT OLD.\"%%w\" COLLATE BINARY OR typeof(NEW.\"%%w\") != typeof(OLD.\"%%w\"))', name, name, name, name), ' OR ') FROM pragma_table_info('%q') WHERE pk>0 ORDER BY pk;", table);
+    if (!sql) goto finalize;
+    pkchanged = dbutils_text_select(db, sql);
+    cloudsync_memory_free(sql);
+    sql = NULL;
+    if (!pknames || !pknew || !pkchanged) goto finalize;
+    
+    // primary key trigger
+    if (colvalues == NULL) {
+        sql = cloudsync_memory_mprintf("CREATE TRIGGER \"%w\" AFTER UPDATE OF %s ON \"%w\" %s AND (%s) BEGIN SELECT cloudsync_update('%q',%s); END", trigger_name, pknames, table, trigger_when, pkchanged, table, pkclause);
+    } else {
+        sql = cloudsync_memory_mprintf("CREATE TRIGGER \"%w\" AFTER UPDATE OF %s ON \"%w\" %s AND (%s) BEGIN SELECT cloudsync_update('%q',%s,%s); END", trigger_name, pknames, table, trigger_when, pkchanged, table, pkclause, colvalues);
+    }
+    if (!sql) goto finalize;
+    
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    DEBUG_SQL("\n%s", sql);
+    cloudsync_memory_free(sql);
+    sql = NULL;
+    if (rc != SQLITE_OK || colvalues == NULL) goto finalize;
+    rc = SQLITE_NOMEM;
+    
+    // column triggers
+    // triggers on the same table fire from the most recently created one, so they are created
+    // in descending cid order to mark the columns in cid order (like the full-row trigger)
+    sql = cloudsync_memory_mprintf("SELECT group_concat(format('CREATE TRIGGER \"cloudsync_column_after_update_%%w_%%d\" AFTER UPDATE OF \"%%w\" ON \"%%w\" %%s AND NOT (%%s) AND (NEW.\"%%w\" IS NOT OLD.\"%%w\" COLLATE BINARY OR typeof(NEW.\"%%w\") != typeof(OLD.\"%%w\")) BEGIN SELECT cloudsync_update_column(%%Q,%%Q,%%s,NEW.\"%%w\",OLD.\"%%w\"); END;', %Q, cid, name, %Q, %Q, %Q, name, name, name, name, %Q, name, %Q, name, name), ' ') FROM (SELECT cid, name FROM pragma_table_info('%q') WHERE pk=0 ORDER BY cid DESC);", table, table, trigger_when, pkchanged, table, pknew, table);
+    if (!sql) goto finalize;
+    char *triggers = dbutils_text_select(db, sql);
+    if (!triggers) goto finalize;
+    
+    rc = sqlite3_exec(db, triggers, NULL, NULL, NULL);
+    DEBUG_SQL("\n%s", triggers);
+    cloudsync_memory_free(triggers);
+    
+finalize:
+    if (rc != SQLITE_OK) DEBUG_ALWAYS("dbutils_check_update_triggers error %s (%d)", sqlite3_errmsg(db), rc);
+    if (sql) cloudsync_memory_free(sql);
+    if (trigger_name) cloudsync_memory_free(trigger_name);
+    if (pkclause) cloudsync_memory_free(pkclause);
+    if (pknames) cloudsync_memory_free(pknames);
+    if (pknew) cloudsync_memory_free(pknew);
+    if (pkchanged) cloudsync_memory_free(pkchanged);
+    if (colvalues) cloudsync_memory_free(colvalues);
+    return rc;
+}
+
 int dbutils_check_triggers (sqlite3 *db, const char *table, table_algo algo) {
     DEBUG_DBFUNCTION("dbutils_check_triggers %s", table);
     
@@ -533,42 +770,10 @@ int dbutils_check_triggers (sqlite3 *db, const char *table, table_algo algo) {
     rc = SQLITE_NOMEM;
 
     if (algo != table_algo_crdt_gos) {
+        // UPDATE TRIGGERS
+        rc = dbutils_check_update_triggers(db, table, trigger_when);
+        if (rc != SQLITE_OK) goto finalize;
         rc = SQLITE_NOMEM;
-        
-        // UPDATE TRIGGER
-        // NEW.prikey1, NEW.prikey2, OLD.prikey1, OLD.prikey2, NEW.col1, OLD.col1, NEW.col2, OLD.col2...
-        trigger_name = cloudsync_memory_mprintf("cloudsync_after_update_%s", table);
-        if (!trigger_name) goto finalize;
-        
-        if (!dbutils_trigger_exists(db, trigger_name)) {
-            char *sql = cloudsync_memory_mprintf("SELECT group_concat('NEW.\"' || format('%%w', name) || '\"', ',') || ',' || group_concat('OLD.\"' || format('%%w', name) || '\"', ',') FROM pragma_table_info('%q') WHERE pk>0 ORDER BY pk;", table);
-            if (!sql) goto finalize;
-            
-            char *pkclause = dbutils_text_select(db, sql);
-            char *pkvalues = (pkclause) ? pkclause : "NEW.rowid,OLD.rowid";
-            cloudsync_memory_free(sql);
-            
-            sql = cloudsync_memory_mprintf("SELECT group_concat('NEW.\"' || format('%%w', name) || '\"' || ', OLD.\"' || format('%%w', name) || '\"', ',') FROM pragma_table_info('%q') WHERE pk=0 ORDER BY cid;", table);
-            if (!sql) goto finalize;
-            char *colvalues = dbutils_text_select(db, sql);
-            cloudsync_memory_free(sql);
-            
-            if (colvalues == NULL) {
-                sql = cloudsync_memory_mprintf("CREATE TRIGGER \"%w\" AFTER UPDATE ON \"%w\" %s BEGIN SELECT cloudsync_update('%q',%s); END", trigger_name, table, trigger_when, table, pkvalues);
-            } else {
-                sql = cloudsync_memory_mprintf("CREATE TRIGGER \"%w\" AFTER UPDATE ON \"%w\" %s BEGIN SELECT cloudsync_update('%q',%s,%s); END", trigger_name, table, trigger_when, table, pkvalues, colvalues);
-                cloudsync_memory_free(colvalues);
-            }
-            if (pkclause) cloudsync_memory_free(pkclause);
-            if (!sql) goto finalize;
-            
-            rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
-            DEBUG_SQL("\n%s", sql);
-            cloudsync_memory_free(sql);
-            if (rc != SQLITE_OK) goto finalize;
-        }
-        cloudsync_memory_free(trigger_name);
-        trigger_name = NULL;
     } else {
         // Grow Only Set
         // In a grow-only set, the update operation is not allowed.
@@ -645,16 +850,36 @@ finalize:
     return rc;
 }
 
+bool dbutils_metatable_has_fingerprint (sqlite3 *db, const char *table) {
+    char *sql = cloudsync_memory_mprintf("SELECT count(*) FROM pragma_table_info('%q_cloudsync') WHERE name='col_fingerprint';", table);
+    if (!sql) return false;
+    
+    sqlite3_int64 count = dbutils_int_select(db, sql);
+    cloudsync_memory_free(sql);
+    return (count > 0);
+}
+
 int dbutils_check_metatable (sqlite3 *db, const char *table, table_algo algo) {
     DEBUG_DBFUNCTION("dbutils_check_metatable %s", table);
         
     // WITHOUT ROWID is available starting from SQLite version 3.8.2 (2013-12-06) and later
-    char *sql = cloudsync_memory_mprintf("CREATE TABLE IF NOT EXISTS \"%w_cloudsync\" (pk BLOB NOT NULL, col_name TEXT NOT NULL, col_version INTEGER, db_version INTEGER, site_id INTEGER DEFAULT 0, seq INTEGER, PRIMARY KEY (pk, col_name)) WITHOUT ROWID; CREATE INDEX IF NOT EXISTS \"%w_cloudsync_db_idx\" ON \"%w_cloudsync\" (db_version);", table, table, table);
+    char *sql = cloudsync_memory_mprintf("CREATE TABLE IF NOT EXISTS \"%w_cloudsync\" (pk BLOB NOT NULL, col_name TEXT NOT NULL, col_version INTEGER, db_version INTEGER, site_id INTEGER DEFAULT 0, seq INTEGER, col_fingerprint INTEGER, PRIMARY KEY (pk, col_name)) WITHOUT ROWID; CREATE INDEX IF NOT EXISTS \"%w_cloudsync_db_idx\" ON \"%w_cloudsync\" (db_version);", table, table, table);
     if (!sql) return SQLITE_NOMEM;
     
     int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
     DEBUG_SQL("\n%s", sql);
     cloudsync_memory_free(sql);
+    if (rc != SQLITE_OK) return rc;
+    
+    // meta-tables created by previous versions have no value fingerprints (adding a nullable column is cheap)
+    if (!dbutils_metatable_has_fingerprint(db, table)) {
+        sql = cloudsync_memory_mprintf("ALTER TABLE \"%w_cloudsync\" ADD COLUMN col_fingerprint INTEGER;", table);
+        if (!sql) return SQLITE_NOMEM;
+        
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        DEBUG_SQL("\n%s", sql);
+        cloudsync_memory_free(sql);
+    }
     
     return rc;
 }
@@ -965,6 +1190,26 @@ int dbutils_settings_load (sqlite3 *db, cloudsync_context *data) {
     return SQLITE_OK;
 }
 
+int dbutils_db_version_init (sqlite3 *db) {
+    // single row table with the current db_version, so reading it is one primary key lookup
+    // regardless of the number of augmented tables (no constraints, so updating it never needs a statement journal)
+    char *sql = "CREATE TABLE IF NOT EXISTS cloudsync_db_version (id INTEGER PRIMARY KEY, version INTEGER);";
+    int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) return rc;
+    
+    // databases created by previous versions start from the max db_version of their meta tables
+    // (the query is NULL if there are no meta tables)
+    sql = "SELECT 'INSERT INTO cloudsync_db_version (id, version) SELECT 1, coalesce(max(version), 0) FROM (' || "
+          "group_concat('SELECT max(db_version) AS version FROM \"' || format('%w', name) || '\"', ' UNION ALL ') || "
+          "' UNION ALL SELECT CAST(value AS INTEGER) AS version FROM cloudsync_settings WHERE key = ''pre_alter_dbversion'');' "
+          "FROM sqlite_master WHERE type='table' AND name LIKE '%_cloudsync';";
+    char *seed = dbutils_text_select(db, sql);
+    
+    rc = sqlite3_exec(db, (seed) ? seed : "INSERT INTO cloudsync_db_version (id, version) VALUES (1, 0);", NULL, NULL, NULL);
+    if (seed) cloudsync_memory_free(seed);
+    return rc;
+}
+
 int dbutils_settings_init (sqlite3 *db, void *cloudsync_data, sqlite3_context *context) {
     DEBUG_SETTINGS("dbutils_settings_init %p", context);
         
@@ -1040,6 +1285,14 @@ int dbutils_settings_init (sqlite3 *db, void *cloudsync_data, sqlite3_context *c
         if (rc != SQLITE_OK) {if (context) sqlite3_result_error(context, sqlite3_errmsg(db), -1); return rc;}
     }
     
+    // check if cloudsync_db_version table exists
+    if (dbutils_table_exists(db, CLOUDSYNC_DB_VERSION_NAME) == false) {
+        DEBUG_SETTINGS("cloudsync_db_version does not exist (creating a new one)");
+        
+        int rc = dbutils_db_version_init(db);
+        if (rc != SQLITE_OK) {if (context) sqlite3_result_error(context, sqlite3_errmsg(db), -1); return rc;}
+    }
+    
     // cloudsync_settings table exists so load it
     dbutils_settings_load(db, data);
     
@@ -1098,6 +1351,6 @@ bool dbutils_check_schema_hash (sqlite3 *db, sqlite3_uint64 hash) {
 
 
 int dbutils_settings_cleanup (sqlite3 *db) {
-    const char *sql = "DROP TABLE IF EXISTS cloudsync_settings; DROP TABLE IF EXISTS cloudsync_site_id; DROP TABLE IF EXISTS cloudsync_table_settings; DROP TABLE IF EXISTS cloudsync_schema_versions; ";
+    const char *sql = "DROP TABLE IF EXISTS cloudsync_settings; DROP TABLE IF EXISTS cloudsync_site_id; DROP TABLE IF EXISTS cloudsync_table_settings; DROP TABLE IF EXISTS cloudsync_schema_versions; DROP TABLE IF EXISTS cloudsync_apply_errors; DROP TABLE IF EXISTS cloudsync_db_version; ";
     return sqlite3_exec(db, sql, NULL, NULL, NULL);
 }
@@ -16,6 +16,7 @@
 #define CLOUDSYNC_SITEID_NAME               "cloudsync_site_id"
 #define CLOUDSYNC_TABLE_SETTINGS_NAME       "cloudsync_table_settings"
 #define CLOUDSYNC_SCHEMA_VERSIONS_NAME      "cloudsync_schema_versions"
+#define CLOUDSYNC_DB_VERSION_NAME           "cloudsync_db_version"
 
 #define CLOUDSYNC_KEY_LIBVERSION            "version"
 #define CLOUDSYNC_KEY_SCHEMAVERSION         "schemaversion"
@@ -24,6 +25,13 @@
 #define CLOUDSYNC_KEY_SEND_DBVERSION        "send_dbversion"
 #define CLOUDSYNC_KEY_SEND_SEQ              "send_seq"
 #define CLOUDSYNC_KEY_DEBUG                 "debug"
+#define CLOUDSYNC_KEY_APPLY_SORTED          "apply_sorted"
+#define CLOUDSYNC_KEY_APPLY_PAYLOAD         "apply_payload"
+#define CLOUDSYNC_KEY_APPLY_ROW             "apply_row"
+#define CLOUDSYNC_KEY_APPLY_OFFSET          "apply_offset"
+#define CLOUDSYNC_KEY_APPLY_ERRORS          "apply_errors"
+#define CLOUDSYNC_KEY_DEFER_META            "defer_meta"
+#define CLOUDSYNC_KEY_PAYLOAD_VERSION       "payload_version"
 #define CLOUDSYNC_KEY_ALGO                  "algo"
 
 // general
@@ -42,6 +50,8 @@ void dbutils_debug_values (int argc, sqlite3_value **argv);
 void dbutils_debug_value (sqlite3_value *value);
 
 int dbutils_value_compare (sqlite3_value *v1, sqlite3_value *v2);
+bool dbutils_value_fingerprint (sqlite3_value *value, sqlite3_int64 *fingerprint);
+int dbutils_fingerprint_compare (sqlite3_int64 lfingerprint, sqlite3_int64 rfingerprint, bool *decided);
 void dbutils_context_result_error (sqlite3_context *context, const char *format, ...);
 
 bool dbutils_system_exists (sqlite3 *db, const char *name, const char *type);
@@ -51,13 +61,17 @@ bool dbutils_table_sanity_check (sqlite3 *db, sqlite3_context *context, const ch
 bool dbutils_is_star_table (const char *table_name);
 
 int dbutils_delete_triggers (sqlite3 *db, const char *table);
+int dbutils_delete_update_triggers (sqlite3 *db, const char *table);
 int dbutils_check_triggers (sqlite3 *db, const char *table, table_algo algo);
+int dbutils_check_update_triggers (sqlite3 *db, const char *table, const char *trigger_when);
 int dbutils_check_metatable (sqlite3 *db, const char *table, table_algo algo);
+bool dbutils_metatable_has_fingerprint (sqlite3 *db, const char *table);
 sqlite3_int64 dbutils_schema_version (sqlite3 *db);
 
 // settings
 int dbutils_settings_cleanup (sqlite3 *db);
 int dbutils_settings_init (sqlite3 *db, void *cloudsync_data, sqlite3_context *context);
+int dbutils_db_version_init (sqlite3 *db);
 int dbutils_settings_set_key_value (sqlite3 *db, sqlite3_context *context, const char *key, const char *value);
 int dbutils_settings_get_int_value (sqlite3 *db, const char *key);
 char *dbutils_settings_get_value (sqlite3 *db, const char *key, char *buffer, size_t blen);
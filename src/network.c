@@ -35,6 +35,7 @@ static size_t cacert_len = sizeof(cacert_pem) - 1;
 #define DEFAULT_SYNC_MAX_RETRIES                1
  
 #define MAX_QUERY_VALUE_LEN                     256
+#define CLOUDSYNC_NETWORK_MAX_PAYLOAD_SIZE      8*1024*1024     // uncompressed size of each uploaded page of changes
 
 #ifndef SQLITE_CORE
 SQLITE_EXTENSION_INIT3
@@ -338,7 +339,8 @@ int network_download_changes (sqlite3_context *context, const char *download_url
     
     int rc = SQLITE_OK;
     if (result.code == CLOUDSYNC_NETWORK_BUFFER) {
-        rc = cloudsync_payload_apply(context, result.buffer, (int)result.blen);
+        // the downloaded buffer is not kept between calls, so it is always applied as a whole
+        rc = cloudsync_payload_apply(context, result.buffer, (int)result.blen, 0);
         network_result_cleanup(&result);
     } else {
         rc = network_set_sqlite_result(context, &result);
@@ -694,70 +696,73 @@ int cloudsync_network_send_changes_internal (sqlite3_context *context, int argc,
     if (!data) {sqlite3_result_error(context, "Unable to retrieve CloudSync context.", -1); return SQLITE_ERROR;}
     
     sqlite3 *db = sqlite3_context_db_handle(context);
+    cloudsync_context *xdata = (cloudsync_context *)sqlite3_user_data(context);
 
-    int db_version = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_SEND_DBVERSION);
+    sqlite3_int64 db_version = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_SEND_DBVERSION);
     if (db_version<0) {sqlite3_result_error(context, "Unable to retrieve db_version.", -1); return SQLITE_ERROR;}
 
-    int seq = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_SEND_SEQ);
+    sqlite3_int64 seq = dbutils_settings_get_int_value(db, CLOUDSYNC_KEY_SEND_SEQ);
     if (seq<0) {sqlite3_result_error(context, "Unable to retrieve seq.", -1); return SQLITE_ERROR;}
     
-    // retrieve BLOB
-    char sql[1024];
-    snprintf(sql, sizeof(sql), "WITH max_db_version AS (SELECT MAX(db_version) AS max_db_version FROM cloudsync_changes) "
-                               "SELECT cloudsync_payload_encode(tbl, pk, col_name, col_value, col_version, db_version, site_id, cl, seq), max_db_version AS max_db_version, MAX(IIF(db_version = max_db_version, seq, NULL)) FROM cloudsync_changes, max_db_version WHERE site_id=cloudsync_siteid() AND (db_version>%d OR (db_version=%d AND seq>%d))", db_version, db_version, seq);
-    int blob_size = 0;
-    char *blob = NULL;
-    sqlite3_int64 new_db_version = 0;
-    sqlite3_int64 new_seq = 0;
-    int rc = dbutils_blob_int_int_select(db, sql, &blob, &blob_size, &new_db_version, &new_seq);
-    if (rc != SQLITE_OK) {
-        sqlite3_result_error(context, "cloudsync_network_send_changes unable to get changes", -1);
-        sqlite3_result_error_code(context, rc);
-        return rc;
-    }
-    
-    // exit if there are no data to send
-    if (blob == NULL || blob_size == 0) return SQLITE_OK;
-    
-    NETWORK_RESULT res = network_receive_buffer(data, data->upload_endpoint, data->authentication, true, false, NULL, CLOUDSYNC_HEADER_SQLITECLOUD);
-    if (res.code != CLOUDSYNC_NETWORK_BUFFER) {
-        network_result_to_sqlite_error(context, res, "cloudsync_network_send_changes unable to receive upload URL");
-        return SQLITE_ERROR;
-    }
-    
-    const char *s3_url = res.buffer;
-    bool sent = network_send_buffer(data, s3_url, NULL, blob, blob_size);
-    cloudsync_memory_free(blob);
-    if (sent == false) {
-        network_result_to_sqlite_error(context, res, "cloudsync_network_send_changes unable to upload BLOB changes to remote host.");
-        return SQLITE_ERROR;
-    }
-    
-    char json_payload[2024];
-    snprintf(json_payload, sizeof(json_payload), "{\"url\":\"%s\"}", s3_url);
-    
-    // free res
-    network_result_cleanup(&res);
-    
-    // notify remote host that we succesfully uploaded changes
-    res = network_receive_buffer(data, data->upload_endpoint, data->authentication, true, true, json_payload, CLOUDSYNC_HEADER_SQLITECLOUD);
-    if (res.code != CLOUDSYNC_NETWORK_OK) {
-        network_result_to_sqlite_error(context, res, "cloudsync_network_send_changes unable to notify BLOB upload to remote host.");
-        return SQLITE_ERROR;
-    }
-    
-    char buf[256];
-    if (new_db_version != db_version) {
-        snprintf(buf, sizeof(buf), "%lld", new_db_version);
-        dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_SEND_DBVERSION, buf);
-    }
-    if (new_seq != seq) {
-        snprintf(buf, sizeof(buf), "%lld", new_seq);
-        dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_SEND_SEQ, buf);
+    // changes are uploaded in pages of bounded size, so memory usage does not depend on the number of unsent changes
+    // and the send cursor is advanced after each page is successfully delivered
+    while (1) {
+        int blob_size = 0;
+        char *blob = NULL;
+        sqlite3_int64 new_db_version = db_version;
+        sqlite3_int64 new_seq = seq;
+        int rc = cloudsync_payload_page(db, xdata, CLOUDSYNC_NETWORK_MAX_PAYLOAD_SIZE, 0, &blob, &blob_size, &new_db_version, &new_seq);
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error(context, "cloudsync_network_send_changes unable to get changes", -1);
+            sqlite3_result_error_code(context, rc);
+            return rc;
+        }
+        
+        // exit if there are no more data to send
+        if (blob == NULL || blob_size == 0) return SQLITE_OK;
+        
+        NETWORK_RESULT res = network_receive_buffer(data, data->upload_endpoint, data->authentication, true, false, NULL, CLOUDSYNC_HEADER_SQLITECLOUD);
+        if (res.code != CLOUDSYNC_NETWORK_BUFFER) {
+            cloudsync_memory_free(blob);
+            network_result_to_sqlite_error(context, res, "cloudsync_network_send_changes unable to receive upload URL");
+            return SQLITE_ERROR;
+        }
+        
+        const char *s3_url = res.buffer;
+        bool sent = network_send_buffer(data, s3_url, NULL, blob, blob_size);
+        cloudsync_memory_free(blob);
+        if (sent == false) {
+            network_result_to_sqlite_error(context, res, "cloudsync_network_send_changes unable to upload BLOB changes to remote host.");
+            return SQLITE_ERROR;
+        }
+        
+        char json_payload[2024];
+        snprintf(json_payload, sizeof(json_payload), "{\"url\":\"%s\"}", s3_url);
+        
+        // free res
+        network_result_cleanup(&res);
+        
+        // notify remote host that we succesfully uploaded changes
+        res = network_receive_buffer(data, data->upload_endpoint, data->authentication, true, true, json_payload, CLOUDSYNC_HEADER_SQLITECLOUD);
+        if (res.code != CLOUDSYNC_NETWORK_OK) {
+            network_result_to_sqlite_error(context, res, "cloudsync_network_send_changes unable to notify BLOB upload to remote host.");
+            return SQLITE_ERROR;
+        }
+        
+        char buf[256];
+        if (new_db_version != db_version) {
+            snprintf(buf, sizeof(buf), "%lld", new_db_version);
+            dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_SEND_DBVERSION, buf);
+        }
+        if (new_seq != seq) {
+            snprintf(buf, sizeof(buf), "%lld", new_seq);
+            dbutils_settings_set_key_value(db, context, CLOUDSYNC_KEY_SEND_SEQ, buf);
+        }
+        
+        network_result_cleanup(&res);
+        db_version = new_db_version;
+        seq = new_seq;
     }
-    
-    network_result_cleanup(&res);
-    return SQLITE_OK;
 }
 
 void cloudsync_network_send_changes (sqlite3_context *context, int argc, sqlite3_value **argv) {
@@ -358,6 +358,47 @@ char *pk_encode (sqlite3_value **argv, int argc, char *b, bool is_prikey, size_t
     return buffer;
 }
 
+size_t pk_encode_integer_size (int64_t value) {
+    // size of a single integer item encoded with pk_encode_integer
+    if (value == INT64_MIN) return 1;
+    if (value < 0) value = -value;
+    return 1 + pk_encode_nbytes_needed(value);
+}
+
+size_t pk_encode_integer (char *buffer, size_t bseek, int64_t value) {
+    // encode a single integer item (same format used by pk_encode)
+    if (value == INT64_MIN) return pk_encode_u8(buffer, bseek, SQLITE_MAX_NEGATIVE_INTEGER);
+    
+    int type = SQLITE_INTEGER;
+    if (value < 0) {value = -value; type = SQLITE_NEGATIVE_INTEGER;}
+    size_t nbytes = pk_encode_nbytes_needed(value);
+    bseek = pk_encode_u8(buffer, bseek, (uint8_t)((nbytes << 3) | type));
+    return pk_encode_int64(buffer, bseek, value, nbytes);
+}
+
+size_t pk_encode_text_size (size_t len) {
+    // size of a single text item encoded with pk_encode_text
+    return 1 + pk_encode_nbytes_needed((int64_t)len) + len;
+}
+
+size_t pk_encode_text (char *buffer, size_t bseek, const char *text, size_t len) {
+    // encode a single text item (same format used by pk_encode)
+    size_t nbytes = pk_encode_nbytes_needed((int64_t)len);
+    bseek = pk_encode_u8(buffer, bseek, (uint8_t)((nbytes << 3) | SQLITE_TEXT));
+    bseek = pk_encode_int64(buffer, bseek, (int64_t)len, nbytes);
+    return pk_encode_data(buffer, bseek, (char *)text, len);
+}
+
 char *pk_encode_prikey (sqlite3_value **argv, int argc, char *b, size_t *bsize) {
     return pk_encode(argv, argc, b, true, bsize);
 }
+
+char *pk_encode_prikey_arena (cloudsync_arena *arena, sqlite3_value **argv, int argc, size_t *bsize) {
+    // the buffer is sized exactly, so pk_encode never falls back to its own allocation
+    size_t blen = pk_encode_size(argv, argc, 1);
+    char *buffer = cloudsync_arena_alloc(arena, blen);
+    if (!buffer) return NULL;
+    
+    *bsize = blen;
+    return pk_encode(argv, argc, buffer, true, bsize);
+}
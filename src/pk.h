@@ -19,12 +19,19 @@
 #include "sqlite3.h"
 #endif
 
+#include "utils.h"
+
 char *pk_encode_prikey (sqlite3_value **argv, int argc, char *b, size_t *bsize);
+char *pk_encode_prikey_arena (cloudsync_arena *arena, sqlite3_value **argv, int argc, size_t *bsize);
 char *pk_encode (sqlite3_value **argv, int argc, char *b, bool is_prikey, size_t *bsize);
 int pk_decode_prikey (char *buffer, size_t blen, int (*cb) (void *xdata, int index, int type, int64_t ival, double dval, char *pval), void *xdata);
 int pk_decode(char *buffer, size_t blen, int count, size_t *seek, int (*cb) (void *xdata, int index, int type, int64_t ival, double dval, char *pval), void *xdata);
 int pk_decode_bind_callback (void *xdata, int index, int type, int64_t ival, double dval, char *pval);
 int pk_decode_print_callback (void *xdata, int index, int type, int64_t ival, double dval, char *pval);
 size_t pk_encode_size (sqlite3_value **argv, int argc, int reserved);
+size_t pk_encode_integer_size (int64_t value);
+size_t pk_encode_integer (char *buffer, size_t bseek, int64_t value);
+size_t pk_encode_text_size (size_t len);
+size_t pk_encode_text (char *buffer, size_t bseek, const char *text, size_t len);
 
 #endif
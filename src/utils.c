@@ -280,6 +280,97 @@ uint64_t fnv1a_hash (const char *data, size_t len) {
     
     return h_final;
 }
+
+uint64_t cloudsync_hash_bytes (const char *data, size_t len) {
+    // plain FNV-1a, suitable for binary keys (primary keys, site_id)
+    uint64_t h = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)data[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+uint64_t cloudsync_hash_nocase (const char *str) {
+    // FNV-1a of the lowercase string, consistent with strcasecmp
+    uint64_t h = FNV_OFFSET_BASIS;
+    for (; *str; ++str) {
+        h ^= (uint8_t)tolower((unsigned char)*str);
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+// MARK: - Arena -
+
+struct cloudsync_arena_chunk {
+    cloudsync_arena_chunk   *next;
+    size_t                  size;               // capacity of data
+    size_t                  used;
+    char                    data[];
+};
+
+void *cloudsync_arena_alloc (cloudsync_arena *arena, size_t size) {
+    // 8 bytes alignment, so that the returned buffers can hold any scalar type
+    size = (size + 7) & ~(size_t)7;
+    if (size == 0) size = 8;
+    
+    cloudsync_arena_chunk *chunk = arena->current;
+    if (chunk && (chunk->size - chunk->used) >= size) {
+        void *ptr = chunk->data + chunk->used;
+        chunk->used += size;
+        return ptr;
+    }
+    
+    // move to the next chunk (already allocated by a previous use of the arena) if it is large enough
+    cloudsync_arena_chunk *next = (chunk) ? chunk->next : arena->first;
+    if (!next || next->size < size) {
+        size_t capacity = (size > CLOUDSYNC_ARENA_CHUNK_SIZE) ? size : CLOUDSYNC_ARENA_CHUNK_SIZE;
+        cloudsync_arena_chunk *clone = (cloudsync_arena_chunk *)cloudsync_memory_alloc((sqlite3_uint64)(sizeof(cloudsync_arena_chunk) + capacity));
+        if (!clone) return NULL;
+        clone->size = capacity;
+        clone->next = next;
+        if (chunk) chunk->next = clone; else arena->first = clone;
+        next = clone;
+    }
+    
+    next->used = size;
+    arena->current = next;
+    return next->data;
+}
+
+void *cloudsync_arena_memdup (cloudsync_arena *arena, const void *ptr, size_t size) {
+    void *buffer = cloudsync_arena_alloc(arena, size);
+    if (buffer) memcpy(buffer, ptr, size);
+    return buffer;
+}
+
+cloudsync_arena_mark cloudsync_arena_get_mark (cloudsync_arena *arena) {
+    cloudsync_arena_mark mark = {.chunk = arena->current, .used = (arena->current) ? arena->current->used : 0};
+    return mark;
+}
+
+void cloudsync_arena_release (cloudsync_arena *arena, cloudsync_arena_mark mark) {
+    // everything allocated after the mark is released, the chunks that follow are reused by the next allocations
+    arena->current = mark.chunk;
+    if (mark.chunk) mark.chunk->used = mark.used;
+}
+
+void cloudsync_arena_reset (cloudsync_arena *arena) {
+    arena->current = NULL;
+}
+
+void cloudsync_arena_free (cloudsync_arena *arena) {
+    cloudsync_arena_chunk *chunk = arena->first;
+    while (chunk) {
+        cloudsync_arena_chunk *next = chunk->next;
+        cloudsync_memory_free(chunk);
+        chunk = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
 // MARK: - CRDT algos -
 
 table_algo crdt_algo_from_name (const char *algo_name) {
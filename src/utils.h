@@ -109,6 +109,8 @@ sqlite3_uint64 memdebug_msize (void *ptr);
 #define UUID_STR_MAXLEN                     37
 #define UUID_LEN                            16
 
+#define CLOUDSYNC_ARENA_CHUNK_SIZE          (64*1024)
+
 // The type of CRDT chosen for a table controls what rows are included or excluded when merging tables together from different databases
 typedef enum {
     table_algo_none = 0,
@@ -127,6 +129,8 @@ char *cloudsync_uuid_v7_string (char value[UUID_STR_MAXLEN], bool dash_format);
 char *cloudsync_uuid_v7_stringify (uint8_t uuid[UUID_LEN], char value[UUID_STR_MAXLEN], bool dash_format);
 char *cloudsync_string_replace_prefix(const char *input, char *prefix, char *replacement);
 uint64_t fnv1a_hash(const char *data, size_t len);
+uint64_t cloudsync_hash_bytes (const char *data, size_t len);
+uint64_t cloudsync_hash_nocase (const char *str);
 
 void *cloudsync_memory_zeroalloc (uint64_t size);
 char *cloudsync_string_ndup (const char *str, size_t len, bool lowercase);
@@ -135,4 +139,25 @@ int cloudsync_blob_compare(const char *blob1, size_t size1, const char *blob2, s
 
 void cloudsync_rowid_decode (sqlite3_int64 rowid, sqlite3_int64 *db_version, sqlite3_int64 *seq);
 
+// Bump allocator for short lived buffers: memory is released all at once (reset) or back to a mark,
+// chunks are kept for reuse until the arena is freed
+typedef struct cloudsync_arena_chunk cloudsync_arena_chunk;
+
+typedef struct {
+    cloudsync_arena_chunk   *first;
+    cloudsync_arena_chunk   *current;
+} cloudsync_arena;
+
+typedef struct {
+    cloudsync_arena_chunk   *chunk;
+    size_t                  used;
+} cloudsync_arena_mark;
+
+void *cloudsync_arena_alloc (cloudsync_arena *arena, size_t size);
+void *cloudsync_arena_memdup (cloudsync_arena *arena, const void *ptr, size_t size);
+cloudsync_arena_mark cloudsync_arena_get_mark (cloudsync_arena *arena);
+void cloudsync_arena_release (cloudsync_arena *arena, cloudsync_arena_mark mark);
+void cloudsync_arena_reset (cloudsync_arena *arena);
+void cloudsync_arena_free (cloudsync_arena *arena);
+
 #endif
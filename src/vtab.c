@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "vtab.h"
+#include "pk.h"
 #include "utils.h"
 #include "dbutils.h"
 #include "cloudsync.h"
@@ -16,16 +17,79 @@
 SQLITE_EXTENSION_INIT3
 #endif
 
+#define CLOUDSYNC_CHANGES_CACHE_SIZE    8
+
+// a source is the stream of changes of a single <table>_cloudsync meta table
+typedef struct {
+    char                    *table;     // table name (without the _cloudsync suffix)
+    sqlite3_stmt            *vm;        // changes statement, ordered by db_version, seq
+    
+    // column values of the row identified by pk (the statement is kept positioned on that row
+    // while consecutive changes share the same pk, so each row is retrieved just once)
+    sqlite3_stmt            *values_vm;
+    char                    *pk;
+    int                     pk_len;
+    int                     pk_alloc;
+    int                     values_rc;  // result of the last values_vm step (0 if not positioned)
+    int                     col_index;  // index of the current col_name in values_vm (-1 for the tombstone)
+} cloudsync_changes_source;
+
+// a plan contains one source for each <table>_cloudsync meta table
+// all the statements share the same constraints (idxs) and are ordered by db_version, seq
+typedef struct {
+    char                    *idxs;      // idxStr used as cache key
+    bool                    colvalue;   // true if col_value is computed (part of the cache key)
+    int                     count;      // number of meta tables (and sources)
+    int                     alloc;
+    cloudsync_changes_source *sources;
+    bool                    inuse;      // true if the plan is currently owned by a cursor
+    sqlite3_uint64          tick;       // last time the plan has been used (for LRU eviction)
+} cloudsync_changes_plan;
+
 typedef struct cloudsync_changes_vtab {
     sqlite3_vtab            base;       // base class, must be first
     sqlite3                 *db;
     void                    *aux;
+    
+    // prepared plans cache (invalidated each time schema_version changes)
+    sqlite3_stmt            *schema_version_stmt;
+    sqlite3_int64           schema_version;
+    sqlite3_uint64          cache_tick;
+    cloudsync_changes_plan  *cache[CLOUDSYNC_CHANGES_CACHE_SIZE];
 } cloudsync_changes_vtab;
 
+typedef struct {
+    sqlite3_int64           db_version;
+    sqlite3_int64           seq;
+} cloudsync_changes_key;
+
+// constraints collected in xBestIndex and used to estimate cost and rows
+typedef struct {
+    bool                    dbversion;          // at least one db_version constraint
+    bool                    dbversion_eq;       // db_version = ? (value unknown or known)
+    bool                    dbversion_range;    // db_version range with an unknown bound
+    sqlite3_int64           lower;              // known inclusive db_version bounds
+    sqlite3_int64           upper;
+    bool                    siteid_eq;
+    bool                    siteid_other;
+    bool                    tbl;                // tbl constraint pushed down
+    bool                    tbl_in;
+    const char              *tbl_name;          // tbl value (if known at prepare time)
+    bool                    colvalue;
+} cloudsync_changes_estimate;
+
 typedef struct cloudsync_changes_cursor {
     sqlite3_vtab_cursor     base;       // base class, must be first
     cloudsync_changes_vtab  *vtab;
-    sqlite3_stmt            *vm;        // prepared statement
+    cloudsync_changes_plan  *plan;      // plan currently used by the cursor
+    sqlite3_stmt            *vm;        // statement positioned on the current row (top of the heap)
+    
+    // k-way merge of the per-table statements on (db_version, seq)
+    int                     *heap;      // min-heap of indexes into plan->sources
+    cloudsync_changes_key   *keys;      // current (db_version, seq) for each source in plan->sources
+    bool                    *selected;  // sources named by the tbl constraint (if any)
+    int                     heap_count;
+    int                     heap_alloc;
 } cloudsync_changes_cursor;
 
 char *cloudsync_changes_columns[] = {"tbl", "pk", "col_name", "col_value", "col_version", "db_version", "site_id", "cl", "seq"};
@@ -40,6 +104,16 @@ char *cloudsync_changes_columns[] = {"tbl", "pk", "col_name", "col_value", "col_
 #define COL_CL_INDEX                7
 #define COL_SEQ_INDEX               8
 
+// idxNum layout
+#define IDXNUM_DBVERSION            2           // db_version constraint is present
+#define IDXNUM_SITEID               4           // site_id constraint is present
+#define IDXNUM_LOWER_INCLUSIVE      8           // db_version lower bound is inclusive (>= or =)
+#define IDXNUM_NO_COLVALUE          16          // col_value is not referenced by the statement
+#define IDXNUM_TBL                  32          // tbl = constraint is present (always bound to the last argv)
+#define IDXNUM_TBL_IN               64          // tbl constraint is an IN list processed all at once
+#define IDXNUM_LOWER_SHIFT          8           // argv index (1-based) of the db_version lower bound
+#define IDXNUM_LOWER_MASK           0xFF
+
 #if CLOUDSYNC_UNITTEST
 bool force_vtab_filter_abort = false;
 #define CHECK_VFILTERTEST_ABORT()   if (force_vtab_filter_abort) rc = SQLITE_ERROR
@@ -88,100 +162,448 @@ int colname_is_legal (const char *name) {
     return 0;
 }
 
-char *build_changes_sql (sqlite3 *db, const char *idxs) {
+char *build_changes_sql (const char *table_meta, const char *idxs) {
     DEBUG_VTAB("build_changes_sql");
     
     /*
-     * This SQLite query dynamically generates and executes a consolidated query
-     * to fetch changes from all tables related to cloud synchronization.
-     *
-     * It works in the following steps:
+     * This function builds the query used to fetch changes from a single
+     * cloud synchronization meta table (the <table>_cloudsync table).
      *
-     * 1. `table_names` CTE: Retrieves all table names in the database that end
-     *    with '_cloudsync' and extracts the base table name (without the '_cloudsync' suffix).
-     *
-     * 2. `changes_query` CTE: Constructs individual SELECT statements for each
-     *    cloud sync table, fetching data about changes in columns:
+     * The inner SELECT fetches data about changes in columns:
+     *      - `tbl`: Name of the augmented table.
      *      - `pk`: Primary key of the table.
      *      - `col_name`: Name of the changed column.
+     *      - `col_value`: Always NULL, the value is retrieved by the cursor (see below).
      *      - `col_version`: Version of the changed column.
      *      - `db_version`: Database version when the change was recorded.
-     *      - `site_id`: Site identifier associated with the change.
+     *      - `site_ord`: Index of the site identifier associated with the change (rowid in `cloudsync_site_id`).
+     *      - `site_id`: Site identifier, only evaluated when referenced by the idxs WHERE clause.
      *      - `cl`: Coalesced version (either `t2.col_version` or 1 if `t2.col_version` is NULL).
      *      - `seq`: Sequence number of the change.
-     *    Each query is constructed by joining the table with `cloudsync_site_id`
-     *    for resolving the site ID and performing a LEFT JOIN with itself to
-     *    identify columns with NULL values in `t2.col_name`.
-     *
-     * 3. `union_query` CTE: Combines all the constructed SELECT statements
-     *    from `changes_query` into a single query using `UNION ALL`.
+     * The meta table is joined with itself (LEFT JOIN) to retrieve the causal length from the tombstone row.
+     * There is no join with `cloudsync_site_id`: the cursor maps `site_ord` back to the site identifier
+     * using the in-memory site_id dictionary of the context.
      *
-     * 4. `final_query` CTE: Wraps the combined UNION ALL query into another
-     *    SELECT statement, preparing for additional filtering.
+     * The outer SELECT applies the dynamic idxs WHERE clause built in xBestIndex and
+     * orders the results by `db_version` and `seq`, so the `<table>_cloudsync_db_idx`
+     * index can be walked directly.
      *
-     * 5. Final SELECT: Adds a WHERE clause to filter records with `db_version`
-     *    greater than a specified value (using a placeholder `?`), and orders
-     *    the results by `db_version` and `seq`.
+     * One statement is prepared for each meta table and the cursor merges them in C
+     * (k-way merge on `db_version`, `seq`), so there is no need to materialize and sort
+     * a UNION ALL of all the meta tables before returning the first row.
      *
-     * The overall result is a consolidated view of changes across all
-     * cloud sync tables, filtered and ordered based on the `db_version` and
-     * `seq` fields.
+     * Column values are not computed here: when `col_value` is referenced by the statement
+     * the cursor retrieves the whole augmented row once (with the same query used by
+     * real_col_values_stmt) and serves all the changed columns of that pk from it.
+     * Rows not visible in the augmented table (RLS restricted) are skipped by the cursor.
      */
     
-    const char *query =
-    "WITH table_names AS ( "
-    "    SELECT format('%q',SUBSTR(tbl_name, 1, LENGTH(tbl_name) - 10)) AS table_name_literal, format('%w',SUBSTR(tbl_name, 1, LENGTH(tbl_name) - 10)) AS table_name_identifier, format('%w',tbl_name) AS table_meta "
-    "    FROM sqlite_master "
-    "    WHERE type = 'table' AND tbl_name LIKE '%_cloudsync' "
-    "), "
-    "changes_query AS ( "
-    "    SELECT "
-    "        'SELECT "
-    "        ''' || \"table_name_literal\" || ''' AS tbl, "
-    "        t1.pk AS pk, "
-    "        t1.col_name AS col_name, "
-    "        cloudsync_col_value(''' || \"table_name_literal\" || ''', t1.col_name, t1.pk) AS col_value, "
-    "        t1.col_version AS col_version, "
-    "        t1.db_version AS db_version, "
-    "        site_tbl.site_id AS site_id, "
-    "        t1.seq AS seq, "
-    "        COALESCE(t2.col_version, 1) AS cl "
-    "     FROM \"' || \"table_meta\" || '\" AS t1 "
-    "     LEFT JOIN cloudsync_site_id AS site_tbl ON t1.site_id = site_tbl.rowid "
-    "     LEFT JOIN \"' || \"table_meta\" || '\" AS t2 ON t1.pk = t2.pk AND t2.col_name = ''" CLOUDSYNC_TOMBSTONE_VALUE "'' "
-    "     WHERE col_value IS NOT ''" CLOUDSYNC_RLS_RESTRICTED_VALUE "''' "
-    "    AS query_string FROM table_names "
-    "), "
-    "union_query AS ( "
-    "    SELECT GROUP_CONCAT(query_string, ' UNION ALL ') AS union_query FROM changes_query "
-    "), "
-    "final_query AS ( "
-    "    SELECT "
-    "        'SELECT tbl, pk, col_name, col_value, col_version, db_version, site_id, cl, seq FROM (' || union_query || ')' "
-    "    AS final_string FROM union_query "
-    ") "
-    "SELECT concat(final_string, ' ";
-    const char *final_query = ";') FROM final_query;";
-    
-    static size_t query_len = 0;
-    static size_t final_query_len = 0;
-    if (query_len == 0) query_len = strlen(query);
-    if (final_query_len == 0) final_query_len = strlen(final_query);
-    
-    size_t idx_len = strlen(idxs);
-    size_t blen = query_len + idx_len + final_query_len + 128;
-    char *sql = (char *)cloudsync_memory_alloc((sqlite3_uint64)blen);
-    if (!sql) return NULL;
-    
-    // build final sql statement taking in account the dynamic idxs string provided by the user
-    memcpy(sql, query, query_len);
-    memcpy(sql + (query_len), idxs, idx_len);
-    memcpy(sql + (query_len + idx_len), final_query, final_query_len+1);
-        
-    char *value = dbutils_text_select(db, sql);
+    size_t meta_len = strlen(table_meta);
+    size_t suffix_len = strlen("_cloudsync");
+    if (meta_len <= suffix_len) return NULL;
+    int table_len = (int)(meta_len - suffix_len);
+    
+    return cloudsync_memory_mprintf("SELECT tbl, pk, col_name, col_value, col_version, db_version, site_ord, cl, seq FROM ("
+                                    "SELECT '%.*q' AS tbl, t1.pk AS pk, t1.col_name AS col_name, NULL AS col_value, "
+                                    "t1.col_version AS col_version, t1.db_version AS db_version, t1.site_id AS site_ord, "
+                                    "(SELECT site_id FROM cloudsync_site_id WHERE rowid = t1.site_id) AS site_id, "
+                                    "t1.seq AS seq, COALESCE(t2.col_version, 1) AS cl "
+                                    "FROM \"%w\" AS t1 "
+                                    "LEFT JOIN \"%w\" AS t2 ON t1.pk = t2.pk AND t2.col_name = '" CLOUDSYNC_TOMBSTONE_VALUE "'"
+                                    ") %s ORDER BY db_version, seq ASC;", table_len, table_meta, table_meta, table_meta, idxs);
+}
+
+// MARK: - Plans Cache -
+
+void vtab_plan_free (cloudsync_changes_plan *plan) {
+    if (!plan) return;
+    
+    for (int i=0; i<plan->count; ++i) {
+        cloudsync_changes_source *source = &plan->sources[i];
+        if (source->vm) sqlite3_finalize(source->vm);
+        if (source->values_vm) sqlite3_finalize(source->values_vm);
+        if (source->table) cloudsync_memory_free(source->table);
+        if (source->pk) cloudsync_memory_free(source->pk);
+    }
+    if (plan->sources) cloudsync_memory_free(plan->sources);
+    if (plan->idxs) cloudsync_memory_free(plan->idxs);
+    cloudsync_memory_free(plan);
+}
+
+int vtab_plan_add (cloudsync_changes_plan *plan, sqlite3 *db, cloudsync_context *data, const char *table_meta) {
+    if (plan->count >= plan->alloc) {
+        int new_alloc = (plan->alloc == 0) ? 16 : plan->alloc * 2;
+        cloudsync_changes_source *sources = (cloudsync_changes_source *)cloudsync_memory_realloc(plan->sources, (sqlite3_uint64)(new_alloc * sizeof(cloudsync_changes_source)));
+        if (!sources) return SQLITE_NOMEM;
+        plan->sources = sources;
+        plan->alloc = new_alloc;
+    }
+    
+    cloudsync_changes_source *source = &plan->sources[plan->count];
+    memset(source, 0, sizeof(cloudsync_changes_source));
+    
+    char *sql = build_changes_sql(table_meta, plan->idxs);
+    if (!sql) return SQLITE_NOMEM;
+    DEBUG_SQL("vtab_plan_add: %s", sql);
+    
+    int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &source->vm, NULL);
     cloudsync_memory_free(sql);
+    if (rc != SQLITE_OK) goto abort_add;
+    
+    source->table = cloudsync_string_ndup(table_meta, strlen(table_meta) - strlen("_cloudsync"), false);
+    if (!source->table) {rc = SQLITE_NOMEM; goto abort_add;}
+    
+    // the values statement is private to the plan because it is kept positioned between two xNext calls
+    // (a table with no augmented context or without non primary key columns has no values statement)
+    const char *values_sql = (plan->colvalue) ? cloudsync_table_values_sql(data, source->table) : NULL;
+    if (values_sql) {
+        rc = sqlite3_prepare_v3(db, values_sql, -1, SQLITE_PREPARE_PERSISTENT, &source->values_vm, NULL);
+        if (rc != SQLITE_OK) goto abort_add;
+    }
+    
+    plan->count++;
+    return SQLITE_OK;
     
-    return value;
+abort_add:
+    if (source->vm) sqlite3_finalize(source->vm);
+    if (source->values_vm) sqlite3_finalize(source->values_vm);
+    if (source->table) cloudsync_memory_free(source->table);
+    memset(source, 0, sizeof(cloudsync_changes_source));
+    return rc;
+}
+
+cloudsync_changes_plan *vtab_plan_create (sqlite3 *db, cloudsync_context *data, const char *idxs, bool colvalue, int *rc) {
+    cloudsync_changes_plan *plan = (cloudsync_changes_plan *)cloudsync_memory_zeroalloc(sizeof(cloudsync_changes_plan));
+    if (!plan) {*rc = SQLITE_NOMEM; return NULL;}
+    plan->colvalue = colvalue;
+    
+    sqlite3_stmt *vm = NULL;
+    plan->idxs = cloudsync_string_dup(idxs, false);
+    if (!plan->idxs) {*rc = SQLITE_NOMEM; goto abort_plan;}
+    
+    // retrieve all the meta tables and prepare one statement for each of them
+    const char *sql = "SELECT tbl_name FROM sqlite_master WHERE type = 'table' AND tbl_name LIKE '%_cloudsync' ORDER BY tbl_name;";
+    *rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (*rc != SQLITE_OK) goto abort_plan;
+    
+    while ((*rc = sqlite3_step(vm)) == SQLITE_ROW) {
+        const char *table_meta = (const char *)sqlite3_column_text(vm, 0);
+        if (!table_meta) continue;
+        
+        *rc = vtab_plan_add(plan, db, data, table_meta);
+        if (*rc != SQLITE_OK) goto abort_plan;
+    }
+    if (*rc != SQLITE_DONE) goto abort_plan;
+    
+    sqlite3_finalize(vm);
+    *rc = SQLITE_OK;
+    return plan;
+    
+abort_plan:
+    if (vm) sqlite3_finalize(vm);
+    vtab_plan_free(plan);
+    return NULL;
+}
+
+void vtab_cache_clear (cloudsync_changes_vtab *vtab) {
+    for (int i=0; i<CLOUDSYNC_CHANGES_CACHE_SIZE; ++i) {
+        cloudsync_changes_plan *plan = vtab->cache[i];
+        
+        // a plan currently owned by a cursor is not freed here,
+        // it is detached from the cache and the cursor will free it on release
+        if (plan && !plan->inuse) vtab_plan_free(plan);
+        vtab->cache[i] = NULL;
+    }
+}
+
+int vtab_cache_check_schema (cloudsync_changes_vtab *vtab) {
+    // the generated plans depend on the list of the *_cloudsync tables in sqlite_master
+    // so the cache must be invalidated each time the schema changes
+    if (vtab->schema_version_stmt == NULL) {
+        int rc = sqlite3_prepare_v3(vtab->db, "PRAGMA schema_version;", -1, SQLITE_PREPARE_PERSISTENT, &vtab->schema_version_stmt, NULL);
+        if (rc != SQLITE_OK) return rc;
+    }
+    
+    int rc = sqlite3_step(vtab->schema_version_stmt);
+    if (rc != SQLITE_ROW) {
+        sqlite3_reset(vtab->schema_version_stmt);
+        return (rc == SQLITE_DONE) ? SQLITE_ERROR : rc;
+    }
+    
+    sqlite3_int64 version = sqlite3_column_int64(vtab->schema_version_stmt, 0);
+    sqlite3_reset(vtab->schema_version_stmt);
+    
+    if (version != vtab->schema_version) {
+        DEBUG_VTAB("vtab_cache_check_schema: schema changed from %lld to %lld", vtab->schema_version, version);
+        vtab_cache_clear(vtab);
+        vtab->schema_version = version;
+    }
+    
+    return SQLITE_OK;
+}
+
+cloudsync_changes_plan *vtab_cache_lookup (cloudsync_changes_vtab *vtab, const char *idxs, bool colvalue) {
+    for (int i=0; i<CLOUDSYNC_CHANGES_CACHE_SIZE; ++i) {
+        cloudsync_changes_plan *plan = vtab->cache[i];
+        if (plan == NULL || plan->inuse) continue;
+        if (plan->colvalue != colvalue || strcmp(plan->idxs, idxs) != 0) continue;
+        
+        plan->inuse = true;
+        plan->tick = ++vtab->cache_tick;
+        return plan;
+    }
+    return NULL;
+}
+
+void vtab_cache_add (cloudsync_changes_vtab *vtab, cloudsync_changes_plan *plan) {
+    plan->inuse = true;
+    plan->tick = ++vtab->cache_tick;
+    
+    // find an empty slot or the least recently used one not currently owned by a cursor
+    int slot = -1;
+    for (int i=0; i<CLOUDSYNC_CHANGES_CACHE_SIZE; ++i) {
+        cloudsync_changes_plan *entry = vtab->cache[i];
+        if (entry == NULL) {slot = i; break;}
+        if (entry->inuse) continue;
+        if (slot == -1 || entry->tick < vtab->cache[slot]->tick) slot = i;
+    }
+    
+    // cache is full and all the plans are in use, so the plan will be freed by the cursor
+    if (slot == -1) return;
+    
+    if (vtab->cache[slot]) vtab_plan_free(vtab->cache[slot]);
+    vtab->cache[slot] = plan;
+}
+
+void vtab_cache_release (cloudsync_changes_vtab *vtab, cloudsync_changes_plan *plan) {
+    if (!plan) return;
+    
+    // give the plan back to the cache, if it does not belong to the cache then free it
+    for (int i=0; i<CLOUDSYNC_CHANGES_CACHE_SIZE; ++i) {
+        if (vtab->cache[i] != plan) continue;
+        
+        for (int j=0; j<plan->count; ++j) {
+            cloudsync_changes_source *source = &plan->sources[j];
+            sqlite3_reset(source->vm);
+            sqlite3_clear_bindings(source->vm);
+            if (source->values_vm) sqlite3_reset(source->values_vm);
+            source->values_rc = 0;
+            source->pk_len = 0;
+        }
+        plan->inuse = false;
+        return;
+    }
+    
+    vtab_plan_free(plan);
+}
+
+void cloudsync_vtab_reset_cache (sqlite3_vtab *vtab) {
+    if (!vtab) return;
+    
+    cloudsync_changes_vtab *p = (cloudsync_changes_vtab *)vtab;
+    vtab_cache_clear(p);
+    if (p->schema_version_stmt) sqlite3_finalize(p->schema_version_stmt);
+    p->schema_version_stmt = NULL;
+    p->schema_version = 0;
+}
+
+// MARK: - Merge Heap -
+
+static inline bool vtab_heap_less (cloudsync_changes_cursor *c, int i1, int i2) {
+    cloudsync_changes_key *k1 = &c->keys[i1];
+    cloudsync_changes_key *k2 = &c->keys[i2];
+    
+    if (k1->db_version != k2->db_version) return (k1->db_version < k2->db_version);
+    if (k1->seq != k2->seq) return (k1->seq < k2->seq);
+    
+    // use the meta table index to have a deterministic order
+    return (i1 < i2);
+}
+
+void vtab_heap_sift_down (cloudsync_changes_cursor *c, int index) {
+    int count = c->heap_count;
+    int *heap = c->heap;
+    
+    while (1) {
+        int left = (index * 2) + 1;
+        if (left >= count) break;
+        
+        int right = left + 1;
+        int child = (right < count && vtab_heap_less(c, heap[right], heap[left])) ? right : left;
+        if (!vtab_heap_less(c, heap[child], heap[index])) break;
+        
+        int temp = heap[index];
+        heap[index] = heap[child];
+        heap[child] = temp;
+        index = child;
+    }
+}
+
+void vtab_heap_sift_up (cloudsync_changes_cursor *c, int index) {
+    int *heap = c->heap;
+    
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!vtab_heap_less(c, heap[index], heap[parent])) break;
+        
+        int temp = heap[index];
+        heap[index] = heap[parent];
+        heap[parent] = temp;
+        index = parent;
+    }
+}
+
+void vtab_heap_load_key (cloudsync_changes_cursor *c, int index) {
+    sqlite3_stmt *vm = c->plan->sources[index].vm;
+    c->keys[index].db_version = sqlite3_column_int64(vm, COL_DBVERSION_INDEX);
+    c->keys[index].seq = sqlite3_column_int64(vm, COL_SEQ_INDEX);
+}
+
+void vtab_heap_push (cloudsync_changes_cursor *c, int index) {
+    vtab_heap_load_key(c, index);
+    c->heap[c->heap_count] = index;
+    vtab_heap_sift_up(c, c->heap_count++);
+}
+
+int vtab_heap_reserve (cloudsync_changes_cursor *c, int count) {
+    if (count <= c->heap_alloc) return SQLITE_OK;
+    
+    int *heap = (int *)cloudsync_memory_realloc(c->heap, (sqlite3_uint64)(count * sizeof(int)));
+    if (!heap) return SQLITE_NOMEM;
+    c->heap = heap;
+    
+    cloudsync_changes_key *keys = (cloudsync_changes_key *)cloudsync_memory_realloc(c->keys, (sqlite3_uint64)(count * sizeof(cloudsync_changes_key)));
+    if (!keys) return SQLITE_NOMEM;
+    c->keys = keys;
+    
+    bool *selected = (bool *)cloudsync_memory_realloc(c->selected, (sqlite3_uint64)(count * sizeof(bool)));
+    if (!selected) return SQLITE_NOMEM;
+    c->selected = selected;
+    
+    c->heap_alloc = count;
+    return SQLITE_OK;
+}
+
+// MARK: - Sources -
+
+void vtab_source_select (cloudsync_changes_cursor *c, sqlite3_value *value) {
+    // mark the source whose table name matches value (tbl is declared TEXT, so numeric values compare as text)
+    int type = sqlite3_value_type(value);
+    if (type == SQLITE_NULL || type == SQLITE_BLOB) return;
+    
+    const char *name = (const char *)sqlite3_value_text(value);
+    if (!name) return;
+    
+    cloudsync_changes_plan *plan = c->plan;
+    for (int i=0; i<plan->count; ++i) {
+        if (strcmp(plan->sources[i].table, name) == 0) {
+            c->selected[i] = true;
+            return;
+        }
+    }
+}
+
+int vtab_source_select_all (cloudsync_changes_cursor *c, sqlite3_value *value, bool is_in) {
+    memset(c->selected, 0, (size_t)c->plan->count * sizeof(bool));
+    if (!is_in) {
+        vtab_source_select(c, value);
+        return SQLITE_OK;
+    }
+    
+    // IN list processed all at once
+    sqlite3_value *item = NULL;
+    int rc = sqlite3_vtab_in_first(value, &item);
+    while (rc == SQLITE_OK && item) {
+        vtab_source_select(c, item);
+        rc = sqlite3_vtab_in_next(value, &item);
+    }
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+int vtab_source_load_values (cloudsync_changes_vtab *vtab, cloudsync_changes_source *source, bool *visible) {
+    sqlite3_stmt *vm = source->vm;
+    const char *col_name = (const char *)sqlite3_column_text(vm, COL_NAME_INDEX);
+    
+    // tombstone rows have no value
+    if (col_name && strcmp(col_name, CLOUDSYNC_TOMBSTONE_VALUE) == 0) {
+        source->col_index = -1;
+        *visible = true;
+        return SQLITE_OK;
+    }
+    
+    sqlite3_stmt *values_vm = source->values_vm;
+    if (!values_vm || !col_name) {
+        return cloudsync_vtab_set_error((sqlite3_vtab *)vtab, "Unable to retrieve column value precompiled statement for table %s.", source->table);
+    }
+    
+    // retrieve the augmented row only if pk changed since the previous change
+    const char *pk = (const char *)sqlite3_column_blob(vm, COL_PK_INDEX);
+    int pk_len = sqlite3_column_bytes(vm, COL_PK_INDEX);
+    bool same_pk = (source->values_rc != 0 && source->pk_len == pk_len && memcmp(source->pk, pk, (size_t)pk_len) == 0);
+    
+    if (!same_pk) {
+        if (pk_len > source->pk_alloc) {
+            char *buffer = (char *)cloudsync_memory_realloc(source->pk, (sqlite3_uint64)pk_len);
+            if (!buffer) return SQLITE_NOMEM;
+            source->pk = buffer;
+            source->pk_alloc = pk_len;
+        }
+        memcpy(source->pk, pk, (size_t)pk_len);
+        source->pk_len = pk_len;
+        source->values_rc = 0;
+        
+        sqlite3_reset(values_vm);
+        int rc = pk_decode_prikey(source->pk, (size_t)pk_len, pk_decode_bind_callback, (void *)values_vm);
+        if (rc < 0) return sqlite3_errcode(vtab->db);
+        
+        rc = sqlite3_step(values_vm);
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE) return rc;
+        source->values_rc = rc;
+    }
+    
+    // a change whose row cannot be retrieved from the augmented table is RLS restricted
+    if (source->values_rc == SQLITE_DONE) {
+        *visible = false;
+        return SQLITE_OK;
+    }
+    
+    // values_vm lists the columns in the same order of the table context, so the index comes from its hash
+    // (the names are scanned only if the table is not loaded in the context)
+    int ncols = sqlite3_column_count(values_vm);
+    int index = cloudsync_table_column_index((cloudsync_context *)vtab->aux, source->table, col_name);
+    for (int i=0; i<ncols && index < 0; ++i) {
+        if (strcasecmp(sqlite3_column_name(values_vm, i), col_name) == 0) index = i;
+    }
+    
+    if (index >= 0 && index < ncols) {
+        source->col_index = index;
+        *visible = true;
+        return SQLITE_OK;
+    }
+    
+    return cloudsync_vtab_set_error((sqlite3_vtab *)vtab, "Unable to retrieve column value precompiled statement for column %s.", col_name);
+}
+
+int vtab_source_step (cloudsync_changes_vtab *vtab, cloudsync_changes_plan *plan, int index) {
+    // advance the source to its next visible change and return SQLITE_ROW, SQLITE_DONE or an error code
+    cloudsync_changes_source *source = &plan->sources[index];
+    
+    while (1) {
+        int rc = sqlite3_step(source->vm);
+        if (rc != SQLITE_ROW || !plan->colvalue) return rc;
+        
+        bool visible = false;
+        rc = vtab_source_load_values(vtab, source, &visible);
+        if (rc != SQLITE_OK) return rc;
+        if (visible) return SQLITE_ROW;
+    }
+}
+
+void vtab_cursor_reset (cloudsync_changes_cursor *c) {
+    vtab_cache_release(c->vtab, c->plan);
+    c->plan = NULL;
+    c->vm = NULL;
+    c->heap_count = 0;
 }
 
 // MARK: -
@@ -200,6 +622,7 @@ int cloudsync_changesvtab_connect (sqlite3 *db, void *aux, int argc, const char
         memset(vnew, 0, sizeof(cloudsync_changes_vtab));
         vnew->db = db;
         vnew->aux = aux;
+        cloudsync_set_changes_vtab((cloudsync_context *)aux, (sqlite3_vtab *)vnew);
         
         *vtab = (sqlite3_vtab *)vnew;
     }
@@ -211,6 +634,8 @@ int cloudsync_changesvtab_disconnect (sqlite3_vtab *vtab) {
     DEBUG_VTAB("cloudsync_changesvtab_disconnect");
     
     cloudsync_changes_vtab *p = (cloudsync_changes_vtab *)vtab;
+    cloudsync_set_changes_vtab((cloudsync_context *)p->aux, NULL);
+    cloudsync_vtab_reset_cache(vtab);
     sqlite3_free(p);
     return SQLITE_OK;
 }
@@ -232,15 +657,127 @@ int cloudsync_changesvtab_close (sqlite3_vtab_cursor *cursor) {
     DEBUG_VTAB("cloudsync_changesvtab_close");
     
     cloudsync_changes_cursor *c = (cloudsync_changes_cursor *)cursor;
-    if (c->vm) {
-        sqlite3_finalize(c->vm);
-        c->vm = NULL;
-    }
+    vtab_cursor_reset(c);
     
+    if (c->heap) cloudsync_memory_free(c->heap);
+    if (c->keys) cloudsync_memory_free(c->keys);
+    if (c->selected) cloudsync_memory_free(c->selected);
     cloudsync_memory_free(cursor);
     return SQLITE_OK;
 }
 
+void vtab_estimate_add_constraint (cloudsync_changes_estimate *e, sqlite3_index_info *idxinfo, int i) {
+    struct sqlite3_index_constraint *constraint = &idxinfo->aConstraint[i];
+    int idx = constraint->iColumn;
+    uint8_t op = constraint->op;
+    
+    // right-hand side is available only when it is a constant expression
+    sqlite3_value *value = NULL;
+    if (sqlite3_vtab_rhs_value(idxinfo, i, &value) != SQLITE_OK) value = NULL;
+    
+    if (idx == COL_DBVERSION_INDEX) {
+        bool known = (value && sqlite3_value_type(value) == SQLITE_INTEGER);
+        sqlite3_int64 v = (known) ? sqlite3_value_int64(value) : 0;
+        e->dbversion = true;
+        switch (op) {
+            case SQLITE_INDEX_CONSTRAINT_EQ:
+                e->dbversion_eq = true;
+                if (known) {if (v > e->lower) e->lower = v; if (v < e->upper) e->upper = v;}
+                break;
+            case SQLITE_INDEX_CONSTRAINT_GT: if (known) {if (v + 1 > e->lower) e->lower = v + 1;} else e->dbversion_range = true; break;
+            case SQLITE_INDEX_CONSTRAINT_GE: if (known) {if (v > e->lower) e->lower = v;} else e->dbversion_range = true; break;
+            case SQLITE_INDEX_CONSTRAINT_LT: if (known) {if (v - 1 < e->upper) e->upper = v - 1;} else e->dbversion_range = true; break;
+            case SQLITE_INDEX_CONSTRAINT_LE: if (known) {if (v < e->upper) e->upper = v;} else e->dbversion_range = true; break;
+            default: break;
+        }
+    } else if (idx == COL_SITEID_INDEX) {
+        if (op == SQLITE_INDEX_CONSTRAINT_EQ) e->siteid_eq = true;
+        else if (op != SQLITE_INDEX_CONSTRAINT_ISNOTNULL) e->siteid_other = true;
+    } else if (idx == COL_TBL_INDEX && value && sqlite3_value_type(value) == SQLITE_TEXT) {
+        e->tbl_name = (const char *)sqlite3_value_text(value);
+    }
+}
+
+bool vtab_estimate_compute (cloudsync_changes_vtab *vtab, cloudsync_changes_estimate *e, double *cost, sqlite3_int64 *rows) {
+    // estimate rows from the per-table meta row counts and the db_version high-water marks
+    // (db_version values are assumed to be uniformly distributed in the [0, max_db_version] range)
+    cloudsync_context *data = (cloudsync_context *)vtab->aux;
+    cloudsync_context_validate_caches(data);
+    
+    int ntables = cloudsync_tables_count(data);
+    int nstats = 0;
+    double scanned = 0.0;
+    for (int i=0; i<ntables; ++i) {
+        const char *name = NULL;
+        sqlite3_int64 nrows = 0, max_db_version = 0;
+        if (!cloudsync_table_stats(data, i, &name, &nrows, &max_db_version)) continue;
+        ++nstats;
+        
+        if (e->tbl && e->tbl_name && strcasecmp(e->tbl_name, name) != 0) continue;
+        if (nrows == 0) continue;
+        
+        double fraction = 1.0;
+        if (e->dbversion) {
+            double distinct = (max_db_version > 0) ? (double)max_db_version + 1.0 : 1.0;
+            sqlite3_int64 hi = (e->upper < max_db_version) ? e->upper : max_db_version;
+            sqlite3_int64 lo = (e->lower > 0) ? e->lower : 0;
+            if (hi < lo) fraction = 0.0;
+            else if (e->dbversion_eq) fraction = 1.0 / distinct;
+            else fraction = ((double)(hi - lo) + 1.0) / distinct;
+            // a range with an unknown bound is assumed to select a quarter of the rows
+            if (e->dbversion_range) fraction *= 0.25;
+        }
+        scanned += (double)nrows * fraction;
+    }
+    if (nstats == 0) return false;
+    
+    // tbl value unknown at prepare time (or IN list): assume it selects one table (or half of the tables)
+    if (e->tbl && !e->tbl_name) {
+        double factor = (double)nstats;
+        if (e->tbl_in) factor = (factor > 2.0) ? factor / 2.0 : 1.0;
+        scanned /= factor;
+    }
+    
+    // site_id is not indexed, so it filters the scanned rows
+    double returned = scanned;
+    if (e->siteid_eq) {
+        sqlite3_int64 nsites = cloudsync_siteid_count(data);
+        if (nsites > 1) returned /= (double)nsites;
+    } else if (e->siteid_other) {
+        returned *= 0.5;
+    }
+    
+    // each returned row requires an additional lookup in the augmented table when col_value is used
+    *cost = scanned + ((e->colvalue) ? returned : 0.0) + 1.0;
+    *rows = (returned < 1.0) ? 1 : (sqlite3_int64)returned;
+    return true;
+}
+
+void vtab_estimate_default (int idxnum, double *cost, sqlite3_int64 *rows) {
+    // fallback used when no statistics are available (no augmented table loaded in the context)
+    if ((idxnum & (IDXNUM_DBVERSION | IDXNUM_SITEID)) == (IDXNUM_DBVERSION | IDXNUM_SITEID)) {
+        // both DbVrsn and SiteId constraints are present
+        // query is expected to be highly selective, returning only one row, with a very low execution cost
+        *cost = 1.0;
+        *rows = 1;
+    } else if ((idxnum & IDXNUM_DBVERSION) == IDXNUM_DBVERSION) {
+        // only DbVrsn constraint is present
+        // query is expected to return more rows (10) and take more time (cost of 10.0) than in the previous case
+        *cost = 10.0;
+        *rows = 10;
+    } else if ((idxnum & IDXNUM_SITEID) == IDXNUM_SITEID) {
+        // only SiteId constraint is present
+        // query is expected to be very inefficient, returning a large number of rows and taking a long time to execute
+        *cost = (double)INT32_MAX;
+        *rows = (sqlite3_int64)INT32_MAX;
+    } else {
+        // no constraints are present
+        // worst-case scenario, where the query returns all rows from the virtual table
+        *cost = (double)INT64_MAX;
+        *rows = (sqlite3_int64)INT64_MAX;
+    }
+}
+
 int cloudsync_changesvtab_best_index (sqlite3_vtab *vtab, sqlite3_index_info *idxinfo) {
     DEBUG_VTAB("cloudsync_changesvtab_best_index");
     
@@ -260,20 +797,21 @@ int cloudsync_changesvtab_best_index (sqlite3_vtab *vtab, sqlite3_index_info *id
     // +1 for the space
     // +1 for the ? character
     // +5 for space AND space
-    // +512 for the extra space and for the WHERE and ORDER BY literals
+    // +64 for the site_id = ? rewrite
+    // +512 for the extra space and for the WHERE literal
     
     // memory internally manager by SQLite, so I cannot use memory_alloc here
-    size_t slen = (count1 * (11 + 1 + 11 + 1 + 5)) + (count2 * 11 + 1 + 5) + 512;
+    size_t slen = (count1 * (11 + 1 + 11 + 1 + 5 + 64)) + 512;
     char *s = (char *)sqlite3_malloc64((sqlite3_uint64)slen);
     if (!s) return SQLITE_NOMEM;
     size_t sindex= 0;
+    s[0] = 0;
 
     int idxnum = 0;
     int arg_index = 1;
-    int orderconsumed = 1;
-    
-    // is there a WHERE clause ?
-    if (count1 > 0) sindex += snprintf(s+sindex, slen-sindex, "WHERE ");
+    int nwhere = 0;
+    int tbl_constraint = -1;
+    cloudsync_changes_estimate estimate = {.lower = 0, .upper = INT64_MAX};
     
     // check constraints
     for (int i=0; i < count1; ++i) {
@@ -281,20 +819,33 @@ int cloudsync_changesvtab_best_index (sqlite3_vtab *vtab, sqlite3_index_info *id
         struct sqlite3_index_constraint *constraint = &idxinfo->aConstraint[i];
         if (constraint->usable == false) continue;
         
+        // rowid is computed from db_version and seq and col_value is retrieved by the cursor, so let SQLite evaluate them
         int idx = constraint->iColumn;
+        if (idx < 0 || idx == COL_VALUE_INDEX) continue;
         uint8_t op = constraint->op;
         
-        const char *colname = (idx > 0) ? COLNAME_FROM_INDEX(idx) : "rowid";
+        // the first tbl = constraint selects the meta tables to scan, so it is not part of the WHERE clause
+        if (idx == COL_TBL_INDEX && op == SQLITE_INDEX_CONSTRAINT_EQ && tbl_constraint < 0) {
+            tbl_constraint = i;
+            continue;
+        }
+        
+        const char *colname = COLNAME_FROM_INDEX(idx);
         const char *opname = opname_from_value(op);
         if (!opname) continue;
+        vtab_estimate_add_constraint(&estimate, idxinfo, i);
         
         // build next constraint
-        if (i > 0) sindex += snprintf(s+sindex, slen-sindex, " AND ");
+        sindex += snprintf(s+sindex, slen-sindex, (nwhere++ == 0) ? "WHERE " : " AND ");
         
         // handle special case where value is not needed
         if ((op == SQLITE_INDEX_CONSTRAINT_ISNULL) || (op == SQLITE_INDEX_CONSTRAINT_ISNOTNULL)) {
             sindex += snprintf(s+sindex, slen-sindex, "%s %s", colname, opname);
             idxinfo->aConstraintUsage[i].argvIndex = 0;
+        } else if (idx == COL_SITEID_INDEX && op == SQLITE_INDEX_CONSTRAINT_EQ) {
+            // resolve the site_id once, instead of resolving the site_ord of each row
+            sindex += snprintf(s+sindex, slen-sindex, "site_ord = (SELECT rowid FROM cloudsync_site_id WHERE site_id = ?)");
+            idxinfo->aConstraintUsage[i].argvIndex = arg_index++;
         } else {
             sindex += snprintf(s+sindex, slen-sindex, "%s %s ?", colname, opname);
             idxinfo->aConstraintUsage[i].argvIndex = arg_index++;
@@ -302,26 +853,48 @@ int cloudsync_changesvtab_best_index (sqlite3_vtab *vtab, sqlite3_index_info *id
         idxinfo->aConstraintUsage[i].omit = 1;
         
         //a bitmask (idxnum) is built up based on which constraints are applied
-        if (idx == COL_DBVERSION_INDEX) idxnum |= 2;    // set bit 1
-        else if (idx == COL_SITEID_INDEX) idxnum |= 4;  // set bit 2
+        if (idx == COL_DBVERSION_INDEX) idxnum |= IDXNUM_DBVERSION;    // set bit 1
+        else if (idx == COL_SITEID_INDEX) idxnum |= IDXNUM_SITEID;     // set bit 2
+        
+        // remember the first db_version lower bound, so xFilter can skip the tables whose
+        // high-water mark is below it (only the first 255 arguments can be encoded)
+        bool is_lower_bound = (op == SQLITE_INDEX_CONSTRAINT_GT || op == SQLITE_INDEX_CONSTRAINT_GE || op == SQLITE_INDEX_CONSTRAINT_EQ);
+        int argv_index = idxinfo->aConstraintUsage[i].argvIndex;
+        if (idx == COL_DBVERSION_INDEX && is_lower_bound && argv_index <= IDXNUM_LOWER_MASK && ((idxnum >> IDXNUM_LOWER_SHIFT) & IDXNUM_LOWER_MASK) == 0) {
+            idxnum |= (argv_index << IDXNUM_LOWER_SHIFT);
+            if (op != SQLITE_INDEX_CONSTRAINT_GT) idxnum |= IDXNUM_LOWER_INCLUSIVE;
+        }
     }
     
-    // is there an ORDER BY clause ?
-    // if not use a default one
-    if (count2 > 0) sindex += snprintf(s+sindex, slen-sindex, " ORDER BY ");
-    else sindex += snprintf(s+sindex, slen-sindex, " ORDER BY db_version, seq ASC");
+    // tbl value is bound last, so the argv indexes of the WHERE clause match the statement parameters
+    if (tbl_constraint >= 0) {
+        idxinfo->aConstraintUsage[tbl_constraint].argvIndex = arg_index++;
+        idxinfo->aConstraintUsage[tbl_constraint].omit = 1;
+        idxnum |= IDXNUM_TBL;
+        
+        // tbl IN (...) is received as a list of values in xFilter
+        if (sqlite3_vtab_in(idxinfo, tbl_constraint, 1)) idxnum |= IDXNUM_TBL_IN;
+        
+        estimate.tbl = true;
+        estimate.tbl_in = ((idxnum & IDXNUM_TBL_IN) != 0);
+        if (!estimate.tbl_in) vtab_estimate_add_constraint(&estimate, idxinfo, tbl_constraint);
+    }
+    
+    // when col_value is not referenced (SELECT max(db_version), count(*), ...) there is no need
+    // to retrieve the column value from the augmented table, so the generated query is a pure meta table scan
+    if ((idxinfo->colUsed & ((sqlite3_uint64)1 << COL_VALUE_INDEX)) == 0) idxnum |= IDXNUM_NO_COLVALUE;
+    estimate.colvalue = ((idxnum & IDXNUM_NO_COLVALUE) == 0);
     
+    // rows are always returned ordered by db_version, seq (k-way merge of the meta tables)
+    // so the ORDER BY clause can be consumed only if it is a prefix of that order
+    int orderconsumed = 1;
     for (int i=0; i < count2; ++i) {
         struct sqlite3_index_orderby *orderby = &idxinfo->aOrderBy[i];
-        
-        // build next constraint
-        if (i > 0) sindex += snprintf(s+sindex, slen-sindex, ", ");
-        
-        int idx = orderby->iColumn;
-        const char *colname = COLNAME_FROM_INDEX(idx);
-        if (!colname_is_legal(colname)) orderconsumed = 0;
-        
-        sindex += snprintf(s+sindex, slen-sindex, "%s %s", colname, orderby->desc ? " DESC" : " ASC");
+        int expected = (i == 0) ? COL_DBVERSION_INDEX : COL_SEQ_INDEX;
+        if (i > 1 || orderby->iColumn != expected || orderby->desc) {
+            orderconsumed = 0;
+            break;
+        }
     }
     
     idxinfo->idxNum = idxnum;
@@ -354,28 +927,14 @@ int cloudsync_changesvtab_best_index (sqlite3_vtab *vtab, sqlite3_index_info *id
      
      */
     
-    // perform estimated cost and row count based on the constraints
-    if ((idxnum & 6) == 6) {
-        // both DbVrsn and SiteId constraints are present
-        // query is expected to be highly selective, returning only one row, with a very low execution cost
-        idxinfo->estimatedCost = 1.0;
-        idxinfo->estimatedRows = 1;
-    } else if ((idxnum & 2) == 2) {
-        // only DbVrsn constraint is present
-        // query is expected to return more rows (10) and take more time (cost of 10.0) than in the previous case
-        idxinfo->estimatedCost = 10.0;
-        idxinfo->estimatedRows = 10;
-    } else if ((idxnum & 4) == 4) {
-        // only SiteId constraint is present
-        // query is expected to be very inefficient, returning a large number of rows and taking a long time to execute
-        idxinfo->estimatedCost = (double)INT32_MAX;
-        idxinfo->estimatedRows = (sqlite3_int64)INT32_MAX;
-    } else {
-        // no constraints are present
-        // worst-case scenario, where the query returns all rows from the virtual table
-        idxinfo->estimatedCost = (double)INT64_MAX;
-        idxinfo->estimatedRows = (sqlite3_int64)INT64_MAX;
+    // perform estimated cost and row count based on the constraints and on the meta tables statistics
+    double cost = 0.0;
+    sqlite3_int64 rows = 0;
+    if (!vtab_estimate_compute((cloudsync_changes_vtab *)vtab, &estimate, &cost, &rows)) {
+        vtab_estimate_default(idxnum, &cost, &rows);
     }
+    idxinfo->estimatedCost = cost;
+    idxinfo->estimatedRows = rows;
     
     return SQLITE_OK;
 }
@@ -385,42 +944,85 @@ int cloudsync_changesvtab_filter (sqlite3_vtab_cursor *cursor, int idxn, const c
     DEBUG_VTAB("cloudsync_changesvtab_filter");
     
     cloudsync_changes_cursor *c = (cloudsync_changes_cursor *)cursor;
-    sqlite3 *db = c->vtab->db;
-    char *sql = build_changes_sql(db, idxs);
-    if (sql == NULL) return SQLITE_NOMEM;
+    cloudsync_changes_vtab *vtab = c->vtab;
+    sqlite3 *db = vtab->db;
     
     // the xFilter method may be called multiple times on the same sqlite3_vtab_cursor*
-    if (c->vm) sqlite3_finalize(c->vm);
-    c->vm = NULL;
+    vtab_cursor_reset(c);
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &c->vm, NULL);
-    cloudsync_memory_free(sql);
+    int rc = vtab_cache_check_schema(vtab);
+    if (rc != SQLITE_OK) goto abort_filter;
+    
+    // re-use an already prepared plan (if any), otherwise build and prepare a new one
+    bool colvalue = ((idxn & IDXNUM_NO_COLVALUE) == 0);
+    c->plan = vtab_cache_lookup(vtab, idxs, colvalue);
+    if (c->plan == NULL) {
+        c->plan = vtab_plan_create(db, (cloudsync_context *)vtab->aux, idxs, colvalue, &rc);
+        if (c->plan == NULL) goto abort_filter;
+        vtab_cache_add(vtab, c->plan);
+    }
+    
+    cloudsync_changes_plan *plan = c->plan;
+    rc = vtab_heap_reserve(c, plan->count);
     if (rc != SQLITE_OK) goto abort_filter;
     
-    for (int i=0; i<argc; ++i) {
-        rc = sqlite3_bind_value(c->vm, i+1, argv[i]);
+    // local changes buffered by the defer_meta setting must be in the meta tables before they are read
+    cloudsync_context *data = (cloudsync_context *)vtab->aux;
+    rc = cloudsync_deferred_flush(data);
+    if (rc != SQLITE_OK) goto abort_filter;
+    
+    // retrieve the db_version lower bound (if any) used to skip the tables that did not change
+    bool cache_valid = cloudsync_context_validate_caches(data);
+    bool has_lower = false;
+    sqlite3_int64 lower = 0;
+    int lower_index = (idxn >> IDXNUM_LOWER_SHIFT) & IDXNUM_LOWER_MASK;
+    if (lower_index > 0 && lower_index <= argc && sqlite3_value_type(argv[lower_index-1]) == SQLITE_INTEGER) {
+        has_lower = cache_valid;
+        lower = sqlite3_value_int64(argv[lower_index-1]);
+        if ((idxn & IDXNUM_LOWER_INCLUSIVE) == 0) ++lower;
+    }
+    
+    // when a tbl constraint is present, only the named meta tables are scanned (its value is always the last argv)
+    bool has_tbl = ((idxn & IDXNUM_TBL) && argc > 0);
+    int nbind = (has_tbl) ? argc - 1 : argc;
+    if (has_tbl) {
+        rc = vtab_source_select_all(c, argv[argc-1], (idxn & IDXNUM_TBL_IN) != 0);
         if (rc != SQLITE_OK) goto abort_filter;
     }
     
-    rc = sqlite3_step(c->vm);
+    // position each statement on its first row and use it to build the heap
+    for (int i=0; i<plan->count; ++i) {
+        if (has_tbl && !c->selected[i]) continue;
+        if (has_lower) {
+            // a negative value means that the high-water mark is unknown
+            sqlite3_int64 max_db_version = cloudsync_table_max_db_version(data, plan->sources[i].table);
+            if (max_db_version >= 0 && max_db_version < lower) continue;
+        }
+        
+        sqlite3_stmt *vm = plan->sources[i].vm;
+        for (int j=0; j<nbind; ++j) {
+            rc = sqlite3_bind_value(vm, j+1, argv[j]);
+            if (rc != SQLITE_OK) goto abort_filter;
+        }
+        
+        rc = vtab_source_step(vtab, plan, i);
+        if (rc == SQLITE_ROW) vtab_heap_push(c, i);
+        else if (rc != SQLITE_DONE) goto abort_filter;
+    }
+    
+    rc = SQLITE_OK;
     CHECK_VFILTERTEST_ABORT();
+    if (rc != SQLITE_OK) goto abort_filter;
     
-    if (rc == SQLITE_DONE) {
-        sqlite3_finalize(c->vm);
-        c->vm = NULL;
-    } else if (rc != SQLITE_ROW) {
-        goto abort_filter;
-    }
+    if (c->heap_count == 0) vtab_cursor_reset(c);
+    else c->vm = plan->sources[c->heap[0]].vm;
     
     return SQLITE_OK;
     
 abort_filter:
     // error condition
     DEBUG_VTAB("cloudsync_changesvtab_filter: %s\n", sqlite3_errmsg(db));
-    if (c->vm) {
-        sqlite3_finalize(c->vm);
-        c->vm = NULL;
-    }
+    vtab_cursor_reset(c);
     return rc;
 }
 
@@ -428,17 +1030,29 @@ int cloudsync_changesvtab_next (sqlite3_vtab_cursor *cursor) {
     DEBUG_VTAB("cloudsync_changesvtab_next");
     
     cloudsync_changes_cursor *c = (cloudsync_changes_cursor *)cursor;
-    int rc = sqlite3_step(c->vm);
+    int index = c->heap[0];
+    int rc = vtab_source_step(c->vtab, c->plan, index);
     
-    if (rc == SQLITE_DONE) {
-        sqlite3_finalize(c->vm);
-        c->vm = NULL;
+    if (rc == SQLITE_ROW) {
+        // top statement has a new current row, so restore the heap property
+        vtab_heap_load_key(c, index);
+        vtab_heap_sift_down(c, 0);
         rc = SQLITE_OK;
-    } else if (rc == SQLITE_ROW) {
+    } else if (rc == SQLITE_DONE) {
+        // top statement is exhausted, so remove it from the heap
+        c->heap[0] = c->heap[--c->heap_count];
+        if (c->heap_count > 0) vtab_heap_sift_down(c, 0);
         rc = SQLITE_OK;
     }
     
-    if (rc != SQLITE_OK) DEBUG_VTAB("cloudsync_changesvtab_next: %s\n", sqlite3_errmsg(c->vtab->db));
+    if (rc != SQLITE_OK) {
+        DEBUG_VTAB("cloudsync_changesvtab_next: %s\n", sqlite3_errmsg(c->vtab->db));
+        return rc;
+    }
+    
+    if (c->heap_count == 0) vtab_cursor_reset(c);
+    else c->vm = c->plan->sources[c->heap[0]].vm;
+    
     return rc;
 }
 
@@ -454,7 +1068,28 @@ int cloudsync_changesvtab_column (sqlite3_vtab_cursor *cursor, sqlite3_context *
     DEBUG_VTAB("cloudsync_changesvtab_column %d\n", col);
     
     cloudsync_changes_cursor *c = (cloudsync_changes_cursor *)cursor;
-    sqlite3_value *value = sqlite3_column_value(c->vm, col);
+    sqlite3_value *value = NULL;
+    
+    // col_value is served from the augmented row retrieved by the source
+    if (col == COL_VALUE_INDEX && c->plan->colvalue) {
+        cloudsync_changes_source *source = &c->plan->sources[c->heap[0]];
+        if (source->col_index >= 0) value = sqlite3_column_value(source->values_vm, source->col_index);
+        if (!value) {
+            sqlite3_result_null(ctx);
+            return SQLITE_OK;
+        }
+    } else if (col == COL_SITEID_INDEX) {
+        // site_id is resolved from the in-memory dictionary
+        const void *site_id = NULL;
+        if (sqlite3_column_type(c->vm, col) != SQLITE_NULL) {
+            site_id = cloudsync_siteid_from_ord(c->vtab->db, (cloudsync_context *)c->vtab->aux, sqlite3_column_int64(c->vm, col));
+        }
+        if (site_id) sqlite3_result_blob(ctx, site_id, UUID_LEN, SQLITE_TRANSIENT);
+        else sqlite3_result_null(ctx);
+        return SQLITE_OK;
+    } else {
+        value = sqlite3_column_value(c->vm, col);
+    }
     sqlite3_result_value(ctx, value);
     
     return SQLITE_OK;
@@ -464,11 +1099,10 @@ int cloudsync_changesvtab_rowid (sqlite3_vtab_cursor *cursor, sqlite3_int64 *row
     DEBUG_VTAB("cloudsync_changesvtab_rowid");
     
     cloudsync_changes_cursor *c = (cloudsync_changes_cursor *)cursor;
-    sqlite3_int64 seq = sqlite3_column_int64(c->vm, COL_SEQ_INDEX);
-    sqlite3_int64 db_version = sqlite3_column_int64(c->vm, COL_DBVERSION_INDEX);
+    cloudsync_changes_key *key = &c->keys[c->heap[0]];
     
     // for an explanation see https://github.com/sqliteai/sqlite-sync/blob/main/docs/RowID.md
-    *rowid = (db_version << 30) | seq;
+    *rowid = (key->db_version << 30) | key->seq;
     return SQLITE_OK;
 }
 
@@ -14,5 +14,6 @@
 int cloudsync_vtab_register_changes (sqlite3 *db, cloudsync_context *xdata);
 cloudsync_context *cloudsync_vtab_get_context (sqlite3_vtab *vtab);
 int cloudsync_vtab_set_error (sqlite3_vtab *vtab, const char *format, ...);
+void cloudsync_vtab_reset_cache (sqlite3_vtab *vtab);
 
 #endif
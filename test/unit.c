@@ -46,6 +46,8 @@ sqlite3 *do_create_database (void);
 static int stdout_backup = -1; // Backup file descriptor for stdout
 static int dev_null_fd = -1;   // File descriptor for /dev/null
 static int test_counter = 1;
+static int did_apply_errors = 0;        // DID_APPLY notifications of a failed change (unittest_payload_apply_written_callback)
+static int did_apply_unwritten = 0;     // DID_APPLY notifications of a change not yet in the meta table
 
 #define TEST_INSERT     (1 << 0) // 0x01
 #define TEST_UPDATE     (1 << 1) // 0x02
@@ -433,6 +435,37 @@ bool unittest_payload_apply_rls_callback(void **xdata, cloudsync_pk_decode_bind_
 }
 #endif
 
+bool unittest_payload_apply_written_callback(void **xdata, cloudsync_pk_decode_bind_context *d, sqlite3 *db, cloudsync_context *data, int step, int rc) {
+    // each applied change must already be written (its clock in the meta table) when DID_APPLY is notified
+    if (step != CLOUDSYNC_PAYLOAD_APPLY_DID_APPLY) return true;
+    if (rc != SQLITE_DONE) {
+        ++did_apply_errors;
+        return true;
+    }
+    
+    int64_t tbl_len = 0, pk_len = 0, colname_len = 0;
+    char *tbl = cloudsync_pk_context_tbl(d, &tbl_len);
+    void *pk = cloudsync_pk_context_pk(d, &pk_len);
+    char *colname = cloudsync_pk_context_colname(d, &colname_len);
+    if (!tbl || !pk || !colname) return true;
+    
+    char *sql = sqlite3_mprintf("SELECT count(*) FROM \"%.*w_cloudsync\" WHERE pk=?1 AND col_name=?2;", (int)tbl_len, tbl);
+    sqlite3_stmt *vm = NULL;
+    if (sql && sqlite3_prepare_v2(db, sql, -1, &vm, NULL) == SQLITE_OK) {
+        sqlite3_bind_blob(vm, 1, pk, (int)pk_len, SQLITE_STATIC);
+        sqlite3_bind_text(vm, 2, colname, (int)colname_len, SQLITE_STATIC);
+        if (sqlite3_step(vm) != SQLITE_ROW || sqlite3_column_int(vm, 0) != 1) ++did_apply_unwritten;
+    }
+    if (vm) sqlite3_finalize(vm);
+    if (sql) sqlite3_free(sql);
+    return true;
+}
+
+void unittest_busy_function (sqlite3_context *context, int argc, sqlite3_value **argv) {
+    // simulate a locking error raised while a change is written
+    sqlite3_result_error_code(context, SQLITE_BUSY);
+}
+
 // MARK: -
 
 #ifndef CLOUDSYNC_OMIT_PRINT_RESULT
@@ -826,6 +859,85 @@ bool do_test_vtab2 (void) {
     
     // at this point cloudsync_changes contains 10 rows
     
+    // run the same query twice so the second execution re-uses the cached statement
+    for (int i=0; i<2; ++i) {
+        sqlite3_int64 count = dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE db_version>0;");
+        if (count != 10) {rc = SQLITE_ERROR; goto finalize;}
+    }
+    
+    // a schema change must invalidate the cached statements
+    rc = sqlite3_exec(db, "CREATE TABLE bar (id TEXT PRIMARY KEY NOT NULL, value INTEGER); SELECT cloudsync_init('bar'); INSERT INTO bar (id, value) VALUES ('id1', 1);", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    sqlite3_int64 count = dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE db_version>0;");
+    if (count != 11) {rc = SQLITE_ERROR; goto finalize;}
+    
+    // interleave changes between the two tables and check that the merged rows are ordered by db_version, seq
+    rc = sqlite3_exec(db, "INSERT INTO foo (name, age) VALUES ('name11', 11); INSERT INTO bar (id, value) VALUES ('id2', 2); UPDATE foo SET age=100 WHERE name='name1';", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    rc = sqlite3_prepare_v2(db, "SELECT db_version, seq FROM cloudsync_changes;", -1, &stmt, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    sqlite3_int64 last_db_version = 0, last_seq = -1;
+    int nrows = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        sqlite3_int64 db_version = sqlite3_column_int64(stmt, 0);
+        sqlite3_int64 seq = sqlite3_column_int64(stmt, 1);
+        if ((db_version < last_db_version) || (db_version == last_db_version && seq <= last_seq)) {rc = SQLITE_ERROR; goto finalize;}
+        last_db_version = db_version;
+        last_seq = seq;
+        ++nrows;
+    }
+    if (rc != SQLITE_DONE || nrows != 13) {rc = SQLITE_ERROR; goto finalize;}
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+    
+    // tables whose db_version high-water mark is below the lower bound are skipped
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE db_version>12;") != 2) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE db_version>=13;") != 2) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE db_version=14;") != 1) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE db_version>14;") != 0) {rc = SQLITE_ERROR; goto finalize;}
+    
+    // queries that do not reference col_value skip the augmented table lookup
+    if (dbutils_int_select(db, "SELECT max(db_version) FROM cloudsync_changes;") != 14) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE site_id=cloudsync_siteid();") != 13) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT col_value FROM cloudsync_changes WHERE db_version=14;") != 100) {rc = SQLITE_ERROR; goto finalize;}
+    
+    // an ORDER BY not compatible with the merge order must be sorted by SQLite
+    char *value = dbutils_text_select(db, "SELECT group_concat(db_version, ',') FROM (SELECT db_version FROM cloudsync_changes WHERE tbl='bar' ORDER BY db_version DESC);");
+    if (!value || strcmp(value, "13,11") != 0) {cloudsync_memory_free(value); rc = SQLITE_ERROR; goto finalize;}
+    cloudsync_memory_free(value);
+
+    // all the changed columns of a row are served from the same augmented row lookup
+    rc = sqlite3_exec(db, "CREATE TABLE wide (id TEXT PRIMARY KEY NOT NULL, c1 INTEGER, c2 TEXT, c3 REAL); SELECT cloudsync_init('wide'); INSERT INTO wide (id, c1, c2, c3) VALUES ('w1', 1, 'two', 3.5), ('w2', 4, 'five', 6.5); DELETE FROM wide WHERE id='w2';", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+
+    value = dbutils_text_select(db, "SELECT group_concat(col_name || '=' || quote(col_value), ',') FROM cloudsync_changes WHERE tbl='wide';");
+    if (!value || strcmp(value, "c1=1,c2='two',c3=3.5,__[RIP]__=NULL") != 0) {cloudsync_memory_free(value); rc = SQLITE_ERROR; goto finalize;}
+    cloudsync_memory_free(value);
+
+    // constraints on col_value are evaluated by SQLite
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE tbl='wide' AND col_value='two';") != 1) {rc = SQLITE_ERROR; goto finalize;}
+
+    // tbl constraints restrict the scan to the named meta tables
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE tbl='bar';") != 2) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE tbl='bar' AND db_version>11;") != 1) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE tbl IN ('bar', 'wide', 'missing');") != 6) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE tbl='missing';") != 0) {rc = SQLITE_ERROR; goto finalize;}
+
+    // site_id is resolved from the context dictionary (and through cloudsync_site_id only for non equality constraints)
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE site_id=cloudsync_siteid() AND site_id IS NOT NULL;") != 17) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE site_id != cloudsync_siteid();") != 0) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db, "SELECT count(*) FROM cloudsync_changes WHERE site_id=randomblob(16);") != 0) {rc = SQLITE_ERROR; goto finalize;}
+
+    // cost estimates are computed from sqlite_stat1 (when available) and from the db_version high-water marks
+    // (without statistics the meta rows are estimated from the high-water marks, the meta tables are not counted)
+    if (dbutils_int_select(db, "SELECT count(*) FROM foo JOIN cloudsync_changes ON tbl='foo' AND col_name='age' AND col_value=foo.age AND site_id=cloudsync_siteid() WHERE db_version>=1;") != 11) {rc = SQLITE_ERROR; goto finalize;}
+    rc = sqlite3_exec(db, "ANALYZE;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (dbutils_int_select(db, "SELECT count(*) FROM foo JOIN cloudsync_changes ON tbl='foo' AND col_name='age' AND col_value=foo.age WHERE db_version>=1;") != 11) {rc = SQLITE_ERROR; goto finalize;}
+
     // trigger cloudsync_changesvtab_close with vm not null
     const char *sql = "SELECT tbl, quote(pk), col_name, col_value, col_version, db_version, quote(site_id), cl, seq FROM cloudsync_changes;";
     rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
@@ -876,6 +988,7 @@ bool do_test_vtab2 (void) {
     
 finalize:
     if (rc != SQLITE_OK) printf("do_test_vtab2 error: %s\n", sqlite3_errmsg(db));
+    if (stmt) sqlite3_finalize(stmt);
     db = close_db(db);
     return result;
 }
@@ -1682,6 +1795,54 @@ finalize:
     return false;
 }
 
+bool do_test_fingerprint (sqlite3 *db, bool print_result) {
+    // when two fingerprints decide a comparison the result must match dbutils_value_compare
+    const char *sql = "SELECT column1 FROM (VALUES (NULL), (0), (1), (-1), (2), (9223372036854775807), (-9223372036854775807-1), "
+                      "(576460752303423486), (576460752303423487), (-576460752303423487), (-576460752303423488), "
+                      "(3.1415), (-3.1415), (0.0), (-0.0), (1e300), (-1e-300), (6.2830), "
+                      "(''), ('a'), ('abc'), ('abcdefg'), ('abcdefgh'), ('abcdefgi'), ('abcdefghijklmnop'), ('b'), "
+                      "(x''), (x'00'), (x'0000'), (x'61'), (x'6100'), (x'61626364656667'), (x'6162636465666700'), (x'6162636465666768'), (x'616263646566676869'), "
+                      "(zeroblob(90)), (zeroblob(100)));";
+    sqlite3_value *values[64] = {NULL};
+    sqlite3_stmt *vm = NULL;
+    bool result = false;
+    int count = 0;
+    
+    int rc = sqlite3_prepare_v2(db, sql, -1, &vm, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    while (sqlite3_step(vm) == SQLITE_ROW && count < 64) {
+        values[count++] = sqlite3_value_dup(sqlite3_column_value(vm, 0));
+    }
+    
+    int ndecided = 0;
+    for (int i=0; i<count; ++i) {
+        for (int j=0; j<count; ++j) {
+            sqlite3_int64 fp1, fp2;
+            if (!dbutils_value_fingerprint(values[i], &fp1) || !dbutils_value_fingerprint(values[j], &fp2)) goto finalize;
+            
+            bool decided;
+            int ret = dbutils_fingerprint_compare(fp1, fp2, &decided);
+            if (!decided) continue;
+            
+            int expected = dbutils_value_compare(values[i], values[j]);
+            if ((ret > 0) != (expected > 0) || (ret < 0) != (expected < 0)) {
+                if (print_result) printf("fingerprint mismatch %d-%d: %d %d\n", i, j, ret, expected);
+                goto finalize;
+            }
+            ++ndecided;
+        }
+    }
+    
+    // most of the pairs are decided by the fingerprints alone
+    result = (ndecided > (count * count) / 2);
+    
+finalize:
+    for (int i=0; i<count; ++i) sqlite3_value_free(values[i]);
+    if (vm) sqlite3_finalize(vm);
+    return result;
+}
+
 bool do_test_rowid (int ntest, bool print_result) {
     for (int i=0; i<ntest; ++i) {
         // for an explanation see https://github.com/sqliteai/sqlite-sync/blob/main/docs/RowID.md
@@ -2031,6 +2192,46 @@ bool do_test_string_replace_prefix(void) {
     return true;
 }
 
+bool do_test_arena (void) {
+    cloudsync_arena arena = {0};
+    bool result = false;
+    
+    // allocations are 8 bytes aligned and do not overlap
+    char *p1 = cloudsync_arena_memdup(&arena, "abc", 3);
+    char *p2 = cloudsync_arena_alloc(&arena, 5);
+    if (!p1 || !p2 || ((uintptr_t)p1 % 8) != 0 || ((uintptr_t)p2 % 8) != 0 || p2 < p1 + 3) goto abort_test;
+    if (memcmp(p1, "abc", 3) != 0) goto abort_test;
+    
+    // memory allocated after a mark is reused once released
+    cloudsync_arena_mark mark = cloudsync_arena_get_mark(&arena);
+    char *p3 = cloudsync_arena_alloc(&arena, 100);
+    cloudsync_arena_release(&arena, mark);
+    if (cloudsync_arena_alloc(&arena, 100) != p3) goto abort_test;
+    
+    // a request larger than a chunk gets its own chunk, released with the mark too
+    mark = cloudsync_arena_get_mark(&arena);
+    char *big = cloudsync_arena_alloc(&arena, CLOUDSYNC_ARENA_CHUNK_SIZE * 2);
+    if (!big) goto abort_test;
+    memset(big, 1, CLOUDSYNC_ARENA_CHUNK_SIZE * 2);
+    cloudsync_arena_release(&arena, mark);
+    char *p4 = cloudsync_arena_alloc(&arena, 8);
+    if (p4 < p1 || p4 >= p1 + CLOUDSYNC_ARENA_CHUNK_SIZE) goto abort_test;
+    
+    // fill some chunks, then a reset restarts from the first one
+    for (int i=0; i<4; ++i) {
+        if (!cloudsync_arena_alloc(&arena, CLOUDSYNC_ARENA_CHUNK_SIZE / 2)) goto abort_test;
+    }
+    cloudsync_arena_reset(&arena);
+    if (cloudsync_arena_alloc(&arena, 3) != p1) goto abort_test;
+    
+    result = true;
+    
+abort_test:
+    cloudsync_arena_free(&arena);
+    if (arena.first || arena.current) result = false;
+    return result;
+}
+
 // MARK: -
 
 bool do_compare_queries (sqlite3 *db1, const char *sql1, sqlite3 *db2, const char *sql2, int col_to_skip, int col_tombstone, bool display_column) {
@@ -3090,93 +3291,967 @@ finalize:
     return result;
 }
 
-// MARK: -
-
-bool do_test_network_encode_decode (int nclients, bool print_result, bool cleanup_databases, bool force_uncompressed) {
+bool do_test_merge_batch (int nclients, bool apply_sorted, bool print_result, bool cleanup_databases) {
+    // all the changes of a payload are merged as a single batch, where consecutive changes of the same row
+    // share the row clocks: inserts, updates, deletes and resurrections of the same row must still converge
     sqlite3 *db[MAX_SIMULATED_CLIENTS] = {NULL};
     bool result = false;
     int rc = SQLITE_OK;
     
     memset(db, 0, sizeof(sqlite3 *) * MAX_SIMULATED_CLIENTS);
-    if (nclients >= MAX_SIMULATED_CLIENTS) {
-        nclients = MAX_SIMULATED_CLIENTS;
-        printf("Number of test merge reduced to %d clients\n", MAX_SIMULATED_CLIENTS);
-    } else if (nclients < 2) {
-        nclients = 2;
-        printf("Number of test merge increased to %d clients\n", 2);
-    }
+    nclients = 2;
     
     // create databases and tables
-    int table_mask = TEST_PRIKEYS | TEST_NOCOLS;
     time_t timestamp = time(NULL);
     int saved_counter = test_counter;
     for (int i=0; i<nclients; ++i) {
         db[i] = do_create_database_file(i, timestamp, test_counter++);
         if (db[i] == false) return false;
         
-        if (do_create_tables(table_mask, db[i]) == false) {
-            return false;
-        }
+        // mixed case names are resolved by the case-insensitive table and column indexes
+        const char *sql = "CREATE TABLE Todo (id TEXT PRIMARY KEY NOT NULL, Title TEXT, done INTEGER, NOTE TEXT);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
         
-        if (do_augment_tables(table_mask, db[i], table_algo_crdt_cls) == false) {
-            return false;
+        sql = "SELECT cloudsync_init('todo', 'cls', 0);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        // rows grouped by (tbl, pk) instead of the sender order
+        if (apply_sorted) {
+            rc = sqlite3_exec(db[i], "SELECT cloudsync_set('apply_sorted', '1');", NULL, NULL, NULL);
+            if (rc != SQLITE_OK) goto finalize;
         }
     }
     
-    // insert, update and delete some data in all clients
+    // initial rows
+    rc = sqlite3_exec(db[0], "INSERT INTO todo VALUES ('r1', 'one', 0, NULL), ('r2', 'two', 0, NULL), ('r3', 'three', 0, NULL);", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    
+    // several changes to the same rows in the same payload
+    const char *sql = "UPDATE todo SET title='one bis', done=1 WHERE id='r1';"
+                      "DELETE FROM todo WHERE id='r2';"
+                      "DELETE FROM todo WHERE id='r3';"
+                      "INSERT INTO todo VALUES ('r3', 'again', 1, 'back');"
+                      "UPDATE todo SET note='back again' WHERE id='r3';"
+                      "INSERT INTO todo VALUES ('r4', 'four', 0, 'new');"
+                      "UPDATE todo SET done=0 WHERE id='r1';";
+    rc = sqlite3_exec(db[0], sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // concurrent local changes
+    // (the concurrent title of r1 has the same col_version and the tie is decided by the value fingerprints)
+    rc = sqlite3_exec(db[1], "UPDATE todo SET note='local', title='one local' WHERE id='r1'; UPDATE todo SET title='two local' WHERE id='r2';", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    
+    // the receive checkpoint is the most recent change of the payload, whatever the apply order
+    sqlite3_int64 max_db_version = dbutils_int_select(db[0], "SELECT max(db_version) FROM cloudsync_changes;");
+    if (dbutils_int_select(db[1], "SELECT CAST(value AS INTEGER) FROM cloudsync_settings WHERE key='check_dbversion';") != max_db_version) goto finalize;
+    
+    if (do_merge_enc_dec_values(db[1], db[0], true, true) == false) goto finalize;
+    
+    // compare results and clocks
+    sql = "SELECT * FROM todo ORDER BY id;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    sql = "SELECT tbl, pk, col_name, col_value, col_version, cl FROM cloudsync_changes ORDER BY tbl, pk, col_name;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    if (print_result) {
+        printf("\n-> todo\n");
+        do_query(db[0], "SELECT * FROM todo ORDER BY id;", NULL);
+    }
+    
+    result = true;
+    
+finalize:
     for (int i=0; i<nclients; ++i) {
-        do_insert(db[i], table_mask, NINSERT, print_result);
-        //if (i==0) do_update(db[i], table_mask, print_result);
-        //if (i!=nclients-1) do_delete(db[i], table_mask, print_result);
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_merge_batch error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
+        }
     }
+    return result;
+}
+
+bool do_test_payload_checkpoint (bool apply_sorted, bool print_result, bool cleanup_databases) {
+    // a payload applied in checkpoint mode is applied a few rows at a time, each call can be committed separately
+    // and an interrupted (rolled back) call is retried from the last committed checkpoint
+    sqlite3 *db[2] = {NULL, NULL};
+    sqlite3_stmt *select_stmt = NULL;
+    sqlite3_stmt *decode_stmt = NULL;
+    sqlite3_stmt *plain_stmt = NULL;
+    bool result = false;
+    int rc = SQLITE_OK;
+    int nclients = 2;
     
-    if (force_uncompressed) force_uncompressed_blob = true;
+    // create databases and tables
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        const char *sql = "CREATE TABLE todo (id TEXT PRIMARY KEY NOT NULL, title TEXT, done INTEGER, note TEXT);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        sql = "SELECT cloudsync_init('todo', 'cls', 0);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
     
-    // merge all changes (loop extracted from do_merge and do_merge_values)
-    const char *src_sql = "SELECT cloudsync_payload_encode(tbl, pk, col_name, col_value, col_version, db_version, site_id, cl, seq) FROM cloudsync_changes WHERE site_id=cloudsync_siteid();";
-    const char *dest_sql = "SELECT cloudsync_payload_decode(?);";
+    rc = sqlite3_exec(db[0], "SELECT cloudsync_set('payload_version', '3');", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (apply_sorted) {
+        rc = sqlite3_exec(db[1], "SELECT cloudsync_set('apply_sorted', '1');", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    // rows with big notes, so the payload is made of several blocks
+    const char *sql = "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<40) "
+                      "INSERT INTO todo SELECT 'r' || i, 'title ' || i, i % 2, printf('%.*c', 20000 + i, 'x') FROM n;";
+    rc = sqlite3_exec(db[0], sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // the receiver rejects the delete of r5 (as a RLS policy would do): the change is counted and the apply goes on
+    rc = sqlite3_exec(db[0], "DELETE FROM todo WHERE id='r5';", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    rc = sqlite3_exec(db[1], "CREATE TRIGGER todo_reject BEFORE INSERT ON todo_cloudsync WHEN NEW.pk=cloudsync_pk_encode('r5') BEGIN SELECT RAISE(ABORT, 'rejected delete'); END;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    int nchanges = (int)dbutils_int_select(db[0], "SELECT count(*) FROM cloudsync_changes WHERE site_id=cloudsync_siteid();");
+    
+    sql = "SELECT cloudsync_payload_encode(tbl, pk, col_name, col_value, col_version, db_version, site_id, cl, seq) FROM cloudsync_changes WHERE site_id=cloudsync_siteid();";
+    rc = sqlite3_prepare_v2(db[0], sql, -1, &select_stmt, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (sqlite3_step(select_stmt) != SQLITE_ROW) goto finalize;
+    
+    // checkpoint mode is requested by each call (a plain cloudsync_payload_decode applies the whole payload)
+    rc = sqlite3_prepare_v2(db[1], "SELECT cloudsync_payload_decode(?, 7);", -1, &decode_stmt, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    rc = sqlite3_bind_value(decode_stmt, 1, sqlite3_column_value(select_stmt, 0));
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // without max_rows the whole payload is applied by a single call
+    rc = sqlite3_exec(db[1], "BEGIN;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (sqlite3_prepare_v2(db[1], "SELECT cloudsync_payload_decode(?);", -1, &plain_stmt, NULL) != SQLITE_OK) goto finalize;
+    rc = sqlite3_bind_value(plain_stmt, 1, sqlite3_column_value(select_stmt, 0));
+    if (rc != SQLITE_OK) goto finalize;
+    if (sqlite3_step(plain_stmt) != SQLITE_ROW || sqlite3_column_int(plain_stmt, 0) != nchanges) goto finalize;
+    sqlite3_reset(plain_stmt);
+    rc = sqlite3_exec(db[1], "ROLLBACK;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // interrupted apply: neither the rows nor the checkpoint are committed
+    rc = sqlite3_exec(db[1], "BEGIN;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (sqlite3_step(decode_stmt) != SQLITE_ROW || sqlite3_column_int(decode_stmt, 0) != 7) goto finalize;
+    sqlite3_reset(decode_stmt);
+    rc = sqlite3_exec(db[1], "ROLLBACK;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // each call applies (and commits) the next rows until the payload is exhausted
+    int napplied = 0, ncalls = 0;
+    while (1) {
+        rc = sqlite3_step(decode_stmt);
+        if (rc != SQLITE_ROW) goto finalize;
+        int n = sqlite3_column_int(decode_stmt, 0);
+        sqlite3_reset(decode_stmt);
+        if (n == 0) break;
+        napplied += n;
+        if (++ncalls > nchanges) goto finalize;
+    }
+    rc = SQLITE_OK;
+    if (napplied != nchanges || ncalls != (nchanges + 6) / 7) goto finalize;
+    
+    // the receive checkpoint is advanced by the last call only
+    sqlite3_int64 max_db_version = dbutils_int_select(db[0], "SELECT max(db_version) FROM cloudsync_changes;");
+    if (dbutils_int_select(db[1], "SELECT CAST(value AS INTEGER) FROM cloudsync_settings WHERE key='check_dbversion';") != max_db_version) goto finalize;
+    
+    // compare results and clocks
+    sql = "SELECT * FROM todo ORDER BY id;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    sql = "SELECT tbl, pk, col_name, col_value, col_version, cl FROM cloudsync_changes WHERE pk!=cloudsync_pk_encode('r5') ORDER BY tbl, pk, col_name;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM cloudsync_changes WHERE pk=cloudsync_pk_encode('r5');") != 0) goto finalize;
+    
+    result = true;
     
+finalize:
+    if (select_stmt) sqlite3_finalize(select_stmt);
+    if (decode_stmt) sqlite3_finalize(decode_stmt);
+    if (plain_stmt) sqlite3_finalize(plain_stmt);
     for (int i=0; i<nclients; ++i) {
-        int target = i;
-        for (int j=0; j<nclients; ++j) {
-            if (target == j) continue;
-            
-            int blob_size = 0, rc;
-            char *blob = dbutils_blob_select (db[target], src_sql, &blob_size, NULL, &rc);
-            if (!blob) goto finalize;
-            
-            const char *values[] = {blob};
-            int types[] = {SQLITE_BLOB};
-            int len[] = {blob_size};
-
-            dbutils_select(db[j], dest_sql, values, types, len, 1, SQLITE_INTEGER);
-            cloudsync_memory_free(blob);
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_payload_checkpoint error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
         }
     }
+    return result;
+}
+
+bool do_test_merge_coalesce (bool apply_callback, bool print_result, bool cleanup_databases) {
+    // the winning columns of a row are written by a single UPSERT, a column rejected by the receiver
+    // is counted in the apply errors without losing the other columns of the row
+    // (with a payload apply callback each column is written before its DID_APPLY notification)
+    sqlite3 *db[2] = {NULL, NULL};
+    bool result = false;
+    int rc = SQLITE_OK;
+    int nclients = 2;
     
-    if (force_uncompressed) force_uncompressed_blob = false;
-    
-    // compare results
-    for (int i=1; i<nclients; ++i) {
-        char *sql = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY first_name, \"" CUSTOMERS_TABLE_COLUMN_LASTNAME "\";", CUSTOMERS_TABLE);
-        bool result = do_compare_queries(db[0], sql, db[i], sql, -1, -1, print_result);
-        sqlite3_free(sql);
-        if (result == false) goto finalize;
+    // create databases and tables
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        const char *sql = "CREATE TABLE todo (id TEXT PRIMARY KEY NOT NULL, title TEXT, done INTEGER, note TEXT);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        sql = "SELECT cloudsync_init('todo', 'cls', 0);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
     }
     
-    if (print_result) {
-        printf("\n-> customers\n");
-        char *sql = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY first_name, \"" CUSTOMERS_TABLE_COLUMN_LASTNAME "\";", CUSTOMERS_TABLE);
-        do_query(db[0], sql, query_table);
-        sqlite3_free(sql);
+    // the receiver rejects the done values greater than 4 (as a RLS policy would do)
+    const char *sql = "CREATE TRIGGER todo_reject BEFORE INSERT ON todo WHEN NEW.done > 4 BEGIN SELECT RAISE(ABORT, 'rejected done'); END;"
+                      "CREATE TRIGGER todo_reject_update BEFORE UPDATE ON todo WHEN NEW.done > 4 BEGIN SELECT RAISE(ABORT, 'rejected done'); END;"
+                      "SELECT cloudsync_set('apply_errors', '10');";
+    rc = sqlite3_exec(db[1], sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    cloudsync_set_payload_apply_callback(db[1], (apply_callback) ? unittest_payload_apply_written_callback : NULL);
+    did_apply_errors = 0;
+    did_apply_unwritten = 0;
+    
+    sql = "INSERT INTO todo VALUES ('r1', 'a', 1, 'x'), ('r2', 'b', 7, 'y'), ('r3', 'c', 2, 'z');"
+                      "UPDATE todo SET title='a2', note='x2' WHERE id='r1';"
+                      "UPDATE todo SET title='c2', done=3, note='z2' WHERE id='r3';";
+    rc = sqlite3_exec(db[0], sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    
+    // multi-column rows are merged entirely, r2 misses only the rejected done column
+    sql = "SELECT * FROM todo WHERE id!='r2' ORDER BY id;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM todo WHERE id='r2' AND title='b' AND done IS NULL AND note='y';") != 1) goto finalize;
+    
+    sql = "SELECT tbl, pk, col_name, col_value, col_version, cl FROM cloudsync_changes WHERE pk!=cloudsync_pk_encode('r2') OR col_name!='done' ORDER BY tbl, pk, col_name;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM cloudsync_changes WHERE pk=cloudsync_pk_encode('r2') AND col_name='done';") != 0) goto finalize;
+    
+    // the rejected column is counted once
+    if (dbutils_int_select(db[1], "SELECT sum(count) FROM cloudsync_apply_errors;") != 1) goto finalize;
+    
+    // the payload apply callback requires SQLite 3.44
+    if (apply_callback && sqlite3_libversion_number() >= 3044000) {
+        if (did_apply_errors != 1 || did_apply_unwritten != 0) goto finalize;
     }
     
     result = true;
-    rc = SQLITE_OK;
     
 finalize:
     for (int i=0; i<nclients; ++i) {
-        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_merge error: %s\n", sqlite3_errmsg(db[i]));
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_merge_coalesce error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
+        }
+    }
+    return result;
+}
+
+bool do_test_merge_flush_fatal (bool print_result, bool cleanup_databases) {
+    // the pending columns of a row are written before reading a local value to break a col_version tie,
+    // an I/O, memory or locking error of that write must stop the payload apply
+    sqlite3 *db[2] = {NULL, NULL};
+    bool result = false;
+    int rc = SQLITE_OK;
+    int nclients = 2;
+    
+    // create databases and tables
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        const char *sql = "CREATE TABLE todo (id TEXT PRIMARY KEY NOT NULL, title TEXT, note TEXT);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        sql = "SELECT cloudsync_init('todo', 'cls', 0);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    rc = sqlite3_exec(db[0], "INSERT INTO todo VALUES ('r1', 't1', 'n1');", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    
+    // the note values have the same col_version and the same fingerprint prefix, so the tie reads the local value
+    rc = sqlite3_exec(db[0], "UPDATE todo SET title='t2' WHERE id='r1'; UPDATE todo SET note='abcdefghijX' WHERE id='r1';", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    rc = sqlite3_exec(db[1], "UPDATE todo SET note='abcdefghijY' WHERE id='r1';", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // the write of the pending title fails with SQLITE_BUSY (the title is pending only without a payload apply callback)
+    cloudsync_set_payload_apply_callback(db[1], NULL);
+    rc = sqlite3_create_function(db[1], "unittest_busy", 0, SQLITE_UTF8, NULL, unittest_busy_function, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    rc = sqlite3_exec(db[1], "CREATE TRIGGER todo_busy BEFORE UPDATE OF title ON todo BEGIN SELECT unittest_busy(); END;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    if (do_merge_enc_dec_values(db[0], db[1], true, false) == true) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM todo WHERE id='r1' AND title='t1' AND note='abcdefghijY';") != 1) goto finalize;
+    
+    // once the error is gone the payload is applied
+    rc = sqlite3_exec(db[1], "DROP TRIGGER todo_busy;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM todo WHERE id='r1' AND title='t2';") != 1) goto finalize;
+    
+    result = true;
+    
+finalize:
+    for (int i=0; i<nclients; ++i) {
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_merge_flush_fatal error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
+        }
+    }
+    return result;
+}
+
+bool do_test_siteid_savepoint (bool print_result, bool cleanup_databases) {
+    // the site_id values assigned inside a transaction are cached, a ROLLBACK TO that undoes their rows
+    // must not leave changes that reference a site_id no longer in cloudsync_site_id
+    sqlite3 *db[2] = {NULL, NULL};
+    bool result = false;
+    int rc = SQLITE_OK;
+    int nclients = 2;
+    
+    // create databases and tables
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        const char *sql = "CREATE TABLE todo (id TEXT PRIMARY KEY NOT NULL, title TEXT, done INTEGER);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        sql = "SELECT cloudsync_init('todo', 'cls', 0);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    rc = sqlite3_exec(db[0], "INSERT INTO todo VALUES ('r1', 'a', 0), ('r2', 'b', 1);", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // the site_id of db[0] is inserted (and cached) inside the savepoint, then inserted again after the ROLLBACK TO
+    rc = sqlite3_exec(db[1], "BEGIN; SAVEPOINT s;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    rc = sqlite3_exec(db[1], "ROLLBACK TO s; RELEASE s;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM cloudsync_site_id WHERE rowid > 0;") != 0) goto finalize;
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    rc = sqlite3_exec(db[1], "COMMIT;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // the meta table references the site_id by rowid (cloudsync_changes could read it from the dictionary)
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM todo_cloudsync WHERE site_id NOT IN (SELECT rowid FROM cloudsync_site_id);") != 0) goto finalize;
+    const char *sql = "SELECT tbl, pk, col_name, col_value, col_version, site_id, cl FROM cloudsync_changes ORDER BY tbl, pk, col_name;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    result = true;
+    
+finalize:
+    for (int i=0; i<nclients; ++i) {
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_siteid_savepoint error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
+        }
+    }
+    return result;
+}
+
+bool do_test_apply_errors (bool print_result, bool cleanup_databases) {
+    // changes rejected by the receiver are counted by (table, error code) and reported once per apply
+    // in the bounded cloudsync_apply_errors table
+    sqlite3 *db[2] = {NULL, NULL};
+    bool result = false;
+    int rc = SQLITE_OK;
+    int nclients = 2;
+    
+    // create databases and tables
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        const char *sql = "CREATE TABLE todo (id TEXT PRIMARY KEY NOT NULL, title TEXT, done INTEGER);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        sql = "SELECT cloudsync_init('todo', 'cls', 0);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    // the receiver rejects some of the titles (as a RLS policy would do)
+    const char *sql = "CREATE TRIGGER todo_reject BEFORE INSERT ON todo WHEN NEW.title LIKE 'bad%' BEGIN SELECT RAISE(ABORT, 'rejected title'); END;"
+                      "CREATE TRIGGER todo_reject_update BEFORE UPDATE ON todo WHEN NEW.title LIKE 'bad%' BEGIN SELECT RAISE(ABORT, 'rejected title'); END;"
+                      "SELECT cloudsync_set('apply_errors', '1');";
+    rc = sqlite3_exec(db[1], sql, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    rc = sqlite3_exec(db[0], "INSERT INTO todo VALUES ('r1', 'good', 0), ('r2', 'bad one', 0), ('r3', 'bad two', 1), ('r4', 'fine', 1);", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    
+    // one group for the rejected titles of todo
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM cloudsync_apply_errors WHERE tbl='todo' AND count=2 AND message LIKE '%rejected title%';") != 1) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM todo WHERE title IS NULL;") != 2) goto finalize;
+    
+    // the table keeps only the last apply_errors rows
+    if (do_merge_enc_dec_values(db[0], db[1], true, true) == false) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM cloudsync_apply_errors;") != 1) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT max(id) FROM cloudsync_apply_errors;") != 2) goto finalize;
+    
+    if (print_result) {
+        printf("\n-> cloudsync_apply_errors\n");
+        do_query(db[1], "SELECT tbl, code, count, db_version, seq, message FROM cloudsync_apply_errors;", NULL);
+    }
+    
+    result = true;
+    
+finalize:
+    for (int i=0; i<nclients; ++i) {
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_apply_errors error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
+        }
+    }
+    return result;
+}
+
+bool do_test_defer_meta (bool print_result, bool cleanup_databases) {
+    // local changes buffered by the defer_meta setting and written by cloudsync_flush must produce
+    // the same meta tables of the changes written immediately
+    sqlite3 *db[2] = {NULL, NULL};
+    sqlite3 *other = NULL;
+    bool result = false;
+    int rc = SQLITE_OK;
+    int nclients = 2;
+    
+    // create databases and tables (only db[0] defers its meta changes)
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        const char *sql = "CREATE TABLE todo (id TEXT PRIMARY KEY NOT NULL, title TEXT, done INTEGER);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        sql = "SELECT cloudsync_init('todo', 'cls', 0);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    rc = sqlite3_exec(db[0], "SELECT cloudsync_set('defer_meta', '1');", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // a commit without flush is turned into a rollback
+    rc = sqlite3_exec(db[0], "BEGIN; INSERT INTO todo VALUES ('lost', 'lost', 0);", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (sqlite3_exec(db[0], "COMMIT;", NULL, NULL, NULL) == SQLITE_OK) goto finalize;
+    if (dbutils_int_select(db[0], "SELECT count(*) FROM todo;") != 0) goto finalize;
+    
+    // same changes on both databases: repeated updates, a failed statement, deletes, a reinsert, a primary key change
+    // and deletes rolled back to a savepoint (the buffered writes of those rows must still be written)
+    const char *sql = "BEGIN;"
+                      "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<100) INSERT INTO todo SELECT 'r' || i, 'title ' || i, 0 FROM n;"
+                      "UPDATE todo SET title = title || ' bis' WHERE rowid % 3 = 0;"
+                      "UPDATE todo SET title = title || ' ter', done = 1 WHERE rowid % 6 = 0;"
+                      "INSERT OR IGNORE INTO todo VALUES ('r1', 'dup', 0);"
+                      "DELETE FROM todo WHERE rowid % 10 = 0;"
+                      "INSERT INTO todo VALUES ('r10', 'again', 1);"
+                      "UPDATE todo SET id = 'r200' WHERE id = 'r7';"
+                      "UPDATE todo SET done = 1 WHERE id = 'r200';"
+                      "SAVEPOINT sp; DELETE FROM todo WHERE id IN ('r3', 'r20'); ROLLBACK TO sp; RELEASE sp;"
+                      "UPDATE todo SET done = 3 WHERE id = 'r3';"
+                      "SAVEPOINT sp; DELETE FROM todo WHERE id = 'r30'; INSERT INTO todo VALUES ('r30', 'reinserted', 0); ROLLBACK TO sp; RELEASE sp;"
+                      "INSERT INTO todo VALUES ('s1', 'x', 0); SAVEPOINT sp; DELETE FROM todo WHERE id = 's1'; ROLLBACK TO sp; RELEASE sp;";
+    for (int i=0; i<nclients; ++i) {
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        // the failed statement leaves no changes
+        if (sqlite3_exec(db[i], "INSERT INTO todo VALUES ('r300', 'ok', 0), ('r2', 'duplicated', 0);", NULL, NULL, NULL) == SQLITE_OK) goto finalize;
+        
+        rc = sqlite3_exec(db[i], "SELECT cloudsync_flush(); COMMIT;", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    // the setting is not shared by the other connections to the same database
+    other = do_create_database_file(0, timestamp, saved_counter);
+    if (!other) goto finalize;
+    for (int i=0; i<nclients; ++i) {
+        rc = sqlite3_exec((i == 0) ? other : db[i], "BEGIN; INSERT INTO todo VALUES ('other', 'other', 0); COMMIT;", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    close_db(other);
+    other = NULL;
+    
+    // writes to committed rows undone by a savepoint rollback change nothing
+    const char *versions_sql = "SELECT sum(col_version) FROM todo_cloudsync WHERE pk IN (cloudsync_pk_encode('r4'), cloudsync_pk_encode('r11'));";
+    sqlite3_int64 versions = dbutils_int_select(db[0], versions_sql);
+    sql = "BEGIN;"
+          "SAVEPOINT sp; UPDATE todo SET done = 2 WHERE id = 'r4'; ROLLBACK TO sp; RELEASE sp;"
+          "SAVEPOINT sp; UPDATE todo SET done = 5 WHERE id = 'r9'; RELEASE sp; SAVEPOINT sp; UPDATE todo SET done = 6 WHERE id = 'r11'; ROLLBACK TO sp; RELEASE sp;"
+          "SELECT cloudsync_flush(); COMMIT;";
+    for (int i=0; i<nclients; ++i) {
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    if (dbutils_int_select(db[0], versions_sql) != versions) goto finalize;
+    
+    // changes read by cloudsync_changes within the transaction are flushed first
+    rc = sqlite3_exec(db[0], "BEGIN; UPDATE todo SET title = 'read' WHERE id = 'r1';", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (dbutils_int_select(db[0], "SELECT count(*) FROM cloudsync_changes WHERE col_value = 'read';") != 1) goto finalize;
+    rc = sqlite3_exec(db[0], "COMMIT;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    rc = sqlite3_exec(db[1], "UPDATE todo SET title = 'read' WHERE id = 'r1';", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // autocommit statements write their meta changes immediately
+    for (int i=0; i<nclients; ++i) {
+        rc = sqlite3_exec(db[i], "INSERT INTO todo VALUES ('auto', 'auto', 0); UPDATE todo SET done = 4 WHERE id IN ('auto', 'r2'); DELETE FROM todo WHERE id = 'r5';", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    if (dbutils_int_select(db[0], "SELECT count(*) FROM cloudsync_changes WHERE pk = cloudsync_pk_encode('auto');") != 2) goto finalize;
+    
+    // compare results and clocks
+    sql = "SELECT * FROM todo ORDER BY id;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    sql = "SELECT pk, col_name, col_version, db_version, seq, site_id, col_fingerprint FROM todo_cloudsync ORDER BY pk, col_name;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    result = true;
+    
+finalize:
+    for (int i=0; i<nclients; ++i) {
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_defer_meta error: %s\n", sqlite3_errmsg(db[i]));
+        if (i == 0 && other) close_db(other);
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
+        }
+    }
+    return result;
+}
+
+bool do_test_update_triggers (bool print_result, bool cleanup_databases) {
+    // the column specific update triggers must produce the same meta tables of the full-row update trigger
+    // of previous versions (installed by hand in db[1]), which is upgraded by cloudsync_init
+    sqlite3 *db[2] = {NULL, NULL};
+    bool result = false;
+    int rc = SQLITE_OK;
+    int nclients = 2;
+    
+    // create databases and tables
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        const char *sql = "CREATE TABLE doc (id TEXT PRIMARY KEY NOT NULL, name TEXT COLLATE NOCASE, data BLOB, n);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+        
+        sql = "SELECT cloudsync_init('doc', 'cls', 0);";
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    // one trigger for the primary key and one for each column
+    if (dbutils_int_select(db[0], "SELECT count(*) FROM sqlite_master WHERE type='trigger' AND name GLOB 'cloudsync_column_after_update_doc_*';") != 3) goto finalize;
+    
+    // full-row trigger of previous versions
+    rc = dbutils_delete_update_triggers(db[1], "doc");
+    if (rc != SQLITE_OK) goto finalize;
+    rc = sqlite3_exec(db[1], "CREATE TRIGGER \"cloudsync_after_update_doc\" AFTER UPDATE ON \"doc\" FOR EACH ROW WHEN cloudsync_is_sync('doc') = 0 BEGIN SELECT cloudsync_update('doc',NEW.\"id\",OLD.\"id\",NEW.\"name\", OLD.\"name\",NEW.\"data\", OLD.\"data\",NEW.\"n\", OLD.\"n\"); END", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    // same changes on both databases: case only and type only changes, unchanged assignments,
+    // a primary key change with and without column changes (the full-row trigger also consumes a
+    // db_version for an update without changes, so that statement shares the transaction of the next one)
+    const char *sql = "INSERT INTO doc VALUES ('a', 'first', zeroblob(100000), 1), ('b', 'second', x'01', 2), ('c', 'third', NULL, 3);"
+                      "UPDATE doc SET name = 'FIRST' WHERE id = 'a';"
+                      "UPDATE doc SET n = 1.0 WHERE id = 'a';"
+                      "BEGIN;"
+                      "UPDATE doc SET data = data, n = n;"
+                      "UPDATE doc SET n = n + 1, name = 'changed' WHERE id != 'a';"
+                      "COMMIT;"
+                      "UPDATE doc SET id = 'd', name = 'moved' WHERE id = 'b';"
+                      "UPDATE doc SET id = 'e' WHERE id = 'c';"
+                      "UPDATE doc SET id = id, data = x'02' WHERE id = 'e';";
+    for (int i=0; i<nclients; ++i) {
+        rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    // compare results and clocks
+    sql = "SELECT * FROM doc ORDER BY id;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    sql = "SELECT pk, col_name, col_version, db_version, seq, site_id, col_fingerprint FROM doc_cloudsync ORDER BY pk, col_name;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    // cloudsync_init replaces the full-row trigger
+    rc = sqlite3_exec(db[1], "SELECT cloudsync_init('doc', 'cls', 0);", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (dbutils_int_select(db[1], "SELECT count(*) FROM sqlite_master WHERE type='trigger' AND name GLOB 'cloudsync_column_after_update_doc_*';") != 3) goto finalize;
+    sql = "SELECT name, sql FROM sqlite_master WHERE type='trigger' ORDER BY name;";
+    if (do_compare_queries(db[0], sql, db[1], sql, -1, -1, print_result) == false) goto finalize;
+    
+    result = true;
+    
+finalize:
+    for (int i=0; i<nclients; ++i) {
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_update_triggers error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
+        }
+    }
+    return result;
+}
+
+bool do_test_db_version_connections (bool print_result, bool cleanup_databases) {
+    // db_version is checked once per write transaction, so the writes committed by another
+    // connection between two transactions must still be seen by the next one, and the versions used by
+    // a committed transaction must never be reused even if its write of the counter has been rolled back
+    sqlite3 *db[2] = {NULL, NULL};
+    bool result = false;
+    int rc = SQLITE_OK;
+    int nclients = 2;
+    char *value = NULL;
+    
+    // two connections to the same database
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter++;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(0, timestamp, saved_counter);
+        if (db[i] == false) goto finalize;
+        
+        rc = sqlite3_exec(db[i], "CREATE TABLE IF NOT EXISTS todo (id TEXT PRIMARY KEY NOT NULL, title TEXT); SELECT cloudsync_init('todo', 'cls', 0);", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    const char *sql[] = {
+        "BEGIN; INSERT INTO todo VALUES ('a', 'a'); INSERT INTO todo VALUES ('b', 'b'); COMMIT;",
+        "INSERT INTO todo VALUES ('c', 'c');",
+        "BEGIN; INSERT INTO todo VALUES ('d', 'd'); INSERT INTO todo VALUES ('e', 'e'); COMMIT;",
+        "INSERT INTO todo VALUES ('f', 'f');",
+        "SELECT cloudsync_db_version(); INSERT INTO todo VALUES ('g', 'g');",
+        "BEGIN; INSERT INTO todo VALUES ('h', 'h'); ROLLBACK;",
+        "INSERT INTO todo VALUES ('i', 'i');",
+        "INSERT INTO todo VALUES ('j', 'j');",
+        "BEGIN; SAVEPOINT s; INSERT INTO todo VALUES ('k', 'k'); ROLLBACK TO s; INSERT INTO todo VALUES ('l', 'l'); COMMIT;",
+        "INSERT INTO todo VALUES ('m', 'm');"
+    };
+    for (int i=0; i<(int)(sizeof(sql)/sizeof(sql[0])); ++i) {
+        rc = sqlite3_exec(db[i % 2], sql[i], NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto finalize;
+    }
+    
+    // a failed statement within a transaction undoes the write of the db_version counter too,
+    // so the following statement of the same transaction must write it again
+    rc = sqlite3_exec(db[0], "BEGIN;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (sqlite3_exec(db[0], "INSERT INTO todo VALUES ('n', 'n'), ('a', 'duplicated');", NULL, NULL, NULL) == SQLITE_OK) goto finalize;
+    rc = sqlite3_exec(db[0], "INSERT INTO todo VALUES ('o', 'o'); COMMIT;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    rc = sqlite3_exec(db[1], "INSERT INTO todo VALUES ('p', 'p');", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    
+    value = dbutils_text_select(db[0], "SELECT group_concat(db_version, ',') FROM (SELECT db_version FROM todo_cloudsync ORDER BY db_version);");
+    if (print_result) printf("\n-> db_version: %s\n", (value) ? value : "NULL");
+    if (!value || strcmp(value, "1,1,2,3,3,4,5,6,7,8,9,10,11") != 0) goto finalize;
+    if (dbutils_int_select(db[0], "SELECT version FROM cloudsync_db_version;") != 11) goto finalize;
+    
+    // databases created before the db_version counter start from the max db_version of the meta tables
+    rc = sqlite3_exec(db[0], "DROP TABLE cloudsync_db_version;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = close_db(db[i]);
+    }
+    db[0] = do_create_database_file(0, timestamp, saved_counter);
+    if (db[0] == false) goto finalize;
+    if (dbutils_int_select(db[0], "SELECT version FROM cloudsync_db_version;") != 11) goto finalize;
+    rc = sqlite3_exec(db[0], "INSERT INTO todo VALUES ('q', 'q');", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto finalize;
+    if (dbutils_int_select(db[0], "SELECT cloudsync_db_version();") != 12) goto finalize;
+    
+    result = true;
+    
+finalize:
+    if (value) cloudsync_memory_free(value);
+    for (int i=0; i<nclients; ++i) {
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_db_version_connections error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+    }
+    if (cleanup_databases) {
+        char buf[256];
+        do_build_database_path(buf, 0, timestamp, saved_counter);
+        file_delete(buf);
+    }
+    return result;
+}
+
+// MARK: -
+
+bool do_test_network_encode_decode (int nclients, bool print_result, bool cleanup_databases, bool force_uncompressed) {
+    sqlite3 *db[MAX_SIMULATED_CLIENTS] = {NULL};
+    bool result = false;
+    int rc = SQLITE_OK;
+    
+    memset(db, 0, sizeof(sqlite3 *) * MAX_SIMULATED_CLIENTS);
+    if (nclients >= MAX_SIMULATED_CLIENTS) {
+        nclients = MAX_SIMULATED_CLIENTS;
+        printf("Number of test merge reduced to %d clients\n", MAX_SIMULATED_CLIENTS);
+    } else if (nclients < 2) {
+        nclients = 2;
+        printf("Number of test merge increased to %d clients\n", 2);
+    }
+    
+    // create databases and tables
+    int table_mask = TEST_PRIKEYS | TEST_NOCOLS;
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        if (do_create_tables(table_mask, db[i]) == false) {
+            return false;
+        }
+        
+        if (do_augment_tables(table_mask, db[i], table_algo_crdt_cls) == false) {
+            return false;
+        }
+    }
+    
+    // insert, update and delete some data in all clients
+    for (int i=0; i<nclients; ++i) {
+        do_insert(db[i], table_mask, NINSERT, print_result);
+        //if (i==0) do_update(db[i], table_mask, print_result);
+        //if (i!=nclients-1) do_delete(db[i], table_mask, print_result);
+    }
+    
+    if (force_uncompressed) force_uncompressed_blob = true;
+    
+    // merge all changes (loop extracted from do_merge and do_merge_values)
+    const char *src_sql = "SELECT cloudsync_payload_encode(tbl, pk, col_name, col_value, col_version, db_version, site_id, cl, seq) FROM cloudsync_changes WHERE site_id=cloudsync_siteid();";
+    const char *dest_sql = "SELECT cloudsync_payload_decode(?);";
+    
+    for (int i=0; i<nclients; ++i) {
+        int target = i;
+        for (int j=0; j<nclients; ++j) {
+            if (target == j) continue;
+            
+            int blob_size = 0, rc;
+            char *blob = dbutils_blob_select (db[target], src_sql, &blob_size, NULL, &rc);
+            if (!blob) goto finalize;
+            
+            const char *values[] = {blob};
+            int types[] = {SQLITE_BLOB};
+            int len[] = {blob_size};
+
+            dbutils_select(db[j], dest_sql, values, types, len, 1, SQLITE_INTEGER);
+            cloudsync_memory_free(blob);
+        }
+    }
+    
+    if (force_uncompressed) force_uncompressed_blob = false;
+    
+    // compare results
+    for (int i=1; i<nclients; ++i) {
+        char *sql = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY first_name, \"" CUSTOMERS_TABLE_COLUMN_LASTNAME "\";", CUSTOMERS_TABLE);
+        bool result = do_compare_queries(db[0], sql, db[i], sql, -1, -1, print_result);
+        sqlite3_free(sql);
+        if (result == false) goto finalize;
+    }
+    
+    if (print_result) {
+        printf("\n-> customers\n");
+        char *sql = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY first_name, \"" CUSTOMERS_TABLE_COLUMN_LASTNAME "\";", CUSTOMERS_TABLE);
+        do_query(db[0], sql, query_table);
+        sqlite3_free(sql);
+    }
+    
+    result = true;
+    rc = SQLITE_OK;
+    
+finalize:
+    for (int i=0; i<nclients; ++i) {
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_merge error: %s\n", sqlite3_errmsg(db[i]));
+        if (db[i]) close_db(db[i]);
+        if (cleanup_databases) {
+            char buf[256];
+            do_build_database_path(buf, i, timestamp, saved_counter++);
+            file_delete(buf);
+        }
+    }
+    return result;
+}
+
+bool do_test_payload_next (int nclients, int payload_version, bool print_result, bool cleanup_databases) {
+    sqlite3 *db[MAX_SIMULATED_CLIENTS] = {NULL};
+    bool result = false;
+    int rc = SQLITE_OK;
+    
+    memset(db, 0, sizeof(sqlite3 *) * MAX_SIMULATED_CLIENTS);
+    if (nclients >= MAX_SIMULATED_CLIENTS) {
+        nclients = MAX_SIMULATED_CLIENTS;
+        printf("Number of test merge reduced to %d clients\n", MAX_SIMULATED_CLIENTS);
+    } else if (nclients < 2) {
+        nclients = 2;
+        printf("Number of test merge increased to %d clients\n", 2);
+    }
+    
+    // create databases and tables
+    int table_mask = TEST_PRIKEYS | TEST_NOCOLS;
+    time_t timestamp = time(NULL);
+    int saved_counter = test_counter;
+    for (int i=0; i<nclients; ++i) {
+        db[i] = do_create_database_file(i, timestamp, test_counter++);
+        if (db[i] == false) return false;
+        
+        if (do_create_tables(table_mask, db[i]) == false) {
+            return false;
+        }
+        
+        if (do_augment_tables(table_mask, db[i], table_algo_crdt_cls) == false) {
+            return false;
+        }
+        
+        // payloads are encoded as version 1 unless a newer version is enabled
+        if (payload_version > 1) {
+            char *sql = sqlite3_mprintf("SELECT cloudsync_set('payload_version', '%d');", payload_version);
+            rc = sqlite3_exec(db[i], sql, NULL, NULL, NULL);
+            sqlite3_free(sql);
+            if (rc != SQLITE_OK) goto finalize;
+        }
+    }
+    
+    // insert some data in all clients
+    for (int i=0; i<nclients; ++i) {
+        do_insert(db[i], table_mask, NINSERT, print_result);
+    }
+    
+    // send all the local changes of each client in small pages (each delivered page is acknowledged to advance the send cursor of the source)
+    const char *src_sql = "SELECT cloudsync_payload_next(512);";
+    const char *dest_sql = "SELECT cloudsync_payload_decode(?);";
+    
+    for (int i=0; i<nclients; ++i) {
+        int npages = 0;
+        while (1) {
+            int blob_size = 0;
+            char *blob = dbutils_blob_select(db[i], src_sql, &blob_size, NULL, &rc);
+            if (rc != SQLITE_OK) goto finalize;
+            if (!blob) break;
+            ++npages;
+
+            // the version byte follows the 4 bytes signature
+            if (blob_size < 32 || blob[4] != payload_version) {cloudsync_memory_free(blob); rc = SQLITE_ERROR; goto finalize;}
+            
+            // the page is returned again until it is acknowledged
+            int blob2_size = 0;
+            char *blob2 = dbutils_blob_select(db[i], src_sql, &blob2_size, NULL, &rc);
+            bool same = (rc == SQLITE_OK && blob2 && blob2_size == blob_size && memcmp(blob, blob2, blob_size) == 0);
+            if (blob2) cloudsync_memory_free(blob2);
+            if (!same) {cloudsync_memory_free(blob); rc = SQLITE_ERROR; goto finalize;}
+
+            for (int j=0; j<nclients; ++j) {
+                if (i == j) continue;
+                
+                const char *values[] = {blob};
+                int types[] = {SQLITE_BLOB};
+                int len[] = {blob_size};
+                dbutils_select(db[j], dest_sql, values, types, len, 1, SQLITE_INTEGER);
+            }
+            cloudsync_memory_free(blob);
+            
+            if (dbutils_int_select(db[i], "SELECT cloudsync_payload_ack();") != 1) {rc = SQLITE_ERROR; goto finalize;}
+        }
+        
+        // changes must not fit in a single page
+        if (npages < 2) {rc = SQLITE_ERROR; goto finalize;}
+    }
+    
+    // compare results
+    for (int i=1; i<nclients; ++i) {
+        char *sql = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY first_name, \"" CUSTOMERS_TABLE_COLUMN_LASTNAME "\";", CUSTOMERS_TABLE);
+        bool result = do_compare_queries(db[0], sql, db[i], sql, -1, -1, print_result);
+        sqlite3_free(sql);
+        if (result == false) goto finalize;
+    }
+    
+    // invalid arguments
+    if (sqlite3_exec(db[0], "SELECT cloudsync_payload_next(0);", NULL, NULL, NULL) == SQLITE_OK) {rc = SQLITE_ERROR; goto finalize;}
+    if (sqlite3_exec(db[0], "SELECT cloudsync_payload_ack();", NULL, NULL, NULL) == SQLITE_OK) {rc = SQLITE_ERROR; goto finalize;}
+    
+    // the send cursor never moves backward
+    if (dbutils_int_select(db[0], "SELECT cloudsync_payload_ack(0, 0);") != 0) {rc = SQLITE_ERROR; goto finalize;}
+    if (dbutils_int_select(db[0], "SELECT count(*) FROM (SELECT cloudsync_payload_next(512) AS p) WHERE p IS NULL;") != 1) {rc = SQLITE_ERROR; goto finalize;}
+    
+    result = true;
+    rc = SQLITE_OK;
+    
+finalize:
+    for (int i=0; i<nclients; ++i) {
+        if (rc != SQLITE_OK && db[i] && (sqlite3_errcode(db[i]) != SQLITE_OK)) printf("do_test_payload_next error: %s\n", sqlite3_errmsg(db[i]));
         if (db[i]) close_db(db[i]);
         if (cleanup_databases) {
             char buf[256];
@@ -3437,6 +4512,7 @@ int main(int argc, const char * argv[]) {
     result += test_report("PK Test:", do_test_pk(db, 10000, print_result));
     result += test_report("UUID Test:", do_test_uuid(db, 1000, print_result));
     result += test_report("Comparison Test:", do_test_compare(db, print_result));
+    result += test_report("Fingerprint Test:", do_test_fingerprint(db, print_result));
     result += test_report("RowID Test:", do_test_rowid(50000, print_result));
     result += test_report("Algo Names Test:", do_test_algo_names());
     result += test_report("DBUtils Test:", do_test_dbutils());
@@ -3455,6 +4531,7 @@ int main(int argc, const char * argv[]) {
     result += test_report("Functions Test:", do_test_functions(db, print_result));
     result += test_report("Functions Test (Int):", do_test_internal_functions());
     result += test_report("String Func Test:", do_test_string_replace_prefix());
+    result += test_report("Arena Test:", do_test_arena());
     
     // close local database
     db = close_db(db);
@@ -3472,8 +4549,23 @@ int main(int argc, const char * argv[]) {
     
     // test grow-only set
     result += test_report("Test GrowOnlySet:", do_test_gos(6, print_result, cleanup_databases));
+    result += test_report("Test Merge Batch:", do_test_merge_batch(2, false, print_result, cleanup_databases));
+    result += test_report("Test Merge Batch Sorted:", do_test_merge_batch(2, true, print_result, cleanup_databases));
+    result += test_report("Test Payload Checkpoint:", do_test_payload_checkpoint(false, print_result, cleanup_databases));
+    result += test_report("Test Payload Checkpoint Sorted:", do_test_payload_checkpoint(true, print_result, cleanup_databases));
+    result += test_report("Test Merge Coalesce:", do_test_merge_coalesce(false, print_result, cleanup_databases));
+    result += test_report("Test Merge Coalesce Callback:", do_test_merge_coalesce(true, print_result, cleanup_databases));
+    result += test_report("Test Merge Flush Fatal:", do_test_merge_flush_fatal(print_result, cleanup_databases));
+    result += test_report("Test SiteID Savepoint:", do_test_siteid_savepoint(print_result, cleanup_databases));
+    result += test_report("Test Apply Errors:", do_test_apply_errors(print_result, cleanup_databases));
+    result += test_report("Test Defer Meta:", do_test_defer_meta(print_result, cleanup_databases));
+    result += test_report("Test Update Triggers:", do_test_update_triggers(print_result, cleanup_databases));
+    result += test_report("Test DB Version Connections:", do_test_db_version_connections(print_result, cleanup_databases));
     result += test_report("Test Network Enc/Dec:", do_test_network_encode_decode(2, print_result, cleanup_databases, false));
     result += test_report("Test Network Enc/Dec 2:", do_test_network_encode_decode(2, print_result, cleanup_databases, true));
+    result += test_report("Test Payload Next:", do_test_payload_next(2, 1, print_result, cleanup_databases));
+    result += test_report("Test Payload Next v2:", do_test_payload_next(2, 2, print_result, cleanup_databases));
+    result += test_report("Test Payload Next v3:", do_test_payload_next(2, 3, print_result, cleanup_databases));
     result += test_report("Test Fill Initial Data:", do_test_fill_initial_data(3, print_result, cleanup_databases));
     result += test_report("Test Alter Table 1:", do_test_alter(3, 1, print_result, cleanup_databases));
     result += test_report("Test Alter Table 2:", do_test_alter(3, 2, print_result, cleanup_databases));